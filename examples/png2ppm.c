@@ -1,7 +1,7 @@
 /**
  * \file png2ppm.c
  *
- * Compile with : gcc -o png2ppm png2ppm.c -DHAVE_LIBPNG -L. -lyImage -lpng -lz
+ * Compile with : gcc -o png2ppm png2ppm.c -DHAVE_LIBPNG -L. -lyImage -lpng -lz -lm
  */
 
 
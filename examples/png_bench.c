@@ -0,0 +1,141 @@
+/**
+ * \file png_bench.c
+ *
+ * Compare the PNG codec of the library with libpng used directly.
+ * Build the library without libpng to measure the built-in codec :
+ *
+ * HAVE_PNG=no make -C .. && make png_bench
+ *
+ * Usage : png_bench [file.png] [iterations]
+ * Without file, a synthetic 2048x2048 image is used.
+ */
+
+
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "yImage.h"
+#include "yImage_io.h"
+
+
+static double now(void) {
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+/** a photo-like gradient with flat areas */
+static yImage *synthetic_image(int width, int height) {
+
+    int err, x, y;
+    yImage *im = y_create_image(&err, NULL, width, height);
+
+    if(im == NULL) return NULL;
+
+    for(y=0; y<height; y++) {
+        for(x=0; x<width; x++) {
+            unsigned char *rgb = im->rgbData + 3 * ((size_t) y * width + x);
+            int flat = ((x / 256) + (y / 256)) % 3 == 0;
+            rgb[0] = flat ? 200 : x * 255 / width;
+            rgb[1] = flat ? 120 : y * 255 / height;
+            rgb[2] = flat ? 40 : (x + y + (rand() & 7)) & 0xFF;
+        }
+    }
+
+    return im;
+}
+
+
+static void report(const char *name, double seconds, int iterations, size_t pixels, size_t size) {
+
+    double mpixels = pixels * (double) iterations / seconds / 1e6;
+    printf("%-24s %8.1f ms %8.1f Mpixel/s %10lu bytes\n", name, 1000 * seconds / iterations, mpixels,
+        (unsigned long) size);
+}
+
+
+int main(int argc, char **argv) {
+
+    yImage *im, *decoded;
+    yBuffer buffer;
+    png_image image;
+    unsigned char *rgba, *pixels;
+    png_alloc_size_t pngSize = 0;
+    void *pngData;
+    size_t n;
+    double start;
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    int i;
+
+    im = argc > 1 ? y_load_png(argv[1]) : synthetic_image(2048, 2048);
+    if(im == NULL || iterations < 1) {
+        fprintf(stderr, "Usage : %s [file.png] [iterations]\n", argv[0]);
+        return 1;
+    }
+    n = (size_t) im->rgbWidth * im->rgbHeight;
+
+    /* same RGBA pixels for libpng */
+    rgba = malloc(n * 4);
+    pixels = malloc(n * 4);
+    if(rgba == NULL || pixels == NULL) return 2;
+    for(i=0; i<(int) n; i++) {
+        memcpy(rgba + 4 * i, im->rgbData + 3 * i, 3);
+        rgba[4 * i + 3] = im->alphaChanel[i];
+    }
+
+    /* encoding */
+    y_init_buffer(&buffer);
+    start = now();
+    for(i=0; i<iterations; i++) {
+        y_release_buffer(&buffer);
+        if(y_encode_png(im, y_buffer_write, &buffer)) return 3;
+    }
+    report("yImage encode", now() - start, iterations, n, buffer.size);
+
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = im->rgbWidth;
+    image.height = im->rgbHeight;
+    image.format = PNG_FORMAT_RGBA;
+    png_image_write_get_memory_size(image, pngSize, 0, rgba, 0, NULL);
+    pngData = malloc(pngSize);
+    start = now();
+    for(i=0; i<iterations; i++) {
+        png_alloc_size_t size = pngSize;
+        if(!png_image_write_to_memory(&image, pngData, &size, 0, rgba, 0, NULL)) return 4;
+        if(i == iterations - 1) pngSize = size;
+    }
+    report("libpng encode", now() - start, iterations, n, pngSize);
+
+    /* decoding */
+    start = now();
+    for(i=0; i<iterations; i++) {
+        decoded = y_decode_png(buffer.data, buffer.size);
+        if(decoded == NULL) return 5;
+        y_destroy_image(decoded);
+    }
+    report("yImage decode", now() - start, iterations, n, buffer.size);
+
+    start = now();
+    for(i=0; i<iterations; i++) {
+        memset(&image, 0, sizeof(image));
+        image.version = PNG_IMAGE_VERSION;
+        if(!png_image_begin_read_from_memory(&image, pngData, pngSize)) return 6;
+        image.format = PNG_FORMAT_RGBA;
+        if(!png_image_finish_read(&image, NULL, pixels, 0, NULL)) return 6;
+    }
+    report("libpng decode", now() - start, iterations, n, pngSize);
+
+    free(pngData);
+    free(pixels);
+    free(rgba);
+    y_release_buffer(&buffer);
+    y_destroy_image(im);
+
+    return 0;
+}
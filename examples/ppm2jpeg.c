@@ -1,7 +1,7 @@
 /**
  * \file ppm2jpeg.c
  *
- * Compile with : gcc -o ppm2jpeg ppm2jpeg.c -DHAVE_LIBJPEG -L. -lyImage -ljpeg
+ * Compile with : gcc -o ppm2jpeg ppm2jpeg.c -DHAVE_LIBJPEG -L. -lyImage -ljpeg -lm
  */
 
 
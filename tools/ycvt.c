@@ -0,0 +1,460 @@
+/**
+ * \file ycvt.c
+ *
+ * Convert many image files in one process, on parallel threads.
+ *
+ * Usage : ycvt [options] file|directory...
+ *
+ *  -f format   output format : png (default), ppm, qoi, jpeg or tiff
+ *  -o dir      output directory (default : next to each input file)
+ *  -l list     read the input files from a list, one by line ("-" for stdin)
+ *  -j threads  number of files converted at once (default : one by processor)
+ *  -m MiB      bound of the memory used by the images being converted (default 512)
+ *  -q quality  JPEG quality, from 1 to 100
+ *  -v          print each converted file
+ *
+ * The input format is found from the content of each file. The files of
+ * the directories are converted, without recursion. The converted file
+ * takes the name of the input file with the extension of the format. The
+ * files whose converted file would have the name of another converted
+ * file, or of an input file, are not converted (for example a.png and
+ * a.jpg to qoi). The throughput is reported at the end.
+ *
+ * Build the library, then : make -C tools
+ */
+
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "yImage.h"
+#include "yImage_io.h"
+#include "yThread.h"
+
+
+/** default bound of the memory used by the images, in MiB */
+#define DEFAULT_MEMORY_LIMIT 512
+
+/** bytes of memory counted by pixel : the image, and the codecs' buffers */
+#define BYTES_BY_PIXEL 8
+
+
+/** a list of filenames */
+typedef struct {
+    char **names;
+    int size;
+    int capacity;
+} file_list_t;
+
+
+/** a name of the input or converted files, to find the conflicts */
+typedef struct {
+    const char *name;
+    int index;
+    int converted; /* set for the name of a converted file */
+} file_name_t;
+
+
+/** the conversion of all the files */
+typedef struct {
+    file_list_t *files;
+    char **outputs; /* name of the converted file of each input file, NULL if it is not converted */
+    const char *outDir;
+    const char *extension;
+    yImageFormat format;
+    int quality;
+    int verbose;
+
+    /* memory of the images being converted */
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    size_t memoryUsed;
+    size_t memoryLimit;
+
+    /* statistics, protected by "lock" */
+    long converted;
+    long failed;
+    unsigned long long bytesRead;
+    unsigned long long bytesWritten;
+} converter_t;
+
+
+static double now(void) {
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static void usage(void) {
+
+    fprintf(stderr, "Usage : ycvt [-f png|ppm|qoi|jpeg|tiff] [-o dir] [-l list] [-j threads] [-m MiB] [-q quality] [-v]"
+        " file|directory...\n");
+}
+
+
+/** \return 0 in case of success */
+static int add_file(file_list_t *list, const char *name) {
+
+    if(list->size == list->capacity) {
+        int capacity = list->capacity > 0 ? 2 * list->capacity : 256;
+        char **names = realloc(list->names, capacity * sizeof(char *));
+        if(names == NULL) return 1;
+        list->names = names;
+        list->capacity = capacity;
+    }
+
+    list->names[list->size] = strdup(name);
+    if(list->names[list->size] == NULL) return 1;
+    list->size++;
+    return 0;
+}
+
+
+/** add a file, or the regular files of a directory, \return 0 in case of success */
+static int add_path(file_list_t *list, const char *path) {
+
+    struct stat st;
+    struct dirent *entry;
+    DIR *dir;
+    char *name;
+    int err = 0;
+
+    if(stat(path, &st) || !S_ISDIR(st.st_mode)) {
+        return add_file(list, path);
+    }
+
+    dir = opendir(path);
+    if(dir == NULL) {
+        fprintf(stderr, "Could not read directory %s\n", path);
+        return 1;
+    }
+
+    while(!err && (entry = readdir(dir)) != NULL) {
+        if(entry->d_name[0] == '.') continue;
+
+        name = malloc(strlen(path) + strlen(entry->d_name) + 2);
+        if(name == NULL) {
+            err = 1;
+            break;
+        }
+        sprintf(name, "%s/%s", path, entry->d_name);
+        if(!stat(name, &st) && S_ISREG(st.st_mode)) {
+            err = add_file(list, name);
+        }
+        free(name);
+    }
+
+    closedir(dir);
+    return err;
+}
+
+
+/** add the files named in a list, one by line, \return 0 in case of success */
+static int add_list(file_list_t *list, const char *listFile) {
+
+    char line[4096];
+    FILE *f = strcmp(listFile, "-") ? fopen(listFile, "r") : stdin;
+    int err = 0;
+
+    if(f == NULL) {
+        fprintf(stderr, "Could not open list %s\n", listFile);
+        return 1;
+    }
+
+    while(!err && fgets(line, sizeof(line), f) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        line[length] = '\0';
+        if(length > 0) err = add_file(list, line);
+    }
+
+    if(f != stdin) fclose(f);
+    return err;
+}
+
+
+/** \return the name of the converted file, to free */
+static char *output_name(converter_t *cvt, const char *input) {
+
+    const char *base = strrchr(input, '/');
+    const char *dot;
+    size_t dirLength, baseLength;
+    char *name;
+
+    base = base != NULL ? base + 1 : input;
+    dot = strrchr(base, '.');
+    baseLength = dot != NULL && dot != base ? (size_t) (dot - base) : strlen(base);
+    dirLength = cvt->outDir != NULL ? strlen(cvt->outDir) + 1 : (size_t) (base - input);
+
+    name = malloc(dirLength + baseLength + strlen(cvt->extension) + 2);
+    if(name == NULL) return NULL;
+
+    if(cvt->outDir != NULL) {
+        sprintf(name, "%s/", cvt->outDir);
+    } else {
+        memcpy(name, input, dirLength);
+        name[dirLength] = '\0';
+    }
+    strncat(name, base, baseLength);
+    strcat(name, ".");
+    strcat(name, cvt->extension);
+    return name;
+}
+
+
+static int compare_names(const void *a, const void *b) {
+
+    const file_name_t *na = a, *nb = b;
+    int cmp = strcmp(na->name, nb->name);
+
+    if(cmp) return cmp;
+    return na->index - nb->index;
+}
+
+
+/**
+ * Compute the names of the converted files, and refuse the files whose
+ * converted file has the name of another input or converted file.
+ * \return 0 in case of success
+ */
+static int init_outputs(converter_t *cvt) {
+
+    file_list_t *files = cvt->files;
+    file_name_t *names;
+    int i, j, k, nb = 2 * files->size;
+
+    cvt->outputs = calloc(files->size, sizeof(char *));
+    names = malloc(nb * sizeof(file_name_t));
+    if(cvt->outputs == NULL || names == NULL) {
+        free(names);
+        return 1;
+    }
+
+    for(i = 0; i < files->size; i++) {
+        cvt->outputs[i] = output_name(cvt, files->names[i]);
+        if(cvt->outputs[i] == NULL) {
+            free(names);
+            return 1;
+        }
+        names[2*i].name = files->names[i];
+        names[2*i].index = i;
+        names[2*i].converted = 0;
+        names[2*i+1].name = cvt->outputs[i];
+        names[2*i+1].index = i;
+        names[2*i+1].converted = 1;
+    }
+
+    /* the equal names are next to each other once sorted */
+    qsort(names, nb, sizeof(file_name_t), compare_names);
+
+    for(i = 0; i < nb; i = j) {
+        for(j = i + 1; j < nb && !strcmp(names[j].name, names[i].name); j++);
+        if(j - i == 1) continue;
+
+        /* the name of an input file appears once : the other ones are converted files */
+        for(k = i; k < j; k++) {
+            int index = names[k].index;
+            if(!names[k].converted) continue;
+
+            if(j - i == 2 && names[i].index == names[i+1].index) {
+                fprintf(stderr, "%s : the converted file would replace it\n", files->names[index]);
+            } else {
+                fprintf(stderr, "%s : %s would also be read or written for another file\n",
+                    files->names[index], cvt->outputs[index]);
+            }
+            free(cvt->outputs[index]);
+            cvt->outputs[index] = NULL;
+            cvt->failed++;
+        }
+    }
+
+    free(names);
+    return 0;
+}
+
+
+/** \return 0 in case of success */
+static int save_image(converter_t *cvt, yImage *im, const char *file) {
+
+    yPngOptions png;
+    yJpegOptions jpeg;
+    yTiffOptions tiff;
+
+    /* the files are converted in parallel : each one is encoded on its own thread */
+    switch(cvt->format) {
+        case Y_FORMAT_PPM:
+            return y_save_ppm(im, file);
+        case Y_FORMAT_QOI:
+            return y_save_qoi(im, file);
+        case Y_FORMAT_JPEG:
+            y_init_jpeg_options(&jpeg);
+            if(cvt->quality > 0) jpeg.quality = cvt->quality;
+            return y_save_jpeg_with_options(im, file, &jpeg);
+        case Y_FORMAT_TIFF:
+            y_init_tiff_options(&tiff);
+            tiff.threads = 1;
+            return y_save_tiff_with_options(im, file, &tiff);
+        default:
+            y_init_png_options(&png);
+            png.threads = 1;
+            return y_save_png_with_options(im, file, &png);
+    }
+}
+
+
+/** wait until "size" bytes fit in the memory bound, alone if they are more than it */
+static void reserve_memory(converter_t *cvt, size_t size) {
+
+    pthread_mutex_lock(&cvt->lock);
+    while(cvt->memoryUsed > 0 && cvt->memoryUsed + size > cvt->memoryLimit) {
+        pthread_cond_wait(&cvt->released, &cvt->lock);
+    }
+    cvt->memoryUsed += size;
+    pthread_mutex_unlock(&cvt->lock);
+}
+
+
+/** give back the memory of a converted file, and count it */
+static void release_memory(converter_t *cvt, size_t size, int failed, off_t bytesRead, off_t bytesWritten) {
+
+    pthread_mutex_lock(&cvt->lock);
+    cvt->memoryUsed -= size;
+    if(failed) {
+        cvt->failed++;
+    } else {
+        cvt->converted++;
+        cvt->bytesRead += bytesRead;
+        cvt->bytesWritten += bytesWritten;
+    }
+    pthread_cond_broadcast(&cvt->released);
+    pthread_mutex_unlock(&cvt->lock);
+}
+
+
+/** task converting the file "index" */
+static void convert_file(void *data, int index) {
+
+    converter_t *cvt = data;
+    const char *input = cvt->files->names[index];
+    const char *output = cvt->outputs[index];
+    yImageInfo info;
+    yImage *im = NULL;
+    size_t size = 0;
+    struct stat in, out;
+    int err = 1;
+
+    /* refused by init_outputs() */
+    if(output == NULL) return;
+
+    if(y_probe(input, &info) || stat(input, &in)) {
+        fprintf(stderr, "%s : unknown format\n", input);
+    } else {
+        /* the header gives the memory needed before the image is decoded */
+        size = (size_t) info.width * info.height * BYTES_BY_PIXEL;
+        reserve_memory(cvt, size);
+
+        im = y_load_image(input);
+        if(im == NULL) {
+            fprintf(stderr, "%s : could not be decoded\n", input);
+        } else if(save_image(cvt, im, output) || stat(output, &out)) {
+            fprintf(stderr, "%s : could not write %s\n", input, output);
+        } else {
+            err = 0;
+            if(cvt->verbose) printf("%s -> %s\n", input, output);
+        }
+        y_destroy_image(im);
+    }
+
+    release_memory(cvt, size, err, err ? 0 : in.st_size, err ? 0 : out.st_size);
+}
+
+
+static int parse_format(const char *name, yImageFormat *format, const char **extension) {
+
+    if(!strcmp(name, "png")) { *format = Y_FORMAT_PNG; *extension = "png"; }
+    else if(!strcmp(name, "ppm")) { *format = Y_FORMAT_PPM; *extension = "ppm"; }
+    else if(!strcmp(name, "qoi")) { *format = Y_FORMAT_QOI; *extension = "qoi"; }
+    else if(!strcmp(name, "jpeg") || !strcmp(name, "jpg")) { *format = Y_FORMAT_JPEG; *extension = "jpg"; }
+    else if(!strcmp(name, "tiff") || !strcmp(name, "tif")) { *format = Y_FORMAT_TIFF; *extension = "tif"; }
+    else return 1;
+
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+
+    converter_t cvt;
+    file_list_t files = { NULL, 0, 0 };
+    int nbThreads = 0, option, i, err = 0;
+    double start, seconds;
+
+    memset(&cvt, 0, sizeof(cvt));
+    cvt.files = &files;
+    cvt.format = Y_FORMAT_PNG;
+    cvt.extension = "png";
+    cvt.memoryLimit = (size_t) DEFAULT_MEMORY_LIMIT << 20;
+
+    while((option = getopt(argc, argv, "f:o:l:j:m:q:v")) != -1) {
+        switch(option) {
+            case 'f':
+                if(parse_format(optarg, &cvt.format, &cvt.extension)) {
+                    fprintf(stderr, "Unknown format %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'o': cvt.outDir = optarg; break;
+            case 'l': err |= add_list(&files, optarg); break;
+            case 'j': nbThreads = atoi(optarg); break;
+            case 'm': cvt.memoryLimit = (size_t) atol(optarg) << 20; break;
+            case 'q': cvt.quality = atoi(optarg); break;
+            case 'v': cvt.verbose = 1; break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    for(i = optind; i < argc; i++) {
+        err |= add_path(&files, argv[i]);
+    }
+
+    if(err || files.size == 0) {
+        if(files.size == 0) usage();
+        return 1;
+    }
+
+    if(init_outputs(&cvt)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    pthread_mutex_init(&cvt.lock, NULL);
+    pthread_cond_init(&cvt.released, NULL);
+
+    start = now();
+    y_parallel_for(files.size, nbThreads, convert_file, &cvt);
+    seconds = now() - start;
+
+    printf("%ld files converted, %ld failed, in %.2f s : %.1f files/s, %.1f MB/s read, %.1f MB/s written\n",
+        cvt.converted, cvt.failed, seconds, cvt.converted / seconds,
+        cvt.bytesRead / seconds / 1e6, cvt.bytesWritten / seconds / 1e6);
+
+    pthread_cond_destroy(&cvt.released);
+    pthread_mutex_destroy(&cvt.lock);
+    for(i = 0; i < files.size; i++) {
+        free(files.names[i]);
+        free(cvt.outputs[i]);
+    }
+    free(files.names);
+    free(cvt.outputs);
+
+    return cvt.failed > 0;
+}
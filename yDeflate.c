@@ -0,0 +1,752 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yDeflate.c
+ * \brief deflate compression and checksums, without zlib.
+ *
+ * The CRC is computed 8 bytes at a time with 8 lookup tables
+ * ("slicing-by-8"). The decompressor decodes the Huffman codes of up to
+ * FAST_BITS bits with a single table lookup.
+ */
+
+#include "yDeflate.h"
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+/** largest prime smaller than 65536 */
+#define ADLER_BASE 65521
+/** largest n such that 255n(n+1)/2 + (n+1)(ADLER_BASE-1) fits in 32 bits */
+#define ADLER_NMAX 5552
+
+/** maximum length of a stored block */
+#define STORED_MAX 65535
+
+/** bits of the Huffman codes decoded by a table lookup */
+#define FAST_BITS 10
+
+/** maximum length of a Huffman code */
+#define MAX_BITS 15
+
+
+
+/************************************************************/
+/*                   TABLES                                 */
+/************************************************************/
+
+
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/** order of the code length codes in a dynamic block header */
+static const uint8_t codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+
+/** a Huffman code, for decoding */
+typedef struct {
+    uint16_t fast[1 << FAST_BITS]; /**< symbol << 4 | length of the short codes, 0 for longer codes */
+    uint16_t count[MAX_BITS + 1]; /**< number of codes of each length */
+    uint16_t symbol[288]; /**< symbols ordered by code */
+} huffman_t;
+
+
+/** a code to write : bits in the order of the stream, and their number */
+typedef struct {
+    uint32_t bits;
+    int length;
+} code_t;
+
+
+static uint32_t crcTable[8][256];
+
+/** fixed literal/length codes */
+static code_t fixedLiteral[288];
+/** fixed codes of the matches at distance 1, by length, extra bits included */
+static code_t fixedRun[259];
+
+static huffman_t fixedLiteralDecoder;
+static huffman_t fixedDistDecoder;
+
+
+static uint32_t reverse_bits(uint32_t code, int length) {
+
+    uint32_t reversed = 0;
+    int i;
+
+    for(i=0; i<length; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+
+    return reversed;
+}
+
+
+static int build_huffman(huffman_t *h, const uint8_t *lengths, int n);
+
+
+static void init_tables(void) {
+
+    uint8_t lengths[288];
+    uint32_t c;
+    int n, k, sym;
+
+    for(n=0; n<256; n++) {
+        c = n;
+        for(k=0; k<8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        crcTable[0][n] = c;
+    }
+    for(n=0; n<256; n++) {
+        c = crcTable[0][n];
+        for(k=1; k<8; k++) {
+            c = crcTable[0][c & 0xFF] ^ (c >> 8);
+            crcTable[k][n] = c;
+        }
+    }
+
+    /* fixed codes of RFC 1951, 3.2.6 */
+    for(n=0; n<288; n++) {
+        if(n < 144) {
+            fixedLiteral[n].bits = reverse_bits(0x30 + n, 8);
+            fixedLiteral[n].length = 8;
+        } else if(n < 256) {
+            fixedLiteral[n].bits = reverse_bits(0x190 + n - 144, 9);
+            fixedLiteral[n].length = 9;
+        } else if(n < 280) {
+            fixedLiteral[n].bits = reverse_bits(n - 256, 7);
+            fixedLiteral[n].length = 7;
+        } else {
+            fixedLiteral[n].bits = reverse_bits(0xC0 + n - 280, 8);
+            fixedLiteral[n].length = 8;
+        }
+        lengths[n] = fixedLiteral[n].length;
+    }
+
+    /* length code, extra bits, then distance code 0 (5 zero bits) */
+    for(sym=0, n=3; n<=258; n++) {
+        while(sym < 28 && lengthBase[sym+1] <= n) sym++;
+        fixedRun[n].bits = fixedLiteral[257 + sym].bits | ((n - lengthBase[sym]) << fixedLiteral[257 + sym].length);
+        fixedRun[n].length = fixedLiteral[257 + sym].length + lengthExtra[sym] + 5;
+    }
+
+    build_huffman(&fixedLiteralDecoder, lengths, 288);
+    memset(lengths, 5, 30);
+    build_huffman(&fixedDistDecoder, lengths, 30);
+}
+
+
+#ifdef HAVE_PTHREAD
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+#else
+static int tablesReady = 0;
+#endif
+
+
+static void check_tables(void) {
+
+    #ifdef HAVE_PTHREAD
+    pthread_once(&tablesOnce, init_tables);
+    #else
+    if(!tablesReady) {
+        init_tables();
+        tablesReady = 1;
+    }
+    #endif
+}
+
+
+
+/************************************************************/
+/*                   CHECKSUMS                              */
+/************************************************************/
+
+
+uint32_t y_crc32(uint32_t crc, const unsigned char *data, size_t length) {
+
+    check_tables();
+
+    crc = ~crc;
+
+    while(length >= 8) {
+        uint32_t one = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24));
+        uint32_t two = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t) data[7] << 24);
+        crc = crcTable[7][one & 0xFF] ^ crcTable[6][(one >> 8) & 0xFF] ^
+            crcTable[5][(one >> 16) & 0xFF] ^ crcTable[4][one >> 24] ^
+            crcTable[3][two & 0xFF] ^ crcTable[2][(two >> 8) & 0xFF] ^
+            crcTable[1][(two >> 16) & 0xFF] ^ crcTable[0][two >> 24];
+        data += 8;
+        length -= 8;
+    }
+
+    while(length--) {
+        crc = crcTable[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+
+uint32_t y_adler32(uint32_t adler, const unsigned char *data, size_t length) {
+
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while(length > 0) {
+
+        /* the modulo is taken only when the sums could overflow */
+        size_t n = length < ADLER_NMAX ? length : ADLER_NMAX;
+        length -= n;
+
+        while(n >= 8) {
+            a += data[0]; b += a;
+            a += data[1]; b += a;
+            a += data[2]; b += a;
+            a += data[3]; b += a;
+            a += data[4]; b += a;
+            a += data[5]; b += a;
+            a += data[6]; b += a;
+            a += data[7]; b += a;
+            data += 8;
+            n -= 8;
+        }
+        while(n--) {
+            a += *data++;
+            b += a;
+        }
+
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+
+uint32_t y_adler32_combine(uint32_t adler1, uint32_t adler2, size_t length2) {
+
+    uint32_t rem = length2 % ADLER_BASE;
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (rem * sum1) % ADLER_BASE;
+
+    sum1 += (adler2 & 0xFFFF) + ADLER_BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+    if(sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if(sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if(sum2 >= 2 * ADLER_BASE) sum2 -= 2 * ADLER_BASE;
+    if(sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+
+    return (sum2 << 16) | sum1;
+}
+
+
+
+/************************************************************/
+/*                   COMPRESSION                            */
+/************************************************************/
+
+
+typedef struct {
+    unsigned char *out;
+    size_t pos;
+    uint64_t bits; /**< pending bits, the first ones in the low bits */
+    int count; /**< number of pending bits */
+} bit_writer_t;
+
+
+static void put_bits(bit_writer_t *w, uint32_t bits, int length) {
+
+    w->bits |= (uint64_t) bits << w->count;
+    w->count += length;
+
+    if(w->count >= 32) {
+        w->out[w->pos++] = w->bits;
+        w->out[w->pos++] = w->bits >> 8;
+        w->out[w->pos++] = w->bits >> 16;
+        w->out[w->pos++] = w->bits >> 24;
+        w->bits >>= 32;
+        w->count -= 32;
+    }
+}
+
+
+/** write the pending bits, padded to a byte boundary */
+static void flush_bits(bit_writer_t *w) {
+
+    while(w->count > 0) {
+        w->out[w->pos++] = w->bits;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+    w->bits = 0;
+    w->count = 0;
+}
+
+
+static size_t stored_size(size_t length) {
+    return length + 5 * (length / STORED_MAX + 1);
+}
+
+
+static size_t deflate_stored(const unsigned char *data, size_t length, int last, unsigned char *out) {
+
+    size_t pos = 0;
+
+    do {
+        size_t n = length < STORED_MAX ? length : STORED_MAX;
+        length -= n;
+
+        if(n == 0 && !last) break;
+
+        out[pos++] = (last && length == 0) ? 1 : 0;
+        out[pos++] = n & 0xFF;
+        out[pos++] = n >> 8;
+        out[pos++] = ~n & 0xFF;
+        out[pos++] = (~n >> 8) & 0xFF;
+        memcpy(out + pos, data, n);
+        data += n;
+        pos += n;
+    } while(length > 0);
+
+    return pos;
+}
+
+
+static size_t deflate_rle(const unsigned char *data, size_t length, int last, unsigned char *out) {
+
+    bit_writer_t w;
+    size_t i = 0;
+
+    w.out = out;
+    w.pos = 0;
+    w.bits = 0;
+    w.count = 0;
+
+    /* BFINAL, then BTYPE 01 : fixed Huffman codes */
+    put_bits(&w, last ? 3 : 2, 3);
+
+    if(length > 0) {
+        put_bits(&w, fixedLiteral[data[0]].bits, fixedLiteral[data[0]].length);
+        i = 1;
+    }
+
+    while(i < length) {
+
+        unsigned char previous = data[i-1];
+        size_t run = 0;
+
+        if(data[i] == previous) {
+            size_t max = length - i < 258 ? length - i : 258;
+            run = 1;
+            while(run < max && data[i+run] == previous) run++;
+        }
+
+        if(run >= 3) {
+            put_bits(&w, fixedRun[run].bits, fixedRun[run].length);
+            i += run;
+        } else {
+            put_bits(&w, fixedLiteral[data[i]].bits, fixedLiteral[data[i]].length);
+            i++;
+        }
+    }
+
+    /* end of block */
+    put_bits(&w, fixedLiteral[256].bits, fixedLiteral[256].length);
+
+    if(!last) {
+        /* empty stored block, to end on a byte boundary */
+        put_bits(&w, 0, 3);
+        flush_bits(&w);
+        out[w.pos++] = 0;
+        out[w.pos++] = 0;
+        out[w.pos++] = 0xFF;
+        out[w.pos++] = 0xFF;
+    }
+
+    flush_bits(&w);
+    return w.pos;
+}
+
+
+size_t y_deflate_bound(size_t length) {
+    return length + length / 8 + 5 * (length / STORED_MAX + 1) + 16;
+}
+
+
+size_t y_deflate(const unsigned char *data, size_t length, yDeflateMode mode, int last, unsigned char *out) {
+
+    check_tables();
+
+    if(mode == Y_DEFLATE_RLE) {
+        size_t size = deflate_rle(data, length, last, out);
+        if(size <= stored_size(length)) return size;
+    }
+
+    return deflate_stored(data, length, last, out);
+}
+
+
+
+/************************************************************/
+/*                   DECOMPRESSION                          */
+/************************************************************/
+
+
+typedef struct {
+    const unsigned char *in;
+    size_t size;
+    size_t pos; /**< position of the next byte to read, possibly after the end */
+    uint64_t bits;
+    int count;
+} bit_reader_t;
+
+
+/** load at least 56 bits, with zeros after the end of the data */
+static void refill(bit_reader_t *r) {
+
+    while(r->count <= 56) {
+        uint64_t byte = r->pos < r->size ? r->in[r->pos] : 0;
+        r->pos++;
+        r->bits |= byte << r->count;
+        r->count += 8;
+    }
+}
+
+
+static uint32_t get_bits(bit_reader_t *r, int length) {
+
+    uint32_t value = r->bits & ((1u << length) - 1);
+    r->bits >>= length;
+    r->count -= length;
+    return value;
+}
+
+
+/** \return non zero if bits after the end of the data were used */
+static int overrun(bit_reader_t *r) {
+    return r->pos > r->size && (r->pos - r->size) * 8 > (size_t) r->count;
+}
+
+
+/**
+ * Build a decoder from the code lengths of "n" symbols.
+ * \return 0, or Y_DEFLATE_ERR_DATA for an over-subscribed code
+ */
+static int build_huffman(huffman_t *h, const uint8_t *lengths, int n) {
+
+    uint16_t offsets[MAX_BITS + 2];
+    uint32_t code = 0;
+    int left = 1;
+    int i, len;
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+
+    for(i=0; i<n; i++) h->count[lengths[i]]++;
+    h->count[0] = 0;
+
+    for(len=1; len<=MAX_BITS; len++) {
+        left = (left << 1) - h->count[len];
+        if(left < 0) return Y_DEFLATE_ERR_DATA;
+    }
+
+    offsets[1] = 0;
+    for(len=1; len<=MAX_BITS; len++) offsets[len+1] = offsets[len] + h->count[len];
+
+    for(i=0; i<n; i++) {
+        if(lengths[i]) h->symbol[offsets[lengths[i]]++] = i;
+    }
+
+    /* canonical codes, in the order of the symbols table */
+    for(i=0, len=1; len<=FAST_BITS; len++) {
+        int k;
+        for(k=0; k<h->count[len]; k++, i++, code++) {
+            uint32_t reversed = reverse_bits(code, len);
+            for(; reversed < (1 << FAST_BITS); reversed += 1 << len) {
+                h->fast[reversed] = (h->symbol[i] << 4) | len;
+            }
+        }
+        code <<= 1;
+    }
+
+    return 0;
+}
+
+
+/** \return the next symbol, or -1 for an invalid code */
+static int decode_symbol(bit_reader_t *r, huffman_t *h) {
+
+    int entry = h->fast[r->bits & ((1 << FAST_BITS) - 1)];
+    int code = 0, first = 0, index = 0;
+    int len;
+
+    if(entry) {
+        get_bits(r, entry & 15);
+        return entry >> 4;
+    }
+
+    /* longer codes, read bit by bit */
+    for(len=1; len<=MAX_BITS; len++) {
+        int count = h->count[len];
+        code |= (r->bits >> (len - 1)) & 1;
+        if(code - count < first) {
+            get_bits(r, len);
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+
+/** read the code lengths of a dynamic block */
+static int read_dynamic_codes(bit_reader_t *r, huffman_t *literals, huffman_t *distances) {
+
+    uint8_t lengths[288 + 32];
+    huffman_t lengthDecoder;
+    int nbLiterals, nbDistances, nbLengthCodes;
+    int i;
+
+    refill(r);
+    nbLiterals = get_bits(r, 5) + 257;
+    nbDistances = get_bits(r, 5) + 1;
+    nbLengthCodes = get_bits(r, 4) + 4;
+    if(nbLiterals > 286 || nbDistances > 30) return Y_DEFLATE_ERR_DATA;
+
+    memset(lengths, 0, 19);
+    for(i=0; i<nbLengthCodes; i++) {
+        refill(r);
+        lengths[codeLengthOrder[i]] = get_bits(r, 3);
+    }
+    if(build_huffman(&lengthDecoder, lengths, 19)) return Y_DEFLATE_ERR_DATA;
+
+    for(i=0; i<nbLiterals + nbDistances;) {
+
+        int sym, repeat;
+        uint8_t value = 0;
+
+        refill(r);
+        sym = decode_symbol(r, &lengthDecoder);
+        if(sym < 0) return Y_DEFLATE_ERR_DATA;
+
+        if(sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+
+        if(sym == 16) {
+            if(i == 0) return Y_DEFLATE_ERR_DATA;
+            value = lengths[i-1];
+            repeat = 3 + get_bits(r, 2);
+        } else if(sym == 17) {
+            repeat = 3 + get_bits(r, 3);
+        } else {
+            repeat = 11 + get_bits(r, 7);
+        }
+
+        if(i + repeat > nbLiterals + nbDistances) return Y_DEFLATE_ERR_DATA;
+        while(repeat--) lengths[i++] = value;
+    }
+
+    /* the end of block code is needed */
+    if(lengths[256] == 0) return Y_DEFLATE_ERR_DATA;
+
+    if(build_huffman(literals, lengths, nbLiterals)) return Y_DEFLATE_ERR_DATA;
+    if(build_huffman(distances, lengths + nbLiterals, nbDistances)) return Y_DEFLATE_ERR_DATA;
+
+    return overrun(r) ? Y_DEFLATE_ERR_DATA : 0;
+}
+
+
+/** decode the symbols of a compressed block */
+static int inflate_codes(bit_reader_t *r, huffman_t *literals, huffman_t *distances,
+    unsigned char *out, size_t outSize, size_t *pos) {
+
+    size_t p = *pos;
+
+    for(;;) {
+
+        int sym, full = 0;
+        size_t length, dist;
+
+        refill(r);
+        sym = decode_symbol(r, literals);
+
+        if(sym < 256) {
+            if(sym < 0) return Y_DEFLATE_ERR_DATA;
+            if(p >= outSize) break;
+            out[p++] = sym;
+            continue;
+        }
+
+        if(sym == 256) {
+            *pos = p;
+            return overrun(r) ? Y_DEFLATE_ERR_DATA : 0;
+        }
+
+        sym -= 257;
+        if(sym >= 29) return Y_DEFLATE_ERR_DATA;
+        length = lengthBase[sym] + get_bits(r, lengthExtra[sym]);
+
+        refill(r);
+        sym = decode_symbol(r, distances);
+        if(sym < 0 || sym >= 30) return Y_DEFLATE_ERR_DATA;
+        dist = distBase[sym] + get_bits(r, distExtra[sym]);
+
+        if(dist > p) return Y_DEFLATE_ERR_DATA;
+        if(length > outSize - p) {
+            length = outSize - p;
+            full = 1;
+        }
+
+        if(dist >= length) {
+            memcpy(out + p, out + p - dist, length);
+            p += length;
+        } else {
+            /* the copy overlaps its source */
+            const unsigned char *from = out + p - dist;
+            size_t k;
+            for(k=0; k<length; k++) out[p+k] = from[k];
+            p += length;
+        }
+
+        if(overrun(r)) return Y_DEFLATE_ERR_DATA;
+        if(full) break;
+    }
+
+    /* the output is full : keep what fits */
+    *pos = p;
+    return Y_DEFLATE_ERR_FULL;
+}
+
+
+/** decode the blocks until the last one, the reader being on the first */
+static int inflate_blocks(bit_reader_t *r, unsigned char *out, size_t *outSize) {
+
+    huffman_t literals, distances;
+    size_t pos = 0;
+    int last, type, err;
+
+    check_tables();
+
+    do {
+        refill(r);
+        last = get_bits(r, 1);
+        type = get_bits(r, 2);
+
+        if(type == 0) {
+
+            size_t length;
+
+            /* back to a byte boundary, then to the bytes not consumed */
+            get_bits(r, r->count & 7);
+            r->pos -= r->count / 8;
+            r->bits = 0;
+            r->count = 0;
+
+            if(r->pos > r->size || r->size - r->pos < 4) return Y_DEFLATE_ERR_DATA;
+            length = r->in[r->pos] | (r->in[r->pos+1] << 8);
+            if((length ^ 0xFFFF) != (size_t) (r->in[r->pos+2] | (r->in[r->pos+3] << 8))) return Y_DEFLATE_ERR_DATA;
+            r->pos += 4;
+
+            if(r->size - r->pos < length) return Y_DEFLATE_ERR_DATA;
+            if(*outSize - pos < length) {
+                memcpy(out + pos, r->in + r->pos, *outSize - pos);
+                return Y_DEFLATE_ERR_FULL;
+            }
+            memcpy(out + pos, r->in + r->pos, length);
+            r->pos += length;
+            pos += length;
+
+        } else if(type == 1) {
+            err = inflate_codes(r, &fixedLiteralDecoder, &fixedDistDecoder, out, *outSize, &pos);
+            if(err == Y_DEFLATE_ERR_FULL) *outSize = pos;
+            if(err) return err;
+        } else if(type == 2) {
+            err = read_dynamic_codes(r, &literals, &distances);
+            if(!err) err = inflate_codes(r, &literals, &distances, out, *outSize, &pos);
+            if(err == Y_DEFLATE_ERR_FULL) *outSize = pos;
+            if(err) return err;
+        } else {
+            return Y_DEFLATE_ERR_DATA;
+        }
+    } while(!last);
+
+    *outSize = pos;
+    return 0;
+}
+
+
+static void init_reader(bit_reader_t *r, const unsigned char *in, size_t inSize) {
+    r->in = in;
+    r->size = inSize;
+    r->pos = 0;
+    r->bits = 0;
+    r->count = 0;
+}
+
+
+int y_inflate(const unsigned char *in, size_t inSize, unsigned char *out, size_t *outSize) {
+
+    bit_reader_t r;
+
+    init_reader(&r, in, inSize);
+    return inflate_blocks(&r, out, outSize);
+}
+
+
+int y_zlib_uncompress(const unsigned char *in, size_t inSize, unsigned char *out, size_t *outSize) {
+
+    bit_reader_t r;
+    size_t end;
+    uint32_t adler;
+    int err;
+
+    /* deflate method, window up to 32 KiB, no preset dictionary */
+    if(inSize < 6 || (in[0] & 0x0F) != 8 || (in[0] >> 4) > 7 || (in[1] & 0x20) ||
+        ((in[0] << 8) | in[1]) % 31 != 0) {
+        return Y_DEFLATE_ERR_DATA;
+    }
+
+    init_reader(&r, in + 2, inSize - 2);
+    err = inflate_blocks(&r, out, outSize);
+    if(err) return err;
+
+    /* the checksum follows the last block, on a byte boundary */
+    end = 2 + r.pos - r.count / 8;
+    if(end > inSize || inSize - end < 4) return Y_DEFLATE_ERR_DATA;
+
+    adler = ((uint32_t) in[end] << 24) | (in[end+1] << 16) | (in[end+2] << 8) | in[end+3];
+    if(adler != y_adler32(1, out, *outSize)) return Y_DEFLATE_ERR_DATA;
+
+    return 0;
+}
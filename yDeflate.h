@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yDeflate.h
+ * \brief deflate compression and checksums, without zlib.
+ *
+ * These functions are used by the built-in PNG codec when the library
+ * is built without libpng. The compressor favours speed : it writes
+ * stored blocks, or fixed Huffman blocks whose only matches are runs of
+ * a repeated byte. The decompressor reads any deflate stream.
+ */
+
+#ifndef Y_DEFLATE_H_
+#define Y_DEFLATE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/** \brief error codes of the decompression */
+#define Y_DEFLATE_ERR_DATA -1 /**< invalid or truncated compressed data */
+#define Y_DEFLATE_ERR_FULL -2 /**< the output buffer is too small : it is filled with the beginning of the data */
+
+
+/**
+ * \brief Compression modes.
+ */
+typedef enum {
+    Y_DEFLATE_STORED=0, /**< no compression */
+    Y_DEFLATE_RLE /**< fixed Huffman codes and runs of a repeated byte */
+} yDeflateMode;
+
+
+/**
+ * \brief Update a CRC-32, as used by PNG chunks.
+ * \param crc the CRC of the previous data, 0 at the beginning
+ * \param data the data to add
+ * \param length the number of bytes in data
+ * \return the updated CRC
+ */
+uint32_t y_crc32(uint32_t crc, const unsigned char *data, size_t length);
+
+
+/**
+ * \brief Update an Adler-32 checksum, as used by zlib streams.
+ * \param adler the checksum of the previous data, 1 at the beginning
+ * \param data the data to add
+ * \param length the number of bytes in data
+ * \return the updated checksum
+ */
+uint32_t y_adler32(uint32_t adler, const unsigned char *data, size_t length);
+
+
+/**
+ * \brief Give the Adler-32 checksum of two concatenated sequences.
+ * \param adler1 the checksum of the first sequence
+ * \param adler2 the checksum of the second sequence
+ * \param length2 the length of the second sequence
+ * \return the checksum of the whole
+ */
+uint32_t y_adler32_combine(uint32_t adler1, uint32_t adler2, size_t length2);
+
+
+/**
+ * \brief Give the maximum size of the compression of "length" bytes.
+ */
+size_t y_deflate_bound(size_t length);
+
+
+/**
+ * \brief Compress data to raw deflate blocks.
+ *
+ * The output of successive calls can be concatenated : unless "last" is
+ * set, the blocks end on a byte boundary, like zlib's Z_SYNC_FLUSH.
+ * The matches never refer to the data of a previous call.
+ * \param data the data to compress
+ * \param length the number of bytes in data
+ * \param mode the compression mode. Blocks too large with Y_DEFLATE_RLE
+ * are stored instead.
+ * \param last set if the data ends the stream
+ * \param out the output buffer, of at least y_deflate_bound(length) bytes
+ * \return the number of bytes written in out
+ */
+size_t y_deflate(const unsigned char *data, size_t length, yDeflateMode mode, int last, unsigned char *out);
+
+
+/**
+ * \brief Decompress raw deflate data.
+ * \param in the compressed data
+ * \param inSize the number of bytes in "in"
+ * \param out the output buffer
+ * \param outSize the size of "out" as input, the number of bytes
+ * decompressed as output
+ * \return 0 in case of success, Y_DEFLATE_ERR_DATA or Y_DEFLATE_ERR_FULL
+ */
+int y_inflate(const unsigned char *in, size_t inSize, unsigned char *out, size_t *outSize);
+
+
+/**
+ * \brief Decompress a zlib stream, checking its header and checksum.
+ * \param in the compressed data
+ * \param inSize the number of bytes in "in"
+ * \param out the output buffer
+ * \param outSize the size of "out" as input, the number of bytes
+ * decompressed as output
+ * \return 0 in case of success, Y_DEFLATE_ERR_DATA or Y_DEFLATE_ERR_FULL
+ */
+int y_zlib_uncompress(const unsigned char *in, size_t inSize, unsigned char *out, size_t *outSize);
+
+
+#endif
@@ -19,11 +19,13 @@ int y_fill_image(yImage *im, yColor *c){
 
     int i; /* counter */
 
+    if(im->alphaChanel==NULL && c->alpha!=255 && y_add_alpha_channel(im)) return ERR_ALLOCATE_FAIL;
+
     for(i=0; i<im->rgbWidth*im->rgbHeight; i++){
         im->rgbData[3*i]=c->r;
         im->rgbData[3*i+1]=c->g;
         im->rgbData[3*i+2]=c->b;
-        im->alphaChanel[i]=c->alpha;
+        if(im->alphaChanel!=NULL) im->alphaChanel[i]=c->alpha;
         im->hasShapeColor=0;
     }
 
@@ -61,7 +63,8 @@ int y_draw_point(yImage *im, yPoint P, yColor *c){
         im->rgbData[3*index]=c->r;
         im->rgbData[3*index+1]=c->g;
         im->rgbData[3*index+2]=c->b;
-        im->alphaChanel[index]=c->alpha;
+        if(im->alphaChanel==NULL && c->alpha!=255) y_add_alpha_channel(im);
+        if(im->alphaChanel!=NULL) im->alphaChanel[index]=c->alpha;
     }
 
     return 1;
@@ -30,6 +30,8 @@ typedef struct {
  * \brief Fill an image with the specified color.
  * \param im the image to modify
  * \param c the new color to use
+ * \return 0 in case of success, or ERR_ALLOCATE_FAIL if the alpha
+ * channel is needed and can't be allocated
  */
 int y_fill_image(yImage *im, yColor *c);
 
@@ -42,12 +42,24 @@
  * sequences are sequences of Unicode symbols - probably a symbol
  * together with combining accents - also represented by this font
  * position. 
+ *
+ * The older PSF1 format has a 4 bytes header (two magic bytes, a mode
+ * and the charsize). Glyphs are 8 pixels wide and charsize pixels high,
+ * and there are 256 or 512 of them. Its Unicode table is made of
+ * little endian 2-bytes values, with 0xFFFF as separator and 0xFFFE to
+ * start a sequence.
  */
 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "yFont.h"
 #include "yLat1-14.h"
 
@@ -67,6 +79,22 @@
 #define PSF2_SEPARATOR  0xFF
 #define PSF2_STARTSEQ   0xFE
 
+#define PSF1_MAGIC0     0x36
+#define PSF1_MAGIC1     0x04
+#define PSF1_HEADERSIZE 4
+
+/* bits used in PSF1 mode */
+#define PSF1_MODE512    0x01
+#define PSF1_MODEHASTAB 0x02
+#define PSF1_MODEHASSEQ 0x04
+
+/* UCS-2 separators of PSF1 */
+#define PSF1_SEPARATOR  0xFFFF
+#define PSF1_STARTSEQ   0xFFFE
+
+/* value of the glyphs without Unicode description */
+#define NO_UNICODE_VALUE 0xFFFFFFFF
+
 
 /* returns 1 if header is valid, 0 otherwise */
 int is_header_valid(struct psf2_header header){
@@ -82,9 +110,22 @@ int is_header_valid(struct psf2_header header){
 
 
 /**
- * Read an UTF8 encoded value in a array of char.
+ * Give the number of bytes of an UTF8 encoded value from its first byte.
+ */
+static int utf8_length(unsigned char first) {
+
+    if(first >> 5 == 6) return 2;
+    if(first >> 4 == 14) return 3;
+    if(first >> 3 == 30) return 4;
+    return 1;
+}
+
+
+/**
+ * Read an UTF8 encoded value in a array of char, of at most "length"
+ * bytes : a truncated value is read up to the end of the array.
  */
-static unsigned int read_utf8_value(unsigned char *character, int *nbBytes){
+static unsigned int read_utf8_value(unsigned char *character, int length, int *nbBytes){
 
     int first = (unsigned char) character[0];
     *nbBytes = 1;
@@ -94,12 +135,9 @@ static unsigned int read_utf8_value(unsigned char *character, int *nbBytes){
         return first;
     }
 
-    if(first >> 5 == 6) {
-        *nbBytes = 2;
-    } else if (first >> 4 == 14) {
-        *nbBytes = 3;
-    } else if (first >> 3 == 30) {
-        *nbBytes = 4;
+    *nbBytes = utf8_length(first);
+    if(*nbBytes > length) {
+        *nbBytes = length;
     }
 
     int i;
@@ -118,7 +156,13 @@ static void init_utf8_table(unsigned int *utf8_values, int nb_glyphs, unsigned c
     while (pos < data_len && i < nb_glyphs) {
 
         int nb;
-        unsigned int value = read_utf8_value(data+pos, &nb);
+        unsigned int value;
+
+        /* a value truncated by the end of the table is not read */
+        if(pos + utf8_length(data[pos]) > data_len) {
+            break;
+        }
+        value = read_utf8_value(data+pos, data_len-pos, &nb);
 
         utf8_values[i] = value;
 
@@ -129,6 +173,86 @@ static void init_utf8_table(unsigned int *utf8_values, int nb_glyphs, unsigned c
         pos++;
         i++;
     }
+
+    /* the glyphs missing from the table have no value */
+    for(; i < nb_glyphs; i++) {
+        utf8_values[i] = NO_UNICODE_VALUE;
+    }
+}
+
+
+#ifdef HAVE_MMAP
+/**
+ * Give the value of an unicode code point, as read by read_utf8_value().
+ */
+static unsigned int encode_utf8_value(unsigned int codepoint) {
+
+    if(codepoint < 0x80) {
+        return codepoint;
+    }
+
+    if(codepoint < 0x800) {
+        return ((0xC0 | (codepoint >> 6)) << 8) | (0x80 | (codepoint & 0x3F));
+    }
+
+    if(codepoint < 0x10000) {
+        return ((0xE0 | (codepoint >> 12)) << 16) | ((0x80 | ((codepoint >> 6) & 0x3F)) << 8) |
+            (0x80 | (codepoint & 0x3F));
+    }
+
+    return ((0xF0 | (codepoint >> 18)) << 24) | ((0x80 | ((codepoint >> 12) & 0x3F)) << 16) |
+        ((0x80 | ((codepoint >> 6) & 0x3F)) << 8) | (0x80 | (codepoint & 0x3F));
+}
+
+
+/**
+ * Read the first Unicode value of each glyph in a PSF1 table.
+ */
+static void init_ucs2_table(unsigned int *utf8_values, int nb_glyphs, unsigned char *data, size_t data_len) {
+
+    size_t pos = 0;
+    int i;
+
+    for(i=0; i<nb_glyphs; i++) {
+
+        unsigned int value;
+
+        utf8_values[i] = NO_UNICODE_VALUE;
+
+        if(pos + 1 >= data_len) continue;
+
+        value = data[pos] | (data[pos+1] << 8);
+        if(value != PSF1_SEPARATOR && value != PSF1_STARTSEQ) {
+            utf8_values[i] = encode_utf8_value(value);
+        }
+
+        do {
+            value = data[pos] | (data[pos+1] << 8);
+            pos += 2;
+        } while(pos + 1 < data_len && value != PSF1_SEPARATOR);
+    }
+}
+#endif
+
+
+/**
+ * Check that the glyphs described by a header fit in a file, after a
+ * header of at least minHeaderSize bytes.
+ * \return 1 if the sizes are consistent, 0 otherwise
+ */
+static int is_header_consistent(struct psf2_header *header, size_t minHeaderSize, size_t fileSize) {
+
+    size_t glyphsSize;
+
+    if(header->headersize < minHeaderSize) return 0;
+    if(header->headersize > fileSize) return 0;
+    if(header->charsize == 0 || header->length == 0) return 0;
+    if(header->charsize < header->height * ((header->width + 7) / 8)) return 0;
+
+    glyphsSize = (size_t) header->length * header->charsize;
+    if(glyphsSize / header->charsize != header->length) return 0;
+
+    return glyphsSize <= fileSize - header->headersize;
 }
 
 
@@ -149,10 +273,12 @@ static font_t *read_array_font(int *err, unsigned char *binary) {
     }
 
     font->utf8_values = NULL;
+    font->mapping = NULL;
+    font->mappingSize = 0;
 
     memcpy(&(font->header), binary, sizeof(struct psf2_header)); 
 
-    if(!is_header_valid(font->header)){
+    if(!is_header_valid(font->header) || !is_header_consistent(&(font->header), sizeof(struct psf2_header), yLat1_14_psfu_len)){
         *err=Y_ERR_BAD_FILE;
         free(font);
         return(NULL);
@@ -167,7 +293,7 @@ static font_t *read_array_font(int *err, unsigned char *binary) {
         return(NULL);
     }
 
-    memcpy(font->glyphs, binary+sizeof(struct psf2_header), data_size);
+    memcpy(font->glyphs, binary+font->header.headersize, data_size);
 
     if(font->header.flags & PSF2_HAS_UNICODE_TABLE) {
 
@@ -180,7 +306,8 @@ static font_t *read_array_font(int *err, unsigned char *binary) {
             return(NULL);
         }
 
-        init_utf8_table(font->utf8_values, font->header.length, binary + sizeof(struct psf2_header) + data_size, yLat1_14_psfu_len);
+        init_utf8_table(font->utf8_values, font->header.length, binary + font->header.headersize + data_size,
+            yLat1_14_psfu_len - font->header.headersize - data_size);
     }
 
     return(font);
@@ -221,10 +348,14 @@ font_t *read_font(int *err, char *filename){
     }
 
     font->utf8_values = NULL;
+    font->mapping = NULL;
+    font->mappingSize = 0;
 
     nb_lus=fread(&(font->header), sizeof(struct psf2_header), 1, fd);
 
-    if((nb_lus<1)||(!is_header_valid(font->header))){
+    if((nb_lus<1)||(!is_header_valid(font->header))||
+        (font->header.headersize < sizeof(struct psf2_header))||
+        (fseek(fd, font->header.headersize, SEEK_SET) != 0)){
         *err=Y_ERR_BAD_FILE;
         free(font);
         fclose(fd);
@@ -303,11 +434,131 @@ font_t *read_font(int *err, char *filename){
 }
 
 
+#ifdef HAVE_MMAP
+/**
+ * Fill a PSF2 header describing a PSF1 font.
+ * \return 1 if the data are a PSF1 header, 0 otherwise
+ */
+static int read_psf1_header(struct psf2_header *header, unsigned char *data, size_t size) {
+
+    if(size < PSF1_HEADERSIZE) return 0;
+    if(data[0] != PSF1_MAGIC0 || data[1] != PSF1_MAGIC1) return 0;
+
+    header->magic[0] = PSF2_MAGIC0;
+    header->magic[1] = PSF2_MAGIC1;
+    header->magic[2] = PSF2_MAGIC2;
+    header->magic[3] = PSF2_MAGIC3;
+    header->version = 0;
+    header->headersize = PSF1_HEADERSIZE;
+    header->flags = (data[2] & PSF1_MODEHASTAB) ? PSF2_HAS_UNICODE_TABLE : 0;
+    header->length = (data[2] & PSF1_MODE512) ? 512 : 256;
+    header->charsize = data[3];
+    header->height = data[3];
+    header->width = 8;
+
+    return 1;
+}
+#endif
+
+
+font_t *read_font_mmap(int *err, char *filename){
+    #ifdef HAVE_MMAP
+    font_t *font;
+    struct stat st;
+    unsigned char *data;
+    size_t size;
+    int psf1 = 0;
+    int fd;
+
+    *err=0;
+
+    fd=open(filename, O_RDONLY);
+
+    if(fd<0){
+        *err=Y_ERR_FILE_NOT_FOUND;
+        return(NULL);
+    }
+
+    if(fstat(fd, &st)!=0 || st.st_size < PSF1_HEADERSIZE){
+        *err=Y_ERR_BAD_FILE;
+        close(fd);
+        return(NULL);
+    }
+
+    size = st.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    /* the mapping stays valid after the file is closed */
+    close(fd);
+
+    if(data==MAP_FAILED){
+        *err=Y_ERR_BAD_FILE;
+        return(NULL);
+    }
+
+    font = malloc(sizeof(font_t));
+    if(font==NULL){
+        *err=Y_ERR_ALLOCATE_FAIL;
+        munmap(data, size);
+        return(NULL);
+    }
+
+    font->utf8_values = NULL;
+    font->mapping = data;
+    font->mappingSize = size;
+
+    if(read_psf1_header(&(font->header), data, size)) {
+        psf1 = 1;
+    } else if(size >= sizeof(struct psf2_header)) {
+        memcpy(&(font->header), data, sizeof(struct psf2_header));
+    } else {
+        memset(&(font->header), 0, sizeof(struct psf2_header));
+    }
+
+    if(!is_header_valid(font->header) || !is_header_consistent(&(font->header), psf1 ? PSF1_HEADERSIZE : sizeof(struct psf2_header), size)){
+        *err=Y_ERR_BAD_FILE;
+        release_font(font);
+        return(NULL);
+    }
+
+    font->glyphs = data + font->header.headersize;
+
+    if(font->header.flags & PSF2_HAS_UNICODE_TABLE) {
+
+        size_t tablePos = font->header.headersize + (size_t) font->header.length * font->header.charsize;
+
+        font->utf8_values = malloc(font->header.length * sizeof(unsigned int));
+
+        if(font->utf8_values==NULL){
+            *err=Y_ERR_ALLOCATE_FAIL;
+            release_font(font);
+            return(NULL);
+        }
+
+        if(psf1) {
+            init_ucs2_table(font->utf8_values, font->header.length, data + tablePos, size - tablePos);
+        } else {
+            init_utf8_table(font->utf8_values, font->header.length, data + tablePos, size - tablePos);
+        }
+    }
+
+    return(font);
+    #else
+    return read_font(err, filename);
+    #endif
+}
+
+
 /* free memory use by a font */
 void release_font(font_t *font){
     if(font==NULL) return;
 
-    if(font->glyphs!=NULL) free(font->glyphs);
+    if(font->mapping!=NULL) {
+        #ifdef HAVE_MMAP
+        munmap(font->mapping, font->mappingSize);
+        #endif
+    } else if(font->glyphs!=NULL) {
+        free(font->glyphs);
+    }
 
     if(font->utf8_values!=NULL) free(font->utf8_values);
 
@@ -371,5 +622,6 @@ static int glyph_index(font_t *font, unsigned int value) {
 }
 
 unsigned char *get_glyph(font_t *font, char *character, int *nbBytes){
-    return get_character(font, glyph_index(font, read_utf8_value((unsigned char *)character, nbBytes)));
+    int length = strnlen(character, 4);
+    return get_character(font, glyph_index(font, read_utf8_value((unsigned char *)character, length > 0 ? length : 1, nbBytes)));
 }
@@ -9,7 +9,8 @@
  * \file yFont.h
  * \brief font management.
  *
- * Reading functions for the PSF v2 font format.
+ * Reading functions for the PSF v2 font format. PSF v1 fonts can be
+ * loaded with read_font_mmap().
  */
 
 #ifndef FONT_H_
@@ -42,6 +43,8 @@ typedef struct {
     unsigned char *glyphs;
     // only one UTF8 value by glyph is supported for now
     unsigned int *utf8_values; /**< an array of "header.length" utf8 encoded unicode values */
+    void *mapping; /**< the mapped font file if loaded by read_font_mmap(), NULL otherwise */
+    size_t mappingSize; /**< size of the mapping in bytes */
 } font_t;
 
 
@@ -63,6 +66,22 @@ int is_header_valid(struct psf2_header header);
 font_t *read_font(int *err, char *filename);
 
 
+/**
+ * \brief Init a font by mapping a file in memory.
+ *
+ * The file is mapped read-only and the glyphs are not copied :
+ * font->glyphs points directly into the mapping, so the pages are
+ * shared between all the processes which load the same font. Both PSF1
+ * and PSF2 files are accepted. A PSF1 font is described by an
+ * equivalent PSF2 header. Without HAVE_MMAP, the font is read by
+ * read_font(), which only accepts PSF2 files.
+ * \param err a pointer to an integer to put the error code
+ * \param filename the name of the font file (psf)
+ * \return a newly allocated font struct, to free with release_font()
+ */
+font_t *read_font_mmap(int *err, char *filename);
+
+
 /**
  * \brief Init the default font.
  * \param err a pointer to an integer to put the error code
@@ -16,6 +16,9 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h> //memset()
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 
 /************************************************************/
@@ -23,8 +26,8 @@
 /************************************************************/
 
 
-/* create an yImage without transparency */
-yImage *y_create_image(int *err, const unsigned char *rgbData, int width, int height){
+/* create an yImage, with an opaque alpha channel if "withAlpha" is set */
+static yImage *create_image(int *err, const unsigned char *rgbData, int width, int height, int withAlpha){
 
     yImage *im;
 
@@ -42,15 +45,18 @@ yImage *y_create_image(int *err, const unsigned char *rgbData, int width, int he
         return(NULL);
     }
 
-    im->alphaChanel=(unsigned char *) malloc(width*height);
+    im->alphaChanel=NULL;
+    if(withAlpha) {
+        im->alphaChanel=(unsigned char *) malloc(width*height);
         if(im->alphaChanel==NULL) {
-        *err=ERR_ALLOCATE_FAIL;
-        free(im->rgbData);
-        free(im);
-        return(NULL);
-    }
+            *err=ERR_ALLOCATE_FAIL;
+            free(im->rgbData);
+            free(im);
+            return(NULL);
+        }
 
-    memset(im->alphaChanel, 255, width*height);
+        memset(im->alphaChanel, 255, width*height);
+    }
 
     if(rgbData==NULL) {
         memset(im->rgbData, 0, 3*width*height);
@@ -65,23 +71,86 @@ yImage *y_create_image(int *err, const unsigned char *rgbData, int width, int he
     im->shapeColor.g=0;
     im->shapeColor.b=0;
 
+    im->mapping=NULL;
+    im->mappingSize=0;
+
+    *err=0;
+    return(im);
+}
+
+
+/* create an yImage without transparency */
+yImage *y_create_image(int *err, const unsigned char *rgbData, int width, int height){
+    return create_image(err, rgbData, width, height, 1);
+}
+
+
+yImage *y_create_rgb_image(int *err, const unsigned char *rgbData, int width, int height){
+    return create_image(err, rgbData, width, height, 0);
+}
+
+
+yImage *y_create_mapped_image(int *err, unsigned char *rgbData, int width, int height, void *mapping, size_t mappingSize){
+
+    yImage *im;
+
+    im=(yImage *)malloc(sizeof(yImage));
+
+    if (im==NULL) {
+        *err=ERR_ALLOCATE_FAIL;
+        return(NULL);
+    }
+
+    memset(im, 0, sizeof(yImage));
+    im->rgbData=rgbData;
+    im->rgbWidth=width;
+    im->rgbHeight=height;
+    im->mapping=mapping;
+    im->mappingSize=mappingSize;
+
     *err=0;
     return(im);
 }
 
 
+int y_add_alpha_channel(yImage *im){
+
+    int i;
+
+    if(im==NULL) return -1;
+    if(im->alphaChanel!=NULL) return 0;
+
+    im->alphaChanel=(unsigned char *) malloc(im->rgbWidth*im->rgbHeight);
+    if(im->alphaChanel==NULL) return ERR_ALLOCATE_FAIL;
+
+    memset(im->alphaChanel, 255, im->rgbWidth*im->rgbHeight);
+
+    /* the pixels of the shape color were the transparent ones */
+    if(im->hasShapeColor) {
+        for(i=0; i<im->rgbWidth*im->rgbHeight; i++) {
+            if(im->rgbData[3*i]==im->shapeColor.r && im->rgbData[3*i+1]==im->shapeColor.g &&
+                im->rgbData[3*i+2]==im->shapeColor.b) im->alphaChanel[i]=0;
+        }
+    }
+
+    return 0;
+}
+
+
 yImage *y_create_uniform_image(int *err, yColor *background, int width, int height){
 
     yImage *img = y_create_image(err, NULL, width, height);
     int pix;
 
+    if(img==NULL) return NULL;
+
     for(pix=0; pix<width*height; pix++) {
         img->rgbData[3*pix+0]=background->r;
         img->rgbData[3*pix+1]=background->g;
         img->rgbData[3*pix+2]=background->b;
     }
 
-    memset(img->alphaChanel, background->alpha, width*height);
+    if(img->alphaChanel!=NULL) memset(img->alphaChanel, background->alpha, width*height);
 
     return img;
 }
@@ -89,10 +158,25 @@ yImage *y_create_uniform_image(int *err, yColor *background, int width, int heig
 
 
 
+void y_release_rgb_data(yImage *im){
+    #ifdef HAVE_MMAP
+    if(im->mapping!=NULL) {
+        munmap(im->mapping, im->mappingSize);
+        im->mapping=NULL;
+        im->mappingSize=0;
+    } else
+    #endif
+    if(im->rgbData!=NULL) free(im->rgbData);
+
+    im->rgbData=NULL;
+}
+
+
 /* libération de la memoire */
 void y_destroy_image(yImage *im){
     if(im!=NULL){
-        if(im->rgbData!=NULL) free(im->rgbData);
+        y_release_rgb_data(im);
+        if(im->alphaChanel!=NULL) free(im->alphaChanel);
         free(im);
     }
 }
@@ -103,6 +187,18 @@ void y_destroy_image(yImage *im){
 /************************************************************/
 
 
+/* alpha of the pixel at "pos", for the images with or without alpha channel */
+static unsigned char pixel_alpha(yImage *im, int pos){
+
+    if(im->alphaChanel!=NULL) return im->alphaChanel[pos];
+
+    if(im->hasShapeColor && im->rgbData[3*pos]==im->shapeColor.r &&
+        im->rgbData[3*pos+1]==im->shapeColor.g && im->rgbData[3*pos+2]==im->shapeColor.b) return 0;
+
+    return 255;
+}
+
+
 yColor *y_get_color(yImage *im, int x, int y){
 
     yColor *value = NULL;
@@ -118,7 +214,7 @@ yColor *y_get_color(yImage *im, int x, int y){
         value->r = im->rgbData[3*pos];
         value->g = im->rgbData[3*pos+1];
         value->b = im->rgbData[3*pos+2];
-        value->alpha = im->alphaChanel[pos];
+        value->alpha = pixel_alpha(im, pos);
     }
 
     return value;
@@ -157,12 +253,12 @@ void y_superpose_images(yImage *back, yImage *fore, int x, int y){
 
         if((xb>=0) && (xb<back->rgbWidth) && (y>=0) && (yb<back->rgbHeight)){
 
-            int ab= back->alphaChanel[xb+yb*back->rgbWidth];
+            int ab= pixel_alpha(back, xb+yb*back->rgbWidth);
             int rb= back->rgbData[3*(xb+yb*back->rgbWidth)];
             int gb= back->rgbData[3*(xb+yb*back->rgbWidth)+1];
             int bb= back->rgbData[3*(xb+yb*back->rgbWidth)+2];
 
-            int af= fore->alphaChanel[i+j*fore->rgbWidth];
+            int af= fore->alphaChanel!=NULL ? fore->alphaChanel[i+j*fore->rgbWidth] : 255;
             int rf= fore->rgbData[3*(i+j*fore->rgbWidth)];
             int gf= fore->rgbData[3*(i+j*fore->rgbWidth)+1];
             int bf= fore->rgbData[3*(i+j*fore->rgbWidth)+2];
@@ -241,6 +337,8 @@ void y_set_pixel(yImage *im, yColor *color, int x, int y){
     im->rgbData[pos+1]=color->g;
     im->rgbData[pos+2]=color->b;
 
-    im->alphaChanel[y*im->rgbWidth + x]=color->alpha;
+    /* the alpha channel is only added when needed */
+    if(im->alphaChanel==NULL && color->alpha!=255) y_add_alpha_channel(im);
+    if(im->alphaChanel!=NULL) im->alphaChanel[y*im->rgbWidth + x]=color->alpha;
 }
 
@@ -45,6 +45,8 @@ typedef struct {
      * that color can not be displayed.
      */
     yColor shapeColor;
+    void *mapping; /**< \brief file mapping holding rgbData, or NULL if rgbData was allocated */
+    size_t mappingSize; /**< \brief size of the mapping */
 } yImage;
 
 
@@ -64,6 +66,31 @@ typedef struct {
 yImage *y_create_image(int *err, const unsigned char *rgb_data, int width, int height);
 
 
+/**
+ * \brief Create an yImage without alpha channel.
+ *
+ * The field alphaChanel is NULL : all the pixels are opaque, except the
+ * ones of the shape color if hasShapeColor is set. The functions which
+ * set a transparent pixel add the alpha channel.
+ * \param err the function will write here the returned error code
+ * \param rbg_data the background image. Background will be black if NULL
+ * \param width the new image's width
+ * \param height the new image's height
+ * \return a newly allocated yImage struct
+ */
+yImage *y_create_rgb_image(int *err, const unsigned char *rgb_data, int width, int height);
+
+
+/**
+ * \brief Add an opaque alpha channel to an image which has none.
+ *
+ * The pixels of the shape color, if any, become transparent.
+ * \param im the image
+ * \return 0 in case of success, or a negative error code
+ */
+int y_add_alpha_channel(yImage *im);
+
+
 /**
  * \brief Create an yImage with an uniform background color.
  * \param err the function will write here the returned error code
@@ -75,6 +102,32 @@ yImage *y_create_image(int *err, const unsigned char *rgb_data, int width, int h
 yImage *y_create_uniform_image(int *err, yColor *background, int width, int height);
 
 
+/**
+ * \brief Create an yImage whose RGB data lies in a memory mapping.
+ *
+ * The image has no alpha channel. The mapping is released with munmap()
+ * when the image is destroyed.
+ * \param err the function will write here the returned error code
+ * \param rgbData the image's RGB data, inside the mapping
+ * \param width the image's width
+ * \param height the image's height
+ * \param mapping the address of the mapping
+ * \param mappingSize the size of the mapping
+ * \return a newly allocated yImage struct
+ */
+yImage *y_create_mapped_image(int *err, unsigned char *rgbData, int width, int height, void *mapping, size_t mappingSize);
+
+
+/**
+ * \brief Release the RGB data of an image, allocated or mapped.
+ *
+ * The field rgbData is set to NULL. This is for the functions which
+ * replace the RGB data of an image.
+ * \param im the image
+ */
+void y_release_rgb_data(yImage *im);
+
+
 /**
  * \brief free memory.
  * \param im the struct to free
@@ -9,519 +9,5989 @@
  * \file yImage_io.c
  * \brief Load and save yImage in differents formats.
  *
- * PPM read or write is available without the need of an extern library.
- * The use of PNG, JPEG or TIFF format needs the correspondant library
- * at build time.
+ * PPM and QOI read or write is available without the need of an extern
+ * library. The use of JPEG or TIFF format needs the correspondant library at
+ * build time. PNG files are handled by libpng if available, or else by
+ * a built-in codec.
  */
 
 
 #include "yImage_io.h"
+#include "yDeflate.h"
+#include "yThread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h> //memset()
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h> //writev()
 
 #ifdef HAVE_LIBPNG
 #include "png.h"
+#include "zlib.h"
 #endif
 #ifdef HAVE_LIBJPEG
+#include <setjmp.h>
 #include "jpeglib.h"
+#include "jerror.h"
 #endif
 #ifdef HAVE_LIBTIFF
 #include "tiffio.h"
 #endif
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+/** initial capacity of a yBuffer */
+#define BUFFER_MIN_CAPACITY 4096
+
+/** size of the buffer used by the JPEG encoder before calling the write callback */
+#define JPEG_OUTPUT_BUFFER_SIZE 65536
+
+/** number of rows given at once to libjpeg */
+#define JPEG_ROWS_BY_CALL 16
+
+/** max size of a ppm header */
+#define PPM_HEADER_MAX_SIZE 1024
+
+/** header of the ppm files written, with the width and the height */
+#define PPM_HEADER "P6\n# Created by yImage\n%i %i\n255\n"
+
+/** header of the Y4M streams, with the width, the height and the frame rate */
+#define Y4M_HEADER "YUV4MPEG2 W%i H%i F%i:%i Ip A1:1 C420jpeg\n"
+
+/** header of each frame of a Y4M stream */
+#define Y4M_FRAME_HEADER "FRAME\n"
+
+
+
+/* MEMORY BUFFERS */
+
+
+void y_init_buffer(yBuffer *buffer) {
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+
+void y_release_buffer(yBuffer *buffer) {
+    free(buffer->data);
+    y_init_buffer(buffer);
+}
+
+
+/**
+ * Ensure a buffer can hold "needed" bytes.
+ * \return 0 in case of success or ERR_ALLOCATE_FAIL
+ */
+static int reserve_buffer(yBuffer *buffer, size_t needed) {
+
+    size_t capacity;
+    unsigned char *data;
+
+    if(needed <= buffer->capacity) return 0;
+
+    capacity = buffer->capacity < BUFFER_MIN_CAPACITY ? BUFFER_MIN_CAPACITY : buffer->capacity;
+    while(capacity < needed) capacity *= 2;
+
+    data = realloc(buffer->data, capacity);
+    if(data == NULL) return ERR_ALLOCATE_FAIL;
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+
+int y_buffer_write(void *buffer, const unsigned char *data, size_t length) {
+
+    yBuffer *buf = buffer;
+
+    if(reserve_buffer(buf, buf->size + length) != 0) return ERR_ALLOCATE_FAIL;
+
+    memcpy(buf->data + buf->size, data, length);
+    buf->size += length;
+    return 0;
+}
+
+
+/** a yWriteCallback writing in a FILE */
+static int file_write(void *file, const unsigned char *data, size_t length) {
+    return fwrite(data, 1, length, (FILE *) file) == length ? 0 : 1;
+}
+
+
+
+/* WRITING FILES */
 
 
+int y_encode_ppm(yImage *im, yWriteCallback write, void *userData) {
+
+    char header[64];
+    int length;
+
+    length = snprintf(header, sizeof(header), PPM_HEADER, im->rgbWidth, im->rgbHeight);
+
+    if (write(userData, (unsigned char *) header, length))
+    {
+        return 1;
+    }
+    if (write(userData, im->rgbData, (size_t) im->rgbWidth * im->rgbHeight * 3))
+    {
+        return 1;
+    }
+    return 0;
+}
 
 
 int y_save_ppm(yImage *im, const char *file){
     FILE *f; /* file descriptor */
+    int err;
 
     f = fopen(file, "wb");
     if (f)
     {
-        if (!fprintf(f, "P6\n# Created by yImage\n%i %i\n255\n", im->rgbWidth, im->rgbHeight))
-        {
-            fclose(f);
-            return 1;
-        }
-        if (!fwrite(im->rgbData, 1, (im->rgbWidth * im->rgbHeight * 3), f))
-        {
-            fclose(f);
-            return 1;
-        }
-        fclose(f);
-        return 0;
+        err = y_encode_ppm(im, file_write, f);
+        if (fclose(f)) err = 1;
+        return err;
     }
     return 1;
 }
 
 
+int y_save_ppm_mmap(yImage *im, const char *file){
+    #ifdef HAVE_MMAP
+    char header[64];
+    unsigned char *base;
+    size_t length, size;
+    int fd, err = 0;
 
-int y_save_jpeg(yImage *im, const char *file)
+    length = snprintf(header, sizeof(header), PPM_HEADER, im->rgbWidth, im->rgbHeight);
+    size = length + (size_t) im->rgbWidth * im->rgbHeight * 3;
+
+    fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return 1;
+
+    /* the blocks are allocated first : a full disk is an error, not a SIGBUS */
+    if (posix_fallocate(fd, 0, size))
+    {
+        close(fd);
+        return 1;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return 1;
+    }
+
+    memcpy(base, header, length);
+    memcpy(base + length, im->rgbData, size - length);
+
+    if (munmap(base, size)) err = 1;
+    if (close(fd)) err = 1;
+    return err;
+    #else
+    return y_save_ppm(im, file);
+    #endif
+}
+
+
+
+#ifdef HAVE_LIBJPEG
+/** JPEG error manager which returns to the caller instead of exiting */
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmpBuffer;
+} jpeg_error_handler;
+
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    jpeg_error_handler *handler = (jpeg_error_handler *) cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(handler->setjmpBuffer, 1);
+}
+
+
+/** JPEG destination manager giving the data to a yWriteCallback */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    yWriteCallback write;
+    void *userData;
+    JOCTET buffer[JPEG_OUTPUT_BUFFER_SIZE];
+} jpeg_callback_destination;
+
+
+static void init_callback_destination(j_compress_ptr cinfo) {
+    jpeg_callback_destination *dest = (jpeg_callback_destination *) cinfo->dest;
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JPEG_OUTPUT_BUFFER_SIZE;
+}
+
+
+static boolean empty_callback_destination(j_compress_ptr cinfo) {
+    jpeg_callback_destination *dest = (jpeg_callback_destination *) cinfo->dest;
+
+    if(dest->write(dest->userData, dest->buffer, JPEG_OUTPUT_BUFFER_SIZE)) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JPEG_OUTPUT_BUFFER_SIZE;
+    return TRUE;
+}
+
+
+static void term_callback_destination(j_compress_ptr cinfo) {
+    jpeg_callback_destination *dest = (jpeg_callback_destination *) cinfo->dest;
+    size_t length = JPEG_OUTPUT_BUFFER_SIZE - dest->pub.free_in_buffer;
+
+    if(length > 0 && dest->write(dest->userData, dest->buffer, length)) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+}
+#endif
+
+
+void y_init_jpeg_options(yJpegOptions *options)
+{
+    options->quality = (100 * DEFAULT_JPEG_QUALITY) >> 8;
+    options->subsampling = Y_JPEG_SUBSAMPLING_420;
+    options->fastDct = 0;
+    options->optimizeCoding = 0;
+    options->progressive = 0;
+    options->restartInterval = 0;
+}
+
+
+#ifdef HAVE_LIBJPEG
+/**
+ * Set the compression parameters of an RGB image.
+ * \param options the encoder's settings, or NULL for the defaults
+ */
+static void set_jpeg_options(j_compress_ptr cinfo, yJpegOptions *options)
+{
+    yJpegOptions defaults;
+    int h, v;
+
+    if (options == NULL)
+    {
+        y_init_jpeg_options(&defaults);
+        options = &defaults;
+    }
+
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_RGB;
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, options->quality < 1 ? 1 : (options->quality > 100 ? 100 : options->quality), TRUE);
+
+    /* sampling factors of the luminance, the chrominance is not enlarged */
+    switch (options->subsampling)
+    {
+        case Y_JPEG_SUBSAMPLING_444: h = 1; v = 1; break;
+        case Y_JPEG_SUBSAMPLING_422: h = 2; v = 1; break;
+        default: h = 2; v = 2;
+    }
+    cinfo->comp_info[0].h_samp_factor = h;
+    cinfo->comp_info[0].v_samp_factor = v;
+
+    cinfo->dct_method = options->fastDct ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo->optimize_coding = options->optimizeCoding ? TRUE : FALSE;
+    if (options->restartInterval > 0)
+        cinfo->restart_interval = options->restartInterval;
+    if (options->progressive)
+        jpeg_simple_progression(cinfo);
+}
+#endif
+
+
+int y_encode_jpeg_with_options(yImage *im, yJpegOptions *options, yWriteCallback write, void *userData)
 {
     #ifdef HAVE_LIBJPEG
     struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    JSAMPROW row_pointer[1];
-    int row_stride;
+    jpeg_error_handler jerr;
+    jpeg_callback_destination *dest;
+    JSAMPROW rows[JPEG_ROWS_BY_CALL];
+    size_t row_stride;
+    int i;
+
+    dest = malloc(sizeof(jpeg_callback_destination));
+    if(dest == NULL) return 1;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_error_exit;
+    if (setjmp(jerr.setjmpBuffer))
+    {
+        jpeg_destroy_compress(&cinfo);
+        free(dest);
+        return 1;
+    }
+    jpeg_create_compress(&cinfo);
+
+    dest->pub.init_destination = init_callback_destination;
+    dest->pub.empty_output_buffer = empty_callback_destination;
+    dest->pub.term_destination = term_callback_destination;
+    dest->write = write;
+    dest->userData = userData;
+    cinfo.dest = &(dest->pub);
+
+    cinfo.image_width = im->rgbWidth;
+    cinfo.image_height = im->rgbHeight;
+    set_jpeg_options(&cinfo, options);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    /* the rows are given by batches, which saves calls into libjpeg */
+    row_stride = (size_t) cinfo.image_width * 3;
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        int n = cinfo.image_height - cinfo.next_scanline;
+
+        if (n > JPEG_ROWS_BY_CALL) n = JPEG_ROWS_BY_CALL;
+        for (i = 0; i < n; i++)
+            rows[i] = im->rgbData + (cinfo.next_scanline + i) * row_stride;
+        jpeg_write_scanlines(&cinfo, rows, n);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(dest);
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+int y_encode_jpeg(yImage *im, yWriteCallback write, void *userData)
+{
+    return y_encode_jpeg_with_options(im, NULL, write, userData);
+}
+
+
+int y_save_jpeg_with_options(yImage *im, const char *file, yJpegOptions *options)
+{
+    #ifdef HAVE_LIBJPEG
     FILE *f; /* file to create descriptor */
+    int err;
 
     f = fopen(file, "wb");
     if(f)
     {
-        cinfo.err = jpeg_std_error(&jerr);
-        jpeg_create_compress(&cinfo);
-        jpeg_stdio_dest(&cinfo, f);
-        cinfo.image_width = im->rgbWidth;
-        cinfo.image_height = im->rgbHeight;
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_RGB;
-        jpeg_set_defaults(&cinfo);
-        jpeg_set_quality(&cinfo, (100 * DEFAULT_JPEG_QUALITY) >> 8, TRUE);
-        jpeg_start_compress(&cinfo, TRUE);
-        row_stride = cinfo.image_width * 3;
-        while (cinfo.next_scanline < cinfo.image_height)
-        {
-            row_pointer[0] = im->rgbData + (cinfo.next_scanline * row_stride);
-            jpeg_write_scanlines(&cinfo, row_pointer, 1);
-        }
-        jpeg_finish_compress(&cinfo);
-        fclose(f);
-        return 0;
+        err = y_encode_jpeg_with_options(im, options, file_write, f);
+        if (fclose(f)) err = 1;
+        return err;
     }
     #endif
     return 1;
 }
 
 
+int y_save_jpeg(yImage *im, const char *file)
+{
+    return y_save_jpeg_with_options(im, file, NULL);
+}
+
 
-int y_save_png(yImage *im, const char *file)
+
+#ifdef HAVE_LIBPNG
+/** libpng write function giving the data to a yWriteCallback */
+typedef struct {
+    yWriteCallback write;
+    void *userData;
+} png_callback_destination;
+
+
+static void png_callback_write(png_structp png_ptr, png_bytep data, png_size_t length) {
+    png_callback_destination *dest = png_get_io_ptr(png_ptr);
+
+    if(dest->write(dest->userData, data, length)) {
+        png_error(png_ptr, "Write error");
+    }
+}
+
+
+static void png_callback_flush(png_structp png_ptr) {
+}
+#endif
+
+
+void y_init_png_options(yPngOptions *options)
 {
-    #ifdef HAVE_LIBPNG
-    png_structp png_ptr;
-    png_infop info_ptr;
-    unsigned char *data, *ptr;
-    int x, y;
-    png_bytep row_ptr;
-    png_color_8 sig_bit;
-    FILE *f; /* descripteur du fichier à créer */
+    options->compressionLevel = -1;
+    options->strategy = Y_PNG_STRATEGY_DEFAULT;
+    options->filters = Y_PNG_FILTER_AUTO;
+    options->colorType = Y_PNG_COLOR_AUTO;
+    options->dithering = Y_DITHER_NONE;
+    options->threads = 0;
+}
+
+
+/** PNG file signature */
+static const unsigned char png_signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+/** filter types of the PNG rows */
+enum { ROW_FILTER_NONE = 0, ROW_FILTER_SUB, ROW_FILTER_UP, ROW_FILTER_AVG, ROW_FILTER_PAETH };
+
+
+/** alpha value of the pixel "index", with its RGB values at "rgb" */
+static unsigned char pixel_alpha(yImage *im, int index, const unsigned char *rgb)
+{
+    if (im->alphaChanel != NULL)
+        return im->alphaChanel[index];
+
+    if (im->hasShapeColor && rgb[0] == im->shapeColor.r &&
+        rgb[1] == im->shapeColor.g && rgb[2] == im->shapeColor.b)
+        return 0; /* transparent */
+
+    return 255; /* opaque */
+}
+
+
+/** \return 1 if some pixels of the image are not opaque */
+static int has_transparency(yImage *im)
+{
+    size_t i, n = (size_t) im->rgbWidth * im->rgbHeight;
+
+    for (i = 0; i < n; i++)
+        if (pixel_alpha(im, i, im->rgbData + 3 * i) != 255) return 1;
+
+    return 0;
+}
+
+
+/** size of the hash table used to count the colours */
+#define PALETTE_HASH_SIZE 1024
+
+/** the colours of an image with at most 256 colours */
+typedef struct {
+    uint32_t keys[PALETTE_HASH_SIZE]; /**< RGBA colours in the hash table */
+    short slots[PALETTE_HASH_SIZE]; /**< index in "colors" of each key, or -1 for empty slots */
+    uint32_t colors[256]; /**< the RGBA colours */
+    int nbColors; /**< number of colours, -1 if there are more than 256 */
+    uint32_t lastKey; /**< last colour searched */
+    int lastIndex; /**< index of lastKey */
+} png_palette_t;
+
+
+static uint32_t rgba_key(const unsigned char *rgb, unsigned char alpha)
+{
+    return ((uint32_t) rgb[0] << 24) | ((uint32_t) rgb[1] << 16) | ((uint32_t) rgb[2] << 8) | alpha;
+}
+
+
+static void init_png_palette(png_palette_t *palette)
+{
+    memset(palette->slots, 0xFF, sizeof(palette->slots));
+    palette->nbColors = 0;
+    palette->lastIndex = -1;
+    palette->lastKey = 0;
+}
+
+
+/**
+ * Find a colour in the palette, adding it if "add" is set.
+ * \return the colour's index, or -1
+ */
+static int png_palette_index(png_palette_t *palette, uint32_t key, int add)
+{
+    unsigned int h;
+
+    if (key == palette->lastKey && palette->lastIndex >= 0)
+        return palette->lastIndex;
+
+    h = (key * 2654435761u) >> 22;
+
+    while (palette->slots[h] >= 0)
+    {
+        if (palette->keys[h] == key)
+        {
+            palette->lastKey = key;
+            palette->lastIndex = palette->slots[h];
+            return palette->lastIndex;
+        }
+        h = (h + 1) & (PALETTE_HASH_SIZE - 1);
+    }
+
+    if (!add) return -1;
+
+    if (palette->nbColors == 256)
+    {
+        palette->nbColors = -1;
+        return -1;
+    }
+
+    palette->keys[h] = key;
+    palette->slots[h] = palette->nbColors;
+    palette->colors[palette->nbColors] = key;
+    palette->lastKey = key;
+    palette->lastIndex = palette->nbColors;
+    return palette->nbColors++;
+}
+
+
+/**
+ * Find the smallest colour type able to represent the image.
+ *
+ * The colours are counted in "palette" until there are more than 256
+ * of them, while looking for transparent or colored pixels.
+ */
+static yPngColorType reduce_png_color_type(yImage *im, png_palette_t *palette)
+{
+    int opaque = 1, gray = 1;
+    int i, n = im->rgbWidth * im->rgbHeight;
+    const unsigned char *rgb = im->rgbData;
+
+    init_png_palette(palette);
+
+    for (i = 0; i < n && (opaque || gray || palette->nbColors >= 0); i++, rgb += 3)
+    {
+        unsigned char alpha = pixel_alpha(im, i, rgb);
+
+        if (rgb[0] != rgb[1] || rgb[0] != rgb[2]) gray = 0;
+        if (alpha != 255) opaque = 0;
+        if (palette->nbColors >= 0) png_palette_index(palette, rgba_key(rgb, alpha), 1);
+    }
+
+    /* 8 bits gray is as small as a palette and needs no PLTE chunk */
+    if (palette->nbColors >= 0 && !(gray && opaque && palette->nbColors > 16))
+        return Y_PNG_COLOR_PALETTE;
+
+    if (gray) return opaque ? Y_PNG_COLOR_GRAY : Y_PNG_COLOR_GRAY_ALPHA;
+    return opaque ? Y_PNG_COLOR_RGB : Y_PNG_COLOR_RGBA;
+}
+
+
+/**
+ * Count the colours of the image in "palette".
+ * \return 1 if the image has at most 256 colours, 0 otherwise
+ */
+static int count_png_colors(yImage *im, png_palette_t *palette)
+{
+    int i, n = im->rgbWidth * im->rgbHeight;
+    const unsigned char *rgb = im->rgbData;
+
+    init_png_palette(palette);
+
+    for (i = 0; i < n && palette->nbColors >= 0; i++, rgb += 3)
+        png_palette_index(palette, rgba_key(rgb, pixel_alpha(im, i, rgb)), 1);
+
+    return palette->nbColors >= 0;
+}
+
+
+/** \return the bit depth of the indices for a palette of "nbColors" colours */
+static int palette_bit_depth(int nbColors)
+{
+    if (nbColors <= 2) return 1;
+    if (nbColors <= 4) return 2;
+    if (nbColors <= 16) return 4;
+    return 8;
+}
+
+
+/**
+ * Give the content of the PLTE and tRNS chunks. The transparent colours
+ * are moved at the beginning of the palette, so that tRNS is as short as
+ * possible.
+ * \return the number of transparent colours
+ */
+static int sort_png_palette(png_palette_t *palette, unsigned char *colors, unsigned char *alphas)
+{
+    uint32_t sorted[256];
+    int nbTransparent = 0;
+    int i, next, n = palette->nbColors;
+
+    for (i = 0; i < n; i++)
+        if ((palette->colors[i] & 0xFF) != 255) sorted[nbTransparent++] = palette->colors[i];
+    next = nbTransparent;
+    for (i = 0; i < n; i++)
+        if ((palette->colors[i] & 0xFF) == 255) sorted[next++] = palette->colors[i];
+
+    /* rebuild the hash table with the new order */
+    if (nbTransparent > 0)
+    {
+        init_png_palette(palette);
+        for (i = 0; i < n; i++)
+            png_palette_index(palette, sorted[i], 1);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        colors[3 * i] = sorted[i] >> 24;
+        colors[3 * i + 1] = (sorted[i] >> 16) & 0xFF;
+        colors[3 * i + 2] = (sorted[i] >> 8) & 0xFF;
+        alphas[i] = sorted[i] & 0xFF;
+    }
+
+    return nbTransparent;
+}
+
+
+/**
+ * Reduce an opaque image with too many colours to a palette of 256
+ * colours.
+ * \return the palette indices of the pixels, or NULL if the image has
+ * transparent pixels or in case of failure
+ */
+static unsigned char *quantize_png_image(yImage *im, yDithering dithering, png_palette_t *palette)
+{
+    yColorPalette_t colors;
+    unsigned char *indices;
+    int i, n = im->rgbWidth * im->rgbHeight;
+    const unsigned char *rgb = im->rgbData;
+
+    for (i = 0; i < n; i++, rgb += 3)
+        if (pixel_alpha(im, i, rgb) != 255) return NULL;
+
+    indices = malloc(n > 0 ? n : 1);
+    if (indices == NULL) return NULL;
+
+    n = y_quantize_palette(im, colors, 256);
+    if (n < 0 || y_map_to_palette(im, colors, n, dithering, indices))
+    {
+        free(indices);
+        return NULL;
+    }
+
+    init_png_palette(palette);
+    for (i = 0; i < n; i++)
+        palette->colors[i] = rgba_key(colors + 3 * i, 255);
+    palette->nbColors = n;
+
+    return indices;
+}
+
+
+/**
+ * Choose the row filters, as Y_PNG_FILTER_* flags. Unless specified,
+ * the filters are not used without compression or, with zlib, for
+ * palette images. A single cheap filter is used for the fast levels, and
+ * otherwise all of them are tried on each row.
+ */
+static int png_filter_flags(yPngOptions *options, yPngColorType colorType)
+{
+    if (options->filters == Y_PNG_FILTER_AUTO)
+    {
+        if (options->compressionLevel == 0) return Y_PNG_FILTER_NONE;
+        #ifdef HAVE_LIBPNG
+        if (colorType == Y_PNG_COLOR_PALETTE) return Y_PNG_FILTER_NONE;
+        #endif
+        if (options->compressionLevel > 0 && options->compressionLevel <= 3) return Y_PNG_FILTER_SUB;
+        return Y_PNG_FILTER_ALL;
+    }
+
+    return options->filters & Y_PNG_FILTER_ALL;
+}
+
+
+/** \return the colour type stored in the IHDR chunk */
+static int png_color_code(yPngColorType colorType)
+{
+    switch (colorType)
+    {
+    case Y_PNG_COLOR_PALETTE: return 3;
+    case Y_PNG_COLOR_RGB: return 2;
+    case Y_PNG_COLOR_GRAY: return 0;
+    case Y_PNG_COLOR_GRAY_ALPHA: return 4;
+    default: return 6;
+    }
+}
+
+
+/** fill a png row of the given colour type with the row "y" of the image */
+static void fill_png_row(yImage *im, int y, yPngColorType colorType, png_palette_t *palette, unsigned char *data)
+{
+    const unsigned char *ptr = im->rgbData + ((size_t) y * im->rgbWidth * 3);
+    int index = y * im->rgbWidth;
+    int x;
+
+    switch (colorType)
+    {
+    case Y_PNG_COLOR_PALETTE:
+        for (x = 0; x < im->rgbWidth; x++, ptr += 3)
+            data[x] = png_palette_index(palette, rgba_key(ptr, pixel_alpha(im, index + x, ptr)), 0);
+        break;
+    case Y_PNG_COLOR_GRAY:
+        for (x = 0; x < im->rgbWidth; x++, ptr += 3)
+            data[x] = ptr[0];
+        break;
+    case Y_PNG_COLOR_GRAY_ALPHA:
+        for (x = 0; x < im->rgbWidth; x++, ptr += 3)
+        {
+            data[(x << 1) + 0] = ptr[0];
+            data[(x << 1) + 1] = pixel_alpha(im, index + x, ptr);
+        }
+        break;
+    default:
+        for (x = 0; x < im->rgbWidth; x++, ptr += 3)
+        {
+            data[(x << 2) + 0] = ptr[0];
+            data[(x << 2) + 1] = ptr[1];
+            data[(x << 2) + 2] = ptr[2];
+            data[(x << 2) + 3] = pixel_alpha(im, index + x, ptr);
+        }
+    }
+}
+
+
+
+/************************************************************/
+/*                   BLOCK PNG ENCODER                      */
+/************************************************************/
+
+/*
+ * The rows are encoded by groups, possibly on several threads. The
+ * tasks first build and filter the rows of a group, then deflate blocks
+ * of rows independently. With zlib, each block is primed with the
+ * 32 KiB of filtered data preceding it. The blocks end on a byte
+ * boundary, so that they join into a single zlib stream, split in one
+ * IDAT chunk by block.
+ *
+ * Without libpng, this is the encoder used for all the images, with
+ * the built-in deflate.
+ */
+
+/** minimum size of the filtered rows of a block */
+#define PNG_BLOCK_SIZE (256 * 1024)
+/** size of the deflate window */
+#define PNG_WINDOW_SIZE 32768
+/** number of blocks in a group, by thread */
+#define PNG_BLOCKS_BY_THREAD 4
+
+/** a block of rows deflated by one task */
+typedef struct {
+    unsigned char *out; /**< 2 bytes for the zlib header, the deflate data, then 4 bytes for the adler32 */
+    size_t capacity; /**< allocated size of "out" */
+    size_t outSize; /**< size of the deflate data */
+    uint32_t adler; /**< adler32 of the filtered rows */
+} png_block_t;
+
+/** state of the block encoder */
+typedef struct {
+    yImage *im;
+    yPngColorType colorType;
+    png_palette_t *palette;
+    const unsigned char *indices; /**< indices of the quantized image, or NULL */
+    int bitDepth;
+    int channels;
+    size_t rowSize; /**< size of a filtered row, with its filter type byte */
+    int filters; /**< combination of Y_PNG_FILTER_* flags */
+    int level; /**< compression level, -1 for the default */
+    int strategy; /**< zlib strategy */
+    int rowsByBlock;
+    int nbBlocks; /**< number of blocks of the current group */
+    int firstRow; /**< first row of the current group */
+    int nbRows; /**< number of rows of the current group */
+    int last; /**< set for the last group of the image */
+    unsigned char *filtered; /**< filtered rows of the group, after PNG_WINDOW_SIZE bytes of history */
+    size_t history; /**< number of valid bytes before the rows of the group */
+    png_block_t *blocks;
+    volatile int failed; /**< set by the tasks on error */
+} png_block_encoder_t;
+
+
+static void put_uint32(unsigned char *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = (value >> 16) & 0xFF;
+    data[2] = (value >> 8) & 0xFF;
+    data[3] = value & 0xFF;
+}
+
+
+static uint32_t get_uint32(const unsigned char *data)
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+
+/** \return 0 in case of success */
+static int write_png_chunk(yWriteCallback write, void *userData, const char *type, const unsigned char *data, size_t length)
+{
+    unsigned char head[8], tail[4];
+    uint32_t crc = y_crc32(0, (const unsigned char *) type, 4);
+
+    if (length > 0)
+        crc = y_crc32(crc, data, length);
+
+    put_uint32(head, length);
+    memcpy(head + 4, type, 4);
+    put_uint32(tail, crc);
+
+    return write(userData, head, 8) || (length > 0 && write(userData, data, length)) || write(userData, tail, 4);
+}
+
+
+/** write the PNG signature and the IHDR chunk, \return 0 in case of success */
+static int write_png_header(yWriteCallback write, void *userData, int width, int height, int bitDepth,
+    yPngColorType colorType)
+{
+    unsigned char header[13];
+
+    put_uint32(header, width);
+    put_uint32(header + 4, height);
+    header[8] = bitDepth;
+    header[9] = png_color_code(colorType);
+    header[10] = 0; /* deflate */
+    header[11] = 0; /* adaptive filtering */
+    header[12] = 0; /* no interlace */
+
+    return write(userData, png_signature, 8) || write_png_chunk(write, userData, "IHDR", header, 13);
+}
+
+
+/** the 2 bytes of a zlib header : deflate with a 32 KiB window, and the compression level */
+static void put_zlib_header(unsigned char *out, int level)
+{
+    int flags;
+
+    if (level < 0) level = 6;
+    flags = (level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3))) << 6;
+    out[0] = 0x78;
+    out[1] = flags + 31 - ((0x78 << 8) + flags) % 31;
+}
+
+
+/** build the row "y" of the image as stored in the file, before filtering */
+static void build_png_row(png_block_encoder_t *enc, int y, png_palette_t *palette, unsigned char *row)
+{
+    yImage *im = enc->im;
+    int x, k;
+
+    if (enc->indices != NULL)
+        memcpy(row, enc->indices + (size_t) y * im->rgbWidth, im->rgbWidth);
+    else if (enc->colorType == Y_PNG_COLOR_RGB)
+        memcpy(row, im->rgbData + (size_t) y * im->rgbWidth * 3, (size_t) im->rgbWidth * 3);
+    else
+        fill_png_row(im, y, enc->colorType, palette, row);
+
+    if (enc->bitDepth < 8)
+    {
+        /* pack the indices, the first one in the high bits */
+        int perByte = 8 / enc->bitDepth;
+        for (x = 0; x < im->rgbWidth; x += perByte)
+        {
+            unsigned char packed = 0;
+            for (k = 0; k < perByte; k++)
+            {
+                packed <<= enc->bitDepth;
+                if (x + k < im->rgbWidth) packed |= row[x + k];
+            }
+            row[x / perByte] = packed;
+        }
+    }
+}
+
+
+/** the Paeth predictor of a byte, from its left, upper and upper left neighbours */
+static int paeth_predictor(int a, int b, int c)
+{
+    int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+
+    return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+
+/** apply a filter to a row of "n" bytes, "bpp" being the number of bytes by pixel */
+static void filter_png_row(int type, const unsigned char *row, const unsigned char *prev, size_t n, size_t bpp, unsigned char *out)
+{
+    size_t i;
+
+    *out++ = type;
+
+    switch (type)
+    {
+    case ROW_FILTER_SUB:
+        for (i = 0; i < bpp; i++) out[i] = row[i];
+        for (; i < n; i++) out[i] = row[i] - row[i - bpp];
+        break;
+    case ROW_FILTER_UP:
+        for (i = 0; i < n; i++) out[i] = row[i] - prev[i];
+        break;
+    case ROW_FILTER_AVG:
+        for (i = 0; i < bpp; i++) out[i] = row[i] - (prev[i] >> 1);
+        for (; i < n; i++) out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+        break;
+    case ROW_FILTER_PAETH:
+        for (i = 0; i < bpp; i++) out[i] = row[i] - prev[i];
+        for (; i < n; i++) out[i] = row[i] - paeth_predictor(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        memcpy(out, row, n);
+    }
+}
+
+
+/** \return the sum of the absolute values of the filtered bytes, as libpng does to choose a filter */
+static size_t png_row_cost(const unsigned char *data, size_t n)
+{
+    size_t i, sum = 0;
+
+    for (i = 0; i < n; i++)
+        sum += data[i] < 128 ? data[i] : 256 - data[i];
+
+    return sum;
+}
+
+
+/**
+ * Filter a row of "n" bytes with the best of the "filters" : the one
+ * giving the smallest png_row_cost(). "out" and "trial" receive n + 1
+ * bytes.
+ */
+static void choose_png_filter(int filters, const unsigned char *row, const unsigned char *prev, size_t n, size_t bpp,
+    unsigned char *out, unsigned char *trial)
+{
+    size_t bestCost = (size_t) -1;
+    int type;
+
+    for (type = ROW_FILTER_NONE; type <= ROW_FILTER_PAETH; type++)
+    {
+        int flag = Y_PNG_FILTER_NONE << type;
+        size_t cost;
+
+        if (!(filters & flag))
+            continue;
+
+        if ((filters & ~flag) == 0)
+        {
+            /* a single filter to use */
+            filter_png_row(type, row, prev, n, bpp, out);
+            return;
+        }
+
+        filter_png_row(type, row, prev, n, bpp, trial);
+        cost = png_row_cost(trial + 1, n);
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            memcpy(out, trial, n + 1);
+        }
+    }
+
+    if (filters == 0)
+        filter_png_row(ROW_FILTER_NONE, row, prev, n, bpp, out);
+}
+
+
+/** task building and filtering the rows of the block "index" */
+static void filter_png_block(void *data, int index)
+{
+    png_block_encoder_t *enc = data;
+    png_palette_t palette;
+    size_t n = enc->rowSize - 1;
+    size_t bpp = enc->channels * enc->bitDepth / 8;
+    size_t rawSize = (size_t) enc->im->rgbWidth * enc->channels;
+    unsigned char *buffer, *row, *prev, *trial, *tmp;
+    int y0 = enc->firstRow + index * enc->rowsByBlock;
+    int y1 = y0 + enc->rowsByBlock;
+    int y;
+
+    if (y1 > enc->firstRow + enc->nbRows)
+        y1 = enc->firstRow + enc->nbRows;
+    if (bpp < 1)
+        bpp = 1;
+
+    buffer = malloc(2 * rawSize + enc->rowSize);
+    if (buffer == NULL)
+    {
+        enc->failed = 1;
+        return;
+    }
+    row = buffer;
+    prev = buffer + rawSize;
+    trial = buffer + 2 * rawSize;
+
+    /* the palette caches the last colour searched : each task needs its own */
+    if (enc->colorType == Y_PNG_COLOR_PALETTE && enc->indices == NULL)
+        palette = *enc->palette;
+
+    if (y0 > 0)
+        build_png_row(enc, y0 - 1, &palette, prev);
+    else
+        memset(prev, 0, n);
+
+    for (y = y0; y < y1; y++)
+    {
+        unsigned char *out = enc->filtered + PNG_WINDOW_SIZE + (size_t) (y - enc->firstRow) * enc->rowSize;
+
+        build_png_row(enc, y, &palette, row);
+        choose_png_filter(enc->filters, row, prev, n, bpp, out, trial);
+
+        tmp = prev;
+        prev = row;
+        row = tmp;
+    }
+
+    free(buffer);
+}
+
+
+/** \return the filtered rows of the block "index", and their size */
+static unsigned char *png_block_data(png_block_encoder_t *enc, int index, size_t *length)
+{
+    int first = index * enc->rowsByBlock;
+    int nbRows = enc->nbRows - first < enc->rowsByBlock ? enc->nbRows - first : enc->rowsByBlock;
+
+    *length = (size_t) nbRows * enc->rowSize;
+    return enc->filtered + PNG_WINDOW_SIZE + (size_t) first * enc->rowSize;
+}
+
+
+/** make sure that a block can receive "needed" bytes, \return 0 on failure */
+static int reserve_png_block(png_block_t *block, size_t needed)
+{
+    if (block->capacity < needed)
+    {
+        free(block->out);
+        block->out = malloc(needed);
+        block->capacity = block->out != NULL ? needed : 0;
+    }
+
+    return block->out != NULL;
+}
+
+
+#ifdef HAVE_LIBPNG
+static int png_strategy(yPngStrategy strategy)
+{
+    switch (strategy)
+    {
+    case Y_PNG_STRATEGY_FILTERED: return Z_FILTERED;
+    case Y_PNG_STRATEGY_HUFFMAN_ONLY: return Z_HUFFMAN_ONLY;
+    case Y_PNG_STRATEGY_RLE: return Z_RLE;
+    case Y_PNG_STRATEGY_FIXED: return Z_FIXED;
+    default: return Z_DEFAULT_STRATEGY;
+    }
+}
+
+
+/** task deflating the block "index" with zlib */
+static void deflate_png_block(void *data, int index)
+{
+    png_block_encoder_t *enc = data;
+    png_block_t *block = enc->blocks + index;
+    size_t length;
+    unsigned char *in = png_block_data(enc, index, &length);
+    size_t dictionary = enc->history + (in - (enc->filtered + PNG_WINDOW_SIZE));
+    int flush = (enc->last && index == enc->nbBlocks - 1) ? Z_FINISH : Z_SYNC_FLUSH;
+    z_stream strm;
+    int ret, done = 0;
+
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, enc->level, Z_DEFLATED, -15, 8, png_strategy(enc->strategy)) != Z_OK)
+    {
+        enc->failed = 1;
+        return;
+    }
+
+    if (dictionary > PNG_WINDOW_SIZE)
+        dictionary = PNG_WINDOW_SIZE;
+    if (dictionary > 0)
+        deflateSetDictionary(&strm, in - dictionary, dictionary);
+
+    /* room for the header, the trailer and the empty block of the sync flush */
+    reserve_png_block(block, deflateBound(&strm, length) + 16);
+
+    block->outSize = 0;
+    strm.next_in = in;
+    strm.avail_in = length;
+
+    while (block->out != NULL)
+    {
+        unsigned char *bigger;
+
+        strm.next_out = block->out + 2 + block->outSize;
+        strm.avail_out = block->capacity - 6 - block->outSize;
+        ret = deflate(&strm, flush);
+        block->outSize = block->capacity - 6 - strm.avail_out;
+
+        if (ret == Z_STREAM_ERROR)
+            break;
+        if (ret == Z_STREAM_END || strm.avail_out > 0)
+        {
+            done = 1;
+            break;
+        }
+
+        /* the output buffer is full */
+        bigger = realloc(block->out, 2 * block->capacity);
+        if (bigger == NULL)
+            break;
+        block->out = bigger;
+        block->capacity *= 2;
+    }
+
+    if (!done)
+        enc->failed = 1;
+
+    block->adler = y_adler32(1, in, length);
+    deflateEnd(&strm);
+}
+#else
+/** task deflating the block "index" with the built-in deflate */
+static void deflate_png_block(void *data, int index)
+{
+    png_block_encoder_t *enc = data;
+    png_block_t *block = enc->blocks + index;
+    size_t length;
+    unsigned char *in = png_block_data(enc, index, &length);
+    int last = enc->last && index == enc->nbBlocks - 1;
+
+    /* room for the header and the trailer */
+    if (!reserve_png_block(block, y_deflate_bound(length) + 6))
+    {
+        enc->failed = 1;
+        return;
+    }
+
+    block->outSize = y_deflate(in, length, enc->level == 0 ? Y_DEFLATE_STORED : Y_DEFLATE_RLE, last, block->out + 2);
+    block->adler = y_adler32(1, in, length);
+}
+#endif
+
+
+/**
+ * Write compressed image data : an IDAT chunk, or the fdAT chunk of an
+ * APNG frame when "sequence" is set. \return 0 in case of success
+ */
+static int write_png_data(yWriteCallback write, void *userData, uint32_t *sequence, const unsigned char *data,
+    size_t length)
+{
+    unsigned char head[12], tail[4];
+    uint32_t crc;
+
+    if (sequence == NULL)
+        return write_png_chunk(write, userData, "IDAT", data, length);
+
+    put_uint32(head, length + 4);
+    memcpy(head + 4, "fdAT", 4);
+    put_uint32(head + 8, (*sequence)++);
+    crc = y_crc32(y_crc32(0, head + 4, 8), data, length);
+    put_uint32(tail, crc);
+
+    return write(userData, head, 12) || write(userData, data, length) || write(userData, tail, 4);
+}
+
+
+/**
+ * Compress the rows of an image by blocks, on "nbThreads" threads, and
+ * write them in IDAT chunks, or in fdAT chunks when "sequence" is set.
+ * \return 0 in case of success, 3 for a write error, 4 if the memory
+ * can't be allocated
+ */
+static int encode_png_rows(yImage *im, yPngOptions *options, yPngColorType colorType, png_palette_t *palette,
+    const unsigned char *indices, int bitDepth, int channels, int nbThreads, uint32_t *sequence,
+    yWriteCallback write, void *userData)
+{
+    png_block_encoder_t enc;
+    uint32_t adler = 1;
+    int maxBlocks = nbThreads * PNG_BLOCKS_BY_THREAD;
+    int groupRows, i, err = 0;
+
+    memset(&enc, 0, sizeof(enc));
+    enc.im = im;
+    enc.colorType = colorType;
+    enc.palette = palette;
+    enc.indices = indices;
+    enc.bitDepth = bitDepth;
+    enc.channels = channels;
+    enc.rowSize = ((size_t) im->rgbWidth * channels * bitDepth + 7) / 8 + 1;
+    enc.filters = png_filter_flags(options, colorType);
+    enc.level = options->compressionLevel < 0 ? -1 :
+        (options->compressionLevel > 9 ? 9 : options->compressionLevel);
+    enc.strategy = options->strategy;
+    enc.rowsByBlock = PNG_BLOCK_SIZE / enc.rowSize;
+    if (enc.rowsByBlock < 1)
+        enc.rowsByBlock = 1;
+
+    groupRows = enc.rowsByBlock * maxBlocks;
+    if (groupRows > im->rgbHeight)
+        groupRows = im->rgbHeight;
+
+    enc.filtered = malloc(PNG_WINDOW_SIZE + (size_t) groupRows * enc.rowSize);
+    enc.blocks = calloc(maxBlocks, sizeof(png_block_t));
+    if (enc.filtered == NULL || enc.blocks == NULL)
+    {
+        free(enc.filtered);
+        free(enc.blocks);
+        return 4;
+    }
+
+    for (enc.firstRow = 0; !err && enc.firstRow < im->rgbHeight; enc.firstRow += enc.nbRows)
+    {
+        size_t length, keep;
+
+        enc.nbRows = im->rgbHeight - enc.firstRow < groupRows ? im->rgbHeight - enc.firstRow : groupRows;
+        enc.last = enc.firstRow + enc.nbRows == im->rgbHeight;
+        enc.nbBlocks = (enc.nbRows + enc.rowsByBlock - 1) / enc.rowsByBlock;
+
+        y_parallel_for(enc.nbBlocks, nbThreads, filter_png_block, &enc);
+        if (!enc.failed)
+            y_parallel_for(enc.nbBlocks, nbThreads, deflate_png_block, &enc);
+        if (enc.failed)
+        {
+            /* the tasks fail only when the memory is lacking */
+            err = 4;
+            break;
+        }
+
+        for (i = 0; i < enc.nbBlocks && !err; i++)
+        {
+            png_block_t *block = enc.blocks + i;
+            unsigned char *out = block->out + 2;
+            size_t size = block->outSize;
+
+            png_block_data(&enc, i, &length);
+            adler = y_adler32_combine(adler, block->adler, length);
+
+            if (enc.firstRow == 0 && i == 0)
+            {
+                out -= 2;
+                put_zlib_header(out, enc.level);
+                size += 2;
+            }
+
+            if (enc.last && i == enc.nbBlocks - 1)
+            {
+                put_uint32(out + size, adler);
+                size += 4;
+            }
+
+            if (size > 0 && write_png_data(write, userData, sequence, out, size))
+                err = 3;
+        }
+
+        /* keep the end of the group as dictionary for the next one */
+        length = (size_t) enc.nbRows * enc.rowSize;
+        keep = length + enc.history < PNG_WINDOW_SIZE ? length + enc.history : PNG_WINDOW_SIZE;
+        memmove(enc.filtered + PNG_WINDOW_SIZE - keep, enc.filtered + PNG_WINDOW_SIZE + length - keep, keep);
+        enc.history = keep;
+    }
+
+    for (i = 0; i < maxBlocks; i++)
+        free(enc.blocks[i].out);
+    free(enc.blocks);
+    free(enc.filtered);
+
+    return err;
+}
+
+
+/**
+ * Encode a PNG file by blocks of rows, on "nbThreads" threads.
+ * \return 0 in case of success, 3 for a write error, 4 if the memory
+ * can't be allocated
+ */
+static int encode_png_blocks(yImage *im, yPngOptions *options, yPngColorType colorType, png_palette_t *palette,
+    const unsigned char *indices, int bitDepth, int channels, int nbThreads,
+    yWriteCallback write, void *userData)
+{
+    int err;
+
+    if (write_png_header(write, userData, im->rgbWidth, im->rgbHeight, bitDepth, colorType))
+        return 3;
+
+    if (colorType == Y_PNG_COLOR_PALETTE)
+    {
+        unsigned char colors[3 * 256];
+        unsigned char alphas[256];
+        int nbTransparent = sort_png_palette(palette, colors, alphas);
+
+        if (write_png_chunk(write, userData, "PLTE", colors, 3 * palette->nbColors) ||
+            (nbTransparent > 0 && write_png_chunk(write, userData, "tRNS", alphas, nbTransparent)))
+            return 3;
+    }
+
+    err = encode_png_rows(im, options, colorType, palette, indices, bitDepth, channels, nbThreads, NULL,
+        write, userData);
+    if (!err && write_png_chunk(write, userData, "IEND", NULL, 0))
+        err = 3;
+
+    return err;
+}
+
+
+/** \return the number of threads to use to encode the image */
+static int png_threads(yImage *im, yPngOptions *options, int channels)
+{
+    int nbThreads = options->threads;
+
+    if (nbThreads <= 0)
+        nbThreads = y_cpu_count();
+
+    /* small images are not worth it */
+    if ((size_t) im->rgbWidth * im->rgbHeight * channels < 2 * PNG_BLOCK_SIZE)
+        return 1;
+
+    return nbThreads;
+}
+
+
+#ifdef HAVE_LIBPNG
+/** set the PLTE and tRNS chunks */
+static void set_png_palette(png_structp png_ptr, png_infop info_ptr, png_palette_t *palette)
+{
+    png_color colors[256];
+    unsigned char rgb[3 * 256];
+    png_byte alphas[256];
+    int i, n = palette->nbColors;
+    int nbTransparent = sort_png_palette(palette, rgb, alphas);
+
+    for (i = 0; i < n; i++)
+    {
+        colors[i].red = rgb[3 * i];
+        colors[i].green = rgb[3 * i + 1];
+        colors[i].blue = rgb[3 * i + 2];
+    }
+
+    png_set_PLTE(png_ptr, info_ptr, colors, n);
+    if (nbTransparent > 0)
+        png_set_tRNS(png_ptr, info_ptr, alphas, nbTransparent, NULL);
+}
+
+
+/** libpng's filters for a combination of Y_PNG_FILTER_* flags */
+static int png_filters(int flags)
+{
+    int filters = 0;
+
+    if (flags & Y_PNG_FILTER_NONE) filters |= PNG_FILTER_NONE;
+    if (flags & Y_PNG_FILTER_SUB) filters |= PNG_FILTER_SUB;
+    if (flags & Y_PNG_FILTER_UP) filters |= PNG_FILTER_UP;
+    if (flags & Y_PNG_FILTER_AVG) filters |= PNG_FILTER_AVG;
+    if (flags & Y_PNG_FILTER_PAETH) filters |= PNG_FILTER_PAETH;
+
+    return filters;
+}
+
+
+/** encode a PNG file with libpng, on the calling thread */
+static int encode_png_libpng(yImage *im, yPngOptions *options, yPngColorType colorType, png_palette_t *palette,
+    const unsigned char *indices, int bitDepth, int channels, yWriteCallback write, void *userData)
+{
+    png_structp png_ptr;
+    png_infop info_ptr;
+    unsigned char * volatile data = NULL;
+    int y;
+    png_bytep row_ptr;
+    png_callback_destination dest;
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr)
+    {
+        fprintf(stderr, "Fail create png data\n");
+        return 1;
+    }
+    info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == NULL)
+    {
+        png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
+        fprintf(stderr, "Fail create png data\n");
+        return 2;
+    }
+    if (setjmp(png_jmpbuf(png_ptr)))
+    {
+        free(data);
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        fprintf(stderr, "Fail create png data\n");
+        return 3;
+    }
+    dest.write = write;
+    dest.userData = userData;
+    png_set_write_fn(png_ptr, &dest, png_callback_write, png_callback_flush);
+
+    if (options->compressionLevel >= 0)
+        png_set_compression_level(png_ptr, options->compressionLevel > 9 ? 9 : options->compressionLevel);
+    png_set_compression_strategy(png_ptr, png_strategy(options->strategy));
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, png_filters(png_filter_flags(options, colorType)));
+
+    png_set_IHDR(png_ptr, info_ptr, im->rgbWidth, im->rgbHeight, bitDepth,
+        png_color_code(colorType), PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    if (colorType == Y_PNG_COLOR_PALETTE)
+        set_png_palette(png_ptr, info_ptr, palette);
+    png_write_info(png_ptr, info_ptr);
+    /* the indices are given one by byte */
+    if (bitDepth < 8)
+        png_set_packing(png_ptr);
+
+    if (colorType != Y_PNG_COLOR_RGB && indices == NULL)
+    {
+        data = (unsigned char *) malloc(im->rgbWidth * channels);
+        if (!data)
+        {
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+            fprintf(stderr, "Fail create png data : no data\n");
+            return 4;
+        }
+    }
+    for (y = 0; y < im->rgbHeight; y++)
+    {
+        if (indices != NULL)
+        {
+            row_ptr = (png_bytep) indices + ((size_t) y * im->rgbWidth);
+        }
+        else if (data == NULL)
+        {
+            /* RGB rows are written directly from the image */
+            row_ptr = im->rgbData + ((size_t) y * im->rgbWidth * 3);
+        }
+        else
+        {
+            fill_png_row(im, y, colorType, palette, data);
+            row_ptr = data;
+        }
+        png_write_rows(png_ptr, &row_ptr, 1);
+    }
+    free(data);
+    data = NULL;
+    png_write_end(png_ptr, info_ptr);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return 0;
+}
+#endif
+
+
+int y_encode_png_with_options(yImage *im, yPngOptions *options, yWriteCallback write, void *userData)
+{
+    unsigned char *indices = NULL;
+    yPngOptions defaults;
+    yPngColorType colorType;
+    png_palette_t palette;
+    int channels, bitDepth = 8;
+    int nbThreads, err;
+
+    if (options == NULL)
+    {
+        y_init_png_options(&defaults);
+        options = &defaults;
+    }
+
+    colorType = options->colorType;
+    if (colorType == Y_PNG_COLOR_AUTO)
+        colorType = reduce_png_color_type(im, &palette);
+    else if (colorType == Y_PNG_COLOR_PALETTE && !count_png_colors(im, &palette))
+    {
+        indices = quantize_png_image(im, options->dithering, &palette);
+        if (indices == NULL)
+            colorType = Y_PNG_COLOR_RGBA;
+    }
+
+    switch (colorType)
+    {
+    case Y_PNG_COLOR_PALETTE:
+        channels = 1;
+        bitDepth = palette_bit_depth(palette.nbColors);
+        break;
+    case Y_PNG_COLOR_RGB: channels = 3; break;
+    case Y_PNG_COLOR_GRAY: channels = 1; break;
+    case Y_PNG_COLOR_GRAY_ALPHA: channels = 2; break;
+    default: channels = 4;
+    }
+
+    nbThreads = png_threads(im, options, channels);
+
+    #ifdef HAVE_LIBPNG
+    if (nbThreads == 1)
+        err = encode_png_libpng(im, options, colorType, &palette, indices, bitDepth, channels, write, userData);
+    else
+    #endif
+        err = encode_png_blocks(im, options, colorType, &palette, indices, bitDepth, channels, nbThreads,
+            write, userData);
+
+    free(indices);
+    return err;
+}
+
+
+int y_encode_png(yImage *im, yWriteCallback write, void *userData)
+{
+    return y_encode_png_with_options(im, NULL, write, userData);
+}
+
+
+int y_save_png_with_options(yImage *im, const char *file, yPngOptions *options)
+{
+    FILE *f; /* descripteur du fichier à créer */
+    int err;
+
+    f = fopen(file, "wb");
+    if (f)
+    {
+        err = y_encode_png_with_options(im, options, file_write, f);
+        if (fclose(f) && !err) err = 1;
+        if (err) fprintf(stderr, "Fail create png file %s\n", file);
+        return err;
+    }
+    return 5;
+}
+
+
+int y_save_png(yImage *im, const char *file)
+{
+    return y_save_png_with_options(im, file, NULL);
+}
+
+
+
+/* ANIMATED PNG */
+
+
+/** APNG frame disposal : the canvas is left as is before the next frame */
+#define APNG_DISPOSE_OP_NONE 0
+
+/** APNG frame blending : the frame's pixels replace the canvas' ones */
+#define APNG_BLEND_OP_SOURCE 0
+
+/** largest delay of an APNG frame, in milliseconds */
+#define APNG_MAX_DELAY 65535
+
+
+/** a frame of an animation, and the rectangle changed since the previous one */
+typedef struct {
+    yImage *im;
+    int x, y, width, height;
+    int delay; /**< display time in milliseconds */
+} apng_frame_t;
+
+
+void y_init_apng_options(yApngOptions *options)
+{
+    options->delay = 100;
+    options->delays = NULL;
+    options->loops = 0;
+    y_init_png_options(&options->png);
+}
+
+
+/** \return a copy of the region (x, y, w, h) of "im", which must be inside it, or NULL */
+static yImage *crop_image(yImage *im, int x, int y, int w, int h)
+{
+    yImage *region;
+    int err, i;
+
+    region = y_create_image(&err, NULL, w, h);
+    if (region == NULL)
+        return NULL;
+
+    for (i = 0; i < h; i++)
+    {
+        size_t pos = (size_t) (y + i) * im->rgbWidth + x;
+
+        memcpy(region->rgbData + (size_t) 3 * i * w, im->rgbData + 3 * pos, (size_t) 3 * w);
+        if (im->alphaChanel != NULL)
+            memcpy(region->alphaChanel + (size_t) i * w, im->alphaChanel + pos, w);
+    }
+    return region;
+}
+
+
+/** \return 1 if the pixel "index" differs between two images of the same size */
+static int pixel_differs(yImage *a, yImage *b, size_t index)
+{
+    const unsigned char *p = a->rgbData + 3 * index, *q = b->rgbData + 3 * index;
+
+    return p[0] != q[0] || p[1] != q[1] || p[2] != q[2] || pixel_alpha(a, index, p) != pixel_alpha(b, index, q);
+}
+
+
+/** \return 1 if the row "y" differs between two images of the same size */
+static int row_differs(yImage *a, yImage *b, int y)
+{
+    size_t first = (size_t) y * a->rgbWidth, i;
+
+    if (memcmp(a->rgbData + 3 * first, b->rgbData + 3 * first, 3 * (size_t) a->rgbWidth))
+        return 1;
+
+    if (a->alphaChanel != NULL && b->alphaChanel != NULL)
+        return memcmp(a->alphaChanel + first, b->alphaChanel + first, a->rgbWidth) != 0;
+
+    for (i = first; i < first + a->rgbWidth; i++)
+        if (pixel_alpha(a, i, a->rgbData + 3 * i) != pixel_alpha(b, i, b->rgbData + 3 * i)) return 1;
+
+    return 0;
+}
+
+
+/**
+ * Find the bounding rectangle of the pixels changed from "prev" to
+ * "frame->im". \return 0 if some pixels changed
+ */
+static int changed_rectangle(yImage *prev, apng_frame_t *frame)
+{
+    yImage *im = frame->im;
+    int top, bottom, left, right, x, y;
+
+    for (top = 0; top < im->rgbHeight && !row_differs(prev, im, top); top++);
+    if (top == im->rgbHeight)
+        return 1;
+    for (bottom = im->rgbHeight - 1; bottom > top && !row_differs(prev, im, bottom); bottom--);
+
+    left = im->rgbWidth;
+    right = -1;
+    for (y = top; y <= bottom; y++)
+    {
+        size_t first = (size_t) y * im->rgbWidth;
+
+        for (x = 0; x < left && !pixel_differs(prev, im, first + x); x++);
+        left = x;
+        for (x = im->rgbWidth - 1; x > right && !pixel_differs(prev, im, first + x); x--);
+        right = x;
+    }
+
+    frame->x = left;
+    frame->y = top;
+    frame->width = right - left + 1;
+    frame->height = bottom - top + 1;
+    return 0;
+}
+
+
+/** write the fcTL chunk of a frame, \return 0 in case of success */
+static int write_apng_frame_control(yWriteCallback write, void *userData, uint32_t *sequence, apng_frame_t *frame)
+{
+    unsigned char control[26];
+    int delay = frame->delay < APNG_MAX_DELAY ? frame->delay : APNG_MAX_DELAY;
+
+    put_uint32(control, (*sequence)++);
+    put_uint32(control + 4, frame->width);
+    put_uint32(control + 8, frame->height);
+    put_uint32(control + 12, frame->x);
+    put_uint32(control + 16, frame->y);
+    control[20] = delay >> 8;
+    control[21] = delay & 0xFF;
+    control[22] = 1000 >> 8;
+    control[23] = 1000 & 0xFF;
+    control[24] = APNG_DISPOSE_OP_NONE;
+    control[25] = APNG_BLEND_OP_SOURCE;
+
+    return write_png_chunk(write, userData, "fcTL", control, 26);
+}
+
+
+/** write the data of a frame, limited to its changed rectangle, \return 0 in case of success */
+static int write_apng_frame_data(yWriteCallback write, void *userData, uint32_t *sequence, apng_frame_t *frame,
+    yPngOptions *options, yPngColorType colorType, int channels, int first)
+{
+    yImage *region = frame->im;
+    png_palette_t palette;
+    int err;
+
+    if (frame->width != region->rgbWidth || frame->height != region->rgbHeight)
+    {
+        region = crop_image(frame->im, frame->x, frame->y, frame->width, frame->height);
+        if (region == NULL)
+            return 4;
+    }
+
+    /* the first frame is the default image, in IDAT chunks */
+    err = encode_png_rows(region, options, colorType, &palette, NULL, 8, channels,
+        png_threads(region, options, channels), first ? NULL : sequence, write, userData);
+
+    if (region != frame->im)
+        y_destroy_image(region);
+    return err;
+}
+
+
+int y_encode_apng(yImage **frames, int nbFrames, yApngOptions *options, yWriteCallback write, void *userData)
+{
+    apng_frame_t *list;
+    yApngOptions defaults;
+    yPngColorType colorType = Y_PNG_COLOR_RGB;
+    unsigned char control[8];
+    uint32_t sequence = 0;
+    int nbWritten = 0, channels = 3, i, err = 0;
+
+    if (options == NULL)
+    {
+        y_init_apng_options(&defaults);
+        options = &defaults;
+    }
+
+    if (frames == NULL || nbFrames < 1)
+        return 1;
+    for (i = 0; i < nbFrames; i++)
+    {
+        if (frames[i]->rgbWidth != frames[0]->rgbWidth || frames[i]->rgbHeight != frames[0]->rgbHeight)
+            return 1;
+        if (colorType == Y_PNG_COLOR_RGB && has_transparency(frames[i]))
+        {
+            colorType = Y_PNG_COLOR_RGBA;
+            channels = 4;
+        }
+    }
+
+    list = malloc(nbFrames * sizeof(apng_frame_t));
+    if (list == NULL)
+        return 4;
+
+    /* the frames identical to the previous one only lengthen its display */
+    for (i = 0; i < nbFrames; i++)
+    {
+        apng_frame_t *frame = list + nbWritten;
+        int delay = options->delays != NULL ? options->delays[i] : options->delay;
+
+        frame->im = frames[i];
+        frame->x = 0;
+        frame->y = 0;
+        frame->width = frames[i]->rgbWidth;
+        frame->height = frames[i]->rgbHeight;
+
+        if (i > 0 && changed_rectangle(frames[i - 1], frame))
+            list[nbWritten - 1].delay += delay;
+        else
+        {
+            frame->delay = delay;
+            nbWritten++;
+        }
+    }
+
+    put_uint32(control, nbWritten);
+    put_uint32(control + 4, options->loops);
+
+    if (write_png_header(write, userData, frames[0]->rgbWidth, frames[0]->rgbHeight, 8, colorType) ||
+        write_png_chunk(write, userData, "acTL", control, 8))
+        err = 3;
+
+    for (i = 0; i < nbWritten && !err; i++)
+    {
+        if (write_apng_frame_control(write, userData, &sequence, list + i))
+            err = 3;
+        else
+            err = write_apng_frame_data(write, userData, &sequence, list + i, &options->png, colorType, channels,
+                i == 0);
+    }
+
+    if (!err && write_png_chunk(write, userData, "IEND", NULL, 0))
+        err = 3;
+
+    free(list);
+    return err;
+}
+
+
+int y_save_apng(yImage **frames, int nbFrames, const char *file, yApngOptions *options)
+{
+    FILE *f;
+    int err;
+
+    f = fopen(file, "wb");
+    if (f)
+    {
+        err = y_encode_apng(frames, nbFrames, options, file_write, f);
+        if (fclose(f) && !err) err = 1;
+        if (err) fprintf(stderr, "Fail create png file %s\n", file);
+        return err;
+    }
+    return 5;
+}
+
+
+
+#ifdef HAVE_LIBTIFF
+/** a TIFF file in memory, for libtiff's client I/O */
+typedef struct {
+    yBuffer *buffer; /**< the data written, NULL when reading */
+    const unsigned char *data; /**< the data to read */
+    size_t size; /**< size of the data to read */
+    size_t pos; /**< current position */
+} tiff_memory_stream;
+
+
+static tmsize_t tiff_memory_read(thandle_t handle, void *data, tmsize_t length) {
+    tiff_memory_stream *stream = (tiff_memory_stream *) handle;
+    const unsigned char *content = stream->buffer ? stream->buffer->data : stream->data;
+    size_t size = stream->buffer ? stream->buffer->size : stream->size;
+    size_t n;
+
+    if(stream->pos >= size || length <= 0) return 0;
+    n = size - stream->pos;
+    if(n > (size_t) length) n = length;
+
+    memcpy(data, content + stream->pos, n);
+    stream->pos += n;
+    return n;
+}
+
+
+static tmsize_t tiff_memory_write(thandle_t handle, void *data, tmsize_t length) {
+    tiff_memory_stream *stream = (tiff_memory_stream *) handle;
+    yBuffer *buffer = stream->buffer;
+
+    if(buffer == NULL || length < 0) return -1;
+    if(reserve_buffer(buffer, stream->pos + length) != 0) return -1;
+
+    if(stream->pos > buffer->size) {
+        memset(buffer->data + buffer->size, 0, stream->pos - buffer->size);
+    }
+    memcpy(buffer->data + stream->pos, data, length);
+    stream->pos += length;
+    if(stream->pos > buffer->size) buffer->size = stream->pos;
+    return length;
+}
+
+
+static toff_t tiff_memory_size(thandle_t handle) {
+    tiff_memory_stream *stream = (tiff_memory_stream *) handle;
+    return stream->buffer ? stream->buffer->size : stream->size;
+}
+
+
+static toff_t tiff_memory_seek(thandle_t handle, toff_t offset, int whence) {
+    tiff_memory_stream *stream = (tiff_memory_stream *) handle;
+
+    switch(whence) {
+    case SEEK_CUR: offset += stream->pos; break;
+    case SEEK_END: offset += tiff_memory_size(handle); break;
+    default: break;
+    }
+
+    stream->pos = offset;
+    return offset;
+}
+
+
+static int tiff_memory_close(thandle_t handle) {
+    return 0;
+}
+
+
+static int tiff_memory_map(thandle_t handle, void **base, toff_t *size) {
+    return 0;
+}
+
+
+static void tiff_memory_unmap(thandle_t handle, void *base, toff_t size) {
+}
+
+
+/** open a TIFF in memory : write in "buffer" with "mode" if not NULL, else read "data" */
+static TIFF *tiff_memory_open(tiff_memory_stream *stream, yBuffer *buffer, const char *mode, const unsigned char *data,
+    size_t size) {
+    stream->buffer = buffer;
+    stream->data = data;
+    stream->size = size;
+    stream->pos = 0;
+
+    return TIFFClientOpen("memory", buffer ? mode : "r", (thandle_t) stream,
+        tiff_memory_read, tiff_memory_write, tiff_memory_seek, tiff_memory_close,
+        tiff_memory_size, tiff_memory_map, tiff_memory_unmap);
+}
+
+
+/** set the fields of a TIFF with 8 bits RGB samples, and an alpha sample if "hasAlpha" is set */
+static void set_tiff_fields(TIFF *tif, int width, int height, int hasAlpha)
+{
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+    TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, hasAlpha ? 4 : 3);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    if (hasAlpha)
+    {
+        uint16_t extra = EXTRASAMPLE_UNASSALPHA;
+        TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, 1, &extra);
+    }
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, -1));
+}
+#endif
+
+
+
+/************************************************************/
+/*                   BLOCK TIFF ENCODER                     */
+/************************************************************/
+
+/*
+ * The image is cut in blocks : the tiles, or strips of rows. The blocks
+ * of a group are filled by several threads, which also compress them
+ * with deflate. Then they are written in order, as raw data. The other
+ * codecs (LZW, Zstandard) are run by libtiff itself, on the calling
+ * thread.
+ */
+
+/** number of blocks a thread handles by group */
+#define TIFF_BLOCKS_BY_THREAD 4
+
+/** approximative size of the uncompressed strips */
+#define TIFF_STRIP_SIZE (256 * 1024)
+
+
+void y_init_tiff_options(yTiffOptions *options)
+{
+    options->compression = Y_TIFF_COMPRESSION_LZW;
+    options->level = -1;
+    options->predictor = 0;
+    options->tileSize = 0;
+    options->bigTiff = 0;
+    options->dropAlpha = 0;
+    options->threads = 0;
+}
+
+
+#ifdef HAVE_LIBTIFF
+/** a block of the image, with its samples and compressed data */
+typedef struct {
+    unsigned char *data; /**< the samples */
+    size_t size; /**< number of bytes in data */
+    unsigned char *out; /**< the compressed data */
+    size_t outSize; /**< number of bytes in out */
+} tiff_block_t;
+
+
+/** context of the block encoder, shared by the tasks */
+typedef struct {
+    yImage *im;
+    yTiffOptions *options;
+    int channels; /**< 3 or 4 samples by pixel */
+    int tiled; /**< set if the blocks are tiles, else strips */
+    int blockWidth, blockHeight; /**< size of the blocks, the last strip may be shorter */
+    int blocksAcross; /**< number of blocks in a row of blocks */
+    int nbBlocks; /**< number of blocks in the image */
+    int ownCodec; /**< set if the blocks are deflated by the tasks, else compressed by libtiff */
+    size_t outCapacity; /**< size of the blocks' out buffer */
+    int first; /**< index of the first block of the group */
+    tiff_block_t *blocks; /**< the blocks of the group */
+    volatile int failed; /**< set if a task failed */
+} tiff_block_encoder_t;
+
+
+/** fill "block" with the samples of the block "index" of the image */
+static void fill_tiff_block(tiff_block_encoder_t *enc, int index, tiff_block_t *block)
+{
+    yImage *im = enc->im;
+    int x0 = (index % enc->blocksAcross) * enc->blockWidth;
+    int y0 = (index / enc->blocksAcross) * enc->blockHeight;
+    int width = im->rgbWidth - x0 < enc->blockWidth ? im->rgbWidth - x0 : enc->blockWidth;
+    int height = im->rgbHeight - y0 < enc->blockHeight ? im->rgbHeight - y0 : enc->blockHeight;
+    size_t rowSize = (size_t) enc->blockWidth * enc->channels;
+    int x, y;
+
+    /* the tiles on the right and bottom edges are padded */
+    block->size = rowSize * (enc->tiled ? enc->blockHeight : height);
+    if (enc->tiled && (width < enc->blockWidth || height < enc->blockHeight))
+        memset(block->data, 0, block->size);
+
+    for (y = 0; y < height; y++)
+    {
+        size_t pos = (size_t) (y0 + y) * im->rgbWidth + x0;
+        const unsigned char *rgb = im->rgbData + 3 * pos;
+        unsigned char *out = block->data + y * rowSize;
+
+        if (enc->channels == 3)
+        {
+            memcpy(out, rgb, (size_t) width * 3);
+            continue;
+        }
+
+        for (x = 0; x < width; x++, rgb += 3, out += 4)
+        {
+            out[0] = rgb[0];
+            out[1] = rgb[1];
+            out[2] = rgb[2];
+            out[3] = pixel_alpha(im, pos + x, rgb);
+        }
+    }
+}
+
+
+/** replace the samples of the rows of a block by their horizontal differences */
+static void predict_tiff_block(tiff_block_encoder_t *enc, tiff_block_t *block)
+{
+    size_t rowSize = (size_t) enc->blockWidth * enc->channels;
+    unsigned char *row;
+    size_t i;
+
+    for (row = block->data; row < block->data + block->size; row += rowSize)
+        for (i = rowSize - 1; i >= (size_t) enc->channels; i--)
+            row[i] -= row[i - enc->channels];
+}
+
+
+/** compress a block in a zlib stream, \return 0 in case of success */
+static int deflate_tiff_block(tiff_block_encoder_t *enc, tiff_block_t *block)
+{
+    int level = enc->options->level > 9 ? 9 : enc->options->level;
+    #ifdef HAVE_LIBPNG
+    uLongf length = enc->outCapacity;
+
+    if (compress2(block->out, &length, block->data, block->size, level < 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK)
+        return 1;
+    block->outSize = length;
+    #else
+    put_zlib_header(block->out, level);
+    block->outSize = 2 + y_deflate(block->data, block->size, level == 0 ? Y_DEFLATE_STORED : Y_DEFLATE_RLE, 1,
+        block->out + 2);
+    put_uint32(block->out + block->outSize, y_adler32(1, block->data, block->size));
+    block->outSize += 4;
+    #endif
+    return 0;
+}
+
+
+/** task filling, and compressing if needed, the block "index" of the group */
+static void encode_tiff_block(void *data, int index)
+{
+    tiff_block_encoder_t *enc = data;
+    tiff_block_t *block = enc->blocks + index;
+
+    fill_tiff_block(enc, enc->first + index, block);
+    if (!enc->ownCodec)
+        return;
+
+    if (enc->options->predictor)
+        predict_tiff_block(enc, block);
+    if (deflate_tiff_block(enc, block))
+        enc->failed = 1;
+}
+
+
+/** \return the libtiff code of a compression */
+static int tiff_compression_code(yTiffCompression compression)
+{
+    switch (compression)
+    {
+    case Y_TIFF_COMPRESSION_NONE: return COMPRESSION_NONE;
+    case Y_TIFF_COMPRESSION_DEFLATE: return COMPRESSION_ADOBE_DEFLATE;
+    case Y_TIFF_COMPRESSION_ZSTD: return COMPRESSION_ZSTD;
+    default: return COMPRESSION_LZW;
+    }
+}
+
+
+/** write the image in an opened TIFF and close it, \return 0 in case of success */
+static int write_tiff(TIFF *tif, yImage *im, yTiffOptions *options)
+{
+    tiff_block_encoder_t enc;
+    int compression = tiff_compression_code(options->compression);
+    int nbThreads, maxBlocks, i, err = 0;
+    size_t blockSize;
+
+    memset(&enc, 0, sizeof(enc));
+    enc.im = im;
+    enc.options = options;
+    enc.channels = !options->dropAlpha && has_transparency(im) ? 4 : 3;
+    enc.ownCodec = options->compression == Y_TIFF_COMPRESSION_DEFLATE;
+
+    if (!TIFFIsCODECConfigured(compression))
+    {
+        TIFFClose(tif);
+        return 1;
+    }
+
+    set_tiff_fields(tif, im->rgbWidth, im->rgbHeight, enc.channels == 4);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+    if (options->predictor && compression != COMPRESSION_NONE)
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+    if (compression == COMPRESSION_ZSTD && options->level > 0)
+        TIFFSetField(tif, TIFFTAG_ZSTD_LEVEL, options->level);
+
+    if (options->tileSize > 0)
+    {
+        /* the TIFF tiles are multiple of 16 */
+        enc.tiled = 1;
+        enc.blockWidth = enc.blockHeight = (options->tileSize + 15) & ~15;
+        TIFFSetField(tif, TIFFTAG_TILEWIDTH, enc.blockWidth);
+        TIFFSetField(tif, TIFFTAG_TILELENGTH, enc.blockHeight);
+    }
+    else
+    {
+        enc.blockWidth = im->rgbWidth;
+        enc.blockHeight = TIFF_STRIP_SIZE / ((size_t) im->rgbWidth * enc.channels);
+        if (enc.blockHeight < 1) enc.blockHeight = 1;
+        if (enc.blockHeight > im->rgbHeight) enc.blockHeight = im->rgbHeight;
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, enc.blockHeight);
+    }
+    enc.blocksAcross = (im->rgbWidth + enc.blockWidth - 1) / enc.blockWidth;
+    enc.nbBlocks = enc.blocksAcross * ((im->rgbHeight + enc.blockHeight - 1) / enc.blockHeight);
+
+    nbThreads = options->threads > 0 ? options->threads : y_cpu_count();
+    if ((size_t) im->rgbWidth * im->rgbHeight * enc.channels < 2 * TIFF_STRIP_SIZE)
+        nbThreads = 1; /* small images are not worth it */
+    maxBlocks = nbThreads * TIFF_BLOCKS_BY_THREAD;
+    if (maxBlocks > enc.nbBlocks)
+        maxBlocks = enc.nbBlocks;
+
+    blockSize = (size_t) enc.blockWidth * enc.blockHeight * enc.channels;
+    #ifdef HAVE_LIBPNG
+    enc.outCapacity = compressBound(blockSize);
+    #else
+    enc.outCapacity = y_deflate_bound(blockSize) + 6;
+    #endif
+
+    enc.blocks = calloc(maxBlocks, sizeof(tiff_block_t));
+    for (i = 0; enc.blocks != NULL && i < maxBlocks && !err; i++)
+    {
+        enc.blocks[i].data = malloc(blockSize);
+        if (enc.ownCodec)
+            enc.blocks[i].out = malloc(enc.outCapacity);
+        err = enc.blocks[i].data == NULL || (enc.ownCodec && enc.blocks[i].out == NULL);
+    }
+    if (enc.blocks == NULL)
+        err = 1;
+
+    for (enc.first = 0; !err && enc.first < enc.nbBlocks; enc.first += maxBlocks)
+    {
+        int nbBlocks = enc.nbBlocks - enc.first < maxBlocks ? enc.nbBlocks - enc.first : maxBlocks;
+
+        y_parallel_for(nbBlocks, nbThreads, encode_tiff_block, &enc);
+        err = enc.failed;
+
+        for (i = 0; i < nbBlocks && !err; i++)
+        {
+            tiff_block_t *block = enc.blocks + i;
+            uint32_t index = enc.first + i;
+            tmsize_t written;
+
+            if (enc.ownCodec)
+                written = enc.tiled ? TIFFWriteRawTile(tif, index, block->out, block->outSize) :
+                    TIFFWriteRawStrip(tif, index, block->out, block->outSize);
+            else
+                written = enc.tiled ? TIFFWriteEncodedTile(tif, index, block->data, block->size) :
+                    TIFFWriteEncodedStrip(tif, index, block->data, block->size);
+            err = written < 0;
+        }
+    }
+
+    for (i = 0; enc.blocks != NULL && i < maxBlocks; i++)
+    {
+        free(enc.blocks[i].data);
+        free(enc.blocks[i].out);
+    }
+    free(enc.blocks);
+
+    if (!err && !TIFFWriteDirectory(tif))
+        err = 1;
+    TIFFClose(tif);
+    return err;
+}
+#endif
+
+
+int y_encode_tiff_with_options(yImage *im, yTiffOptions *options, yWriteCallback write, void *userData)
+{
+    #ifdef HAVE_LIBTIFF
+    TIFF               *tif;
+    tiff_memory_stream  stream;
+    yBuffer             buffer;
+    yTiffOptions        defaults;
+    int                 err;
+
+    if (options == NULL)
+    {
+        y_init_tiff_options(&defaults);
+        options = &defaults;
+    }
+
+    y_init_buffer(&buffer);
+    tif = tiff_memory_open(&stream, &buffer, options->bigTiff ? "w8" : "w", NULL, 0);
+    if (tif)
+    {
+        err = write_tiff(tif, im, options);
+        if (!err) err = write(userData, buffer.data, buffer.size);
+        y_release_buffer(&buffer);
+        return err;
+    }
+    y_release_buffer(&buffer);
+    #endif
+    return 1;
+}
+
+
+int y_encode_tiff(yImage *im, yWriteCallback write, void *userData)
+{
+    return y_encode_tiff_with_options(im, NULL, write, userData);
+}
+
+
+int y_save_tiff_with_options(yImage *im, const char *file, yTiffOptions *options)
+{
+    #ifdef HAVE_LIBTIFF
+    TIFF               *tif;
+    yTiffOptions        defaults;
+
+    if (options == NULL)
+    {
+        y_init_tiff_options(&defaults);
+        options = &defaults;
+    }
+
+    tif = TIFFOpen(file, options->bigTiff ? "w8" : "w");
+    if (tif)
+    {
+        return write_tiff(tif, im, options);
+    }
+    #endif
+    return 1;
+}
+
+
+int y_save_tiff(yImage *im, const char *file)
+{
+    return y_save_tiff_with_options(im, file, NULL);
+}
+
+
+
+/** QOI file signature */
+static const unsigned char qoi_magic[4] = { 'q', 'o', 'i', 'f' };
+
+/** QOI chunk tags */
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+
+/** size of a QOI header */
+#define QOI_HEADER_SIZE 14
+
+/** largest image accepted by the QOI decoder */
+#define QOI_PIXELS_MAX 400000000
+
+/** size of the buffers of the QOI encoder and file decoder */
+#define QOI_BUFFER_SIZE 65536
+
+/** position of a colour in the QOI table of recent colours */
+#define QOI_HASH(r, g, b, a) (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) & 63)
+
+
+/** the end of a QOI stream */
+static const unsigned char qoi_padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+
+/** pack a RGBA colour, to compare colours at once */
+static uint32_t qoi_pixel(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+    return ((uint32_t) r << 24) | ((uint32_t) g << 16) | ((uint32_t) b << 8) | a;
+}
+
+
+/** state of the QOI encoder, kept from a row to the next */
+typedef struct {
+    uint32_t index[64]; /**< the recent colours */
+    uint32_t prev; /**< the previous pixel */
+    int run; /**< number of pixels equal to prev not yet written */
+    unsigned char *out; /**< QOI_BUFFER_SIZE bytes of output */
+    int pos; /**< number of bytes in out */
+} qoi_encoder_t;
+
+
+/** init the encoder state and put the header in its output buffer */
+static void init_qoi_encoder(qoi_encoder_t *enc, int width, int height, int channels)
+{
+    memset(enc->index, 0, sizeof(enc->index));
+    enc->prev = qoi_pixel(0, 0, 0, 255);
+    enc->run = 0;
+
+    memcpy(enc->out, qoi_magic, 4);
+    put_uint32(enc->out + 4, width);
+    put_uint32(enc->out + 8, height);
+    enc->out[12] = channels;
+    enc->out[13] = 0; /* sRGB */
+    enc->pos = QOI_HEADER_SIZE;
+}
+
+
+/**
+ * Encode the rows y0 to y0 + nbRows - 1 of the image.
+ * \return 0 in case of success, 3 if "write" failed
+ */
+static int encode_qoi_rows(qoi_encoder_t *enc, yImage *im, int y0, int nbRows, yWriteCallback write, void *userData)
+{
+    unsigned char *out = enc->out;
+    uint32_t *index = enc->index;
+    uint32_t prev = enc->prev;
+    int pos = enc->pos, run = enc->run;
+    int x, y, err = 0;
+
+    for (y = y0; y < y0 + nbRows && !err; y++)
+    {
+        const unsigned char *rgb = im->rgbData + (size_t) 3 * im->rgbWidth * y;
+        int offset = im->rgbWidth * y;
+
+        for (x = 0; x < im->rgbWidth; x++, rgb += 3)
+        {
+            unsigned char a = im->alphaChanel != NULL ? im->alphaChanel[offset + x] : pixel_alpha(im, offset + x, rgb);
+            uint32_t px = qoi_pixel(rgb[0], rgb[1], rgb[2], a);
+            int h;
+
+            if (pos > QOI_BUFFER_SIZE - 6)
+            {
+                if (write(userData, out, pos)) { err = 3; break; }
+                pos = 0;
+            }
+
+            if (px == prev)
+            {
+                if (++run == 62)
+                {
+                    out[pos++] = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)
+            {
+                out[pos++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            h = QOI_HASH(rgb[0], rgb[1], rgb[2], a);
+            if (index[h] == px)
+            {
+                out[pos++] = QOI_OP_INDEX | h;
+            }
+            else
+            {
+                index[h] = px;
+
+                if ((px & 0xFF) == (prev & 0xFF))
+                {
+                    signed char vr = rgb[0] - (prev >> 24);
+                    signed char vg = rgb[1] - ((prev >> 16) & 0xFF);
+                    signed char vb = rgb[2] - ((prev >> 8) & 0xFF);
+                    signed char vgr = vr - vg;
+                    signed char vgb = vb - vg;
+
+                    if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1)
+                    {
+                        out[pos++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    }
+                    else if (vgr >= -8 && vgr <= 7 && vg >= -32 && vg <= 31 && vgb >= -8 && vgb <= 7)
+                    {
+                        out[pos++] = QOI_OP_LUMA | (vg + 32);
+                        out[pos++] = (vgr + 8) << 4 | (vgb + 8);
+                    }
+                    else
+                    {
+                        out[pos++] = QOI_OP_RGB;
+                        out[pos++] = rgb[0];
+                        out[pos++] = rgb[1];
+                        out[pos++] = rgb[2];
+                    }
+                }
+                else
+                {
+                    out[pos++] = QOI_OP_RGBA;
+                    out[pos++] = rgb[0];
+                    out[pos++] = rgb[1];
+                    out[pos++] = rgb[2];
+                    out[pos++] = a;
+                }
+            }
+            prev = px;
+        }
+    }
+
+    enc->prev = prev;
+    enc->pos = pos;
+    enc->run = run;
+    return err;
+}
+
+
+/** write the last run and the end of the stream, \return 0 in case of success, 3 if "write" failed */
+static int finish_qoi(qoi_encoder_t *enc, yWriteCallback write, void *userData)
+{
+    if (enc->run > 0)
+        enc->out[enc->pos++] = QOI_OP_RUN | (enc->run - 1);
+    enc->run = 0;
+
+    if (write(userData, enc->out, enc->pos) || write(userData, qoi_padding, sizeof(qoi_padding)))
+        return 3;
+
+    enc->pos = 0;
+    return 0;
+}
+
+
+int y_encode_qoi(yImage *im, yWriteCallback write, void *userData)
+{
+    qoi_encoder_t enc;
+    int x, err, channels = 3;
+
+    enc.out = malloc(QOI_BUFFER_SIZE);
+    if (enc.out == NULL) return 4;
+
+    /* the channels field is only informative : 4 if the image is not opaque */
+    for (x = 0; x < im->rgbWidth * im->rgbHeight && channels == 3; x++)
+        if (pixel_alpha(im, x, im->rgbData + 3 * x) != 255) channels = 4;
+
+    init_qoi_encoder(&enc, im->rgbWidth, im->rgbHeight, channels);
+    err = encode_qoi_rows(&enc, im, 0, im->rgbHeight, write, userData);
+    if (!err)
+        err = finish_qoi(&enc, write, userData);
+
+    free(enc.out);
+    return err;
+}
+
+
+int y_save_qoi(yImage *im, const char *file)
+{
+    FILE *f;
+    int err;
+
+    f = fopen(file, "wb");
+    if (f == NULL) return 5;
+
+    err = y_encode_qoi(im, file_write, f);
+    if (fclose(f) && !err) err = 3;
+    return err;
+}
+
+
+int y_encode_pnm(yImage *im, yPnmType type, int bitDepth, yWriteCallback write, void *userData) {
+
+    char header[128];
+    unsigned char *row;
+    int channels = type == Y_PNM_PGM ? 1 : (type == Y_PNM_PAM ? 4 : 3);
+    int bytes = bitDepth == 16 ? 2 : 1;
+    size_t i, n = (size_t) im->rgbWidth * channels;
+    int length, y, err = 0;
+
+    if(type == Y_PNM_PPM && bytes == 1) return y_encode_ppm(im, write, userData);
+
+    if(type == Y_PNM_PAM) {
+        length = snprintf(header, sizeof(header), "P7\nWIDTH %i\nHEIGHT %i\nDEPTH 4\nMAXVAL %i\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+            im->rgbWidth, im->rgbHeight, bytes == 2 ? 65535 : 255);
+    } else {
+        length = snprintf(header, sizeof(header), "P%c\n# Created by yImage\n%i %i\n%i\n", type == Y_PNM_PGM ? '5' : '6',
+            im->rgbWidth, im->rgbHeight, bytes == 2 ? 65535 : 255);
+    }
+
+    row = malloc(n * bytes);
+    if(row == NULL) return 1;
+
+    if(write(userData, (unsigned char *) header, length)) err = 1;
+
+    for(y = 0; y < im->rgbHeight && !err; y++) {
+        const unsigned char *samples = row;
+
+        if(type == Y_PNM_PPM) samples = im->rgbData + (size_t) 3 * y * im->rgbWidth;
+        else fill_png_row(im, y, type == Y_PNM_PGM ? Y_PNG_COLOR_GRAY : Y_PNG_COLOR_RGBA, NULL, row);
+
+        /* v * 257 in big endian, from the end as the row may be expanded in place */
+        if(bytes == 2) {
+            for(i = n; i-- > 0; ) {
+                row[2 * i] = row[2 * i + 1] = samples[i];
+            }
+        }
+
+        err = write(userData, row, n * bytes);
+    }
+
+    free(row);
+    return err;
+}
+
+
+int y_save_pnm(yImage *im, const char *file, yPnmType type, int bitDepth) {
+
+    FILE *f;
+    int err;
+
+    f = fopen(file, "wb");
+    if (f == NULL) return 1;
+
+    err = y_encode_pnm(im, type, bitDepth, file_write, f);
+    if (fclose(f)) err = 1;
+    return err;
+}
+
+
+
+/* LOADING FILES */
+
+
+/**
+ * Store a row of 8 bits samples in the rgb and alpha rows of a yImage.
+ * Gray levels are expanded to RGB, and the alpha row is not changed for
+ * samples without alpha.
+ * \param samples the row, with 1 (gray), 2 (gray and alpha), 3 (RGB) or
+ * 4 (RGBA) samples by pixel
+ * \param alpha the alpha row, or NULL to drop the alpha samples
+ */
+static void store_samples(const unsigned char *samples, int channels, int width, unsigned char *rgb, unsigned char *alpha)
+{
+    int x;
+
+    if (alpha == NULL && (channels == 2 || channels == 4))
+    {
+        for (x = 0; x < width; x++, samples += channels)
+        {
+            *rgb++ = samples[0];
+            *rgb++ = samples[channels == 4 ? 1 : 0];
+            *rgb++ = samples[channels == 4 ? 2 : 0];
+        }
+        return;
+    }
+
+    switch (channels)
+    {
+    case 4:
+        for (x = 0; x < width; x++)
+        {
+            *rgb++ = *samples++;
+            *rgb++ = *samples++;
+            *rgb++ = *samples++;
+            *alpha++ = *samples++;
+        }
+        break;
+    case 3:
+        memcpy(rgb, samples, (size_t) width * 3);
+        break;
+    case 2:
+        for (x = 0; x < width; x++)
+        {
+            *rgb++ = *samples;
+            *rgb++ = *samples;
+            *rgb++ = *samples++;
+            *alpha++ = *samples++;
+        }
+        break;
+    default:
+        for (x = 0; x < width; x++)
+        {
+            *rgb++ = *samples;
+            *rgb++ = *samples;
+            *rgb++ = *samples++;
+        }
+    }
+}
+
+
+/**
+ * Clip the region (x, y, w, h) to an image of width x height pixels.
+ * \return 0 if the clipped region is not empty
+ */
+static int clip_region(int width, int height, int *x, int *y, int *w, int *h)
+{
+    if (*x < 0) { *w += *x; *x = 0; }
+    if (*y < 0) { *h += *y; *y = 0; }
+    if (*x >= width || *y >= height) return 1;
+    if (*w > width - *x) *w = width - *x;
+    if (*h > height - *y) *h = height - *y;
+    return *w <= 0 || *h <= 0;
+}
+
+
+
+
+/** \return the alpha of the row "y" of a band, or NULL if it has no alpha channel */
+static unsigned char *band_alpha_row(yImage *band, int y)
+{
+    return band->alphaChanel != NULL ? band->alphaChanel + (size_t) y * band->rgbWidth : NULL;
+}
+
+
+/** skip the whitespaces and the comments of a ppm header */
+static size_t skip_ppm_separators(const unsigned char *data, size_t size, size_t pos) {
+
+    while(pos < size) {
+        if(data[pos] == '#') {
+            while(pos < size && data[pos] != '\n') pos++;
+        } else if(isspace(data[pos])) {
+            pos++;
+        } else {
+            break;
+        }
+    }
+
+    return pos;
+}
+
+
+/** read a positive integer in a ppm header, \return 0 in case of success */
+static int read_ppm_integer(const unsigned char *data, size_t size, size_t *pos, int *value) {
+
+    size_t p = skip_ppm_separators(data, size, *pos);
+    int n = 0;
+
+    if(p >= size || !isdigit(data[p])) return 1;
+
+    while(p < size && isdigit(data[p])) {
+        if(n > 100000000) return 1;
+        n = 10 * n + (data[p] - '0');
+        p++;
+    }
+
+    *pos = p;
+    *value = n;
+    return 0;
+}
+
+
+/** read a word of a PAM header in "word", \return 0 in case of success */
+static int read_pam_word(const unsigned char *data, size_t size, size_t *pos, char *word, size_t capacity) {
+
+    size_t p = skip_ppm_separators(data, size, *pos);
+    size_t n = 0;
+
+    while(p < size && !isspace(data[p])) {
+        if(n + 1 < capacity) word[n++] = data[p];
+        p++;
+    }
+
+    word[n] = '\0';
+    *pos = p;
+    return n == 0;
+}
+
+
+/** description of a netpbm file */
+typedef struct {
+    int type; /**< 5 (PGM), 6 (PPM) or 7 (PAM) */
+    int width, height;
+    int channels; /**< samples by pixel : 1 (gray), 2 (gray and alpha), 3 (RGB) or 4 (RGBA) */
+    int maxval; /**< maximum value of the samples, from 1 to 65535 */
+    size_t offset; /**< position of the pixels in the file */
+} pnm_header_t;
+
+
+/** parse the lines of a PAM header, from the one after "P7", \return 0 if it is valid */
+static int parse_pam_header(const unsigned char *data, size_t size, size_t pos, pnm_header_t *header) {
+
+    char key[16];
+
+    header->width = header->height = header->channels = header->maxval = 0;
+
+    while(!read_pam_word(data, size, &pos, key, sizeof(key))) {
+        if(!strcmp(key, "ENDHDR")) {
+            /* the pixels follow the end of the line */
+            while(pos < size && data[pos] != '\n') pos++;
+            if(pos >= size) return 1;
+            header->offset = pos + 1;
+            return header->channels < 1 || header->channels > 4;
+        }
+
+        if(!strcmp(key, "WIDTH")) {
+            if(read_ppm_integer(data, size, &pos, &header->width)) return 1;
+        } else if(!strcmp(key, "HEIGHT")) {
+            if(read_ppm_integer(data, size, &pos, &header->height)) return 1;
+        } else if(!strcmp(key, "DEPTH")) {
+            if(read_ppm_integer(data, size, &pos, &header->channels)) return 1;
+        } else if(!strcmp(key, "MAXVAL")) {
+            if(read_ppm_integer(data, size, &pos, &header->maxval)) return 1;
+        } else {
+            /* TUPLTYPE and unknown keys : the depth gives the layout */
+            while(pos < size && data[pos] != '\n') pos++;
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ * \brief Parse the header of a binary netpbm file : PGM (P5), PPM (P6)
+ * or PAM (P7).
+ * \param data the beginning of the file
+ * \param size the number of bytes available in data
+ * \param header to return the description of the file
+ * \return 0 if the header is valid
+ */
+static int parse_pnm_header(const unsigned char *data, size_t size, pnm_header_t *header) {
+
+    size_t pos = 2;
+
+    if(size < 3 || data[0] != 'P' || data[1] < '5' || data[1] > '7' || !isspace(data[2])) return 1;
+    header->type = data[1] - '0';
+
+    if(header->type == 7) {
+        if(parse_pam_header(data, size, pos, header)) return 1;
+    } else {
+        header->channels = header->type == 5 ? 1 : 3;
+        if(read_ppm_integer(data, size, &pos, &header->width)) return 1;
+        if(read_ppm_integer(data, size, &pos, &header->height)) return 1;
+        if(read_ppm_integer(data, size, &pos, &header->maxval)) return 1;
+
+        /* a single whitespace before the pixels */
+        if(pos >= size || !isspace(data[pos])) return 1;
+        header->offset = pos + 1;
+    }
+
+    if(header->width <= 0 || header->height <= 0) return 1;
+
+    if(header->maxval < 1 || header->maxval > 65535) {
+        fprintf(stderr, "Bad file format : maxval = %d\n", header->maxval);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/** \return the size of a row of pixels in a netpbm file */
+static size_t pnm_row_size(const pnm_header_t *header) {
+    return (size_t) header->width * header->channels * (header->maxval > 255 ? 2 : 1);
+}
+
+
+/** \return 1 if the pixels of the netpbm file are 8 bits RGB, as in rgbData */
+static int is_raw_rgb(const pnm_header_t *header) {
+    return header->channels == 3 && header->maxval == 255;
+}
+
+
+/**
+ * Build the table giving the 8 bits value of the samples, for the
+ * maxvals other than 255 and 65535.
+ * \return the table, NULL if it is not needed or if the memory lacks
+ */
+static unsigned char *pnm_scale_table(const pnm_header_t *header) {
+
+    unsigned char *table;
+    int size = header->maxval > 255 ? 65536 : 256;
+    int v;
+
+    if(header->maxval == 255 || header->maxval == 65535) return NULL;
+
+    table = malloc(size);
+    if(table == NULL) return NULL;
+
+    /* the values beyond maxval are clamped */
+    for(v = 0; v < size; v++) {
+        table[v] = v >= header->maxval ? 255 : (v * 255 + header->maxval / 2) / header->maxval;
+    }
+    return table;
+}
+
+
+/**
+ * Convert a row of netpbm samples to 8 bits, in place.
+ * \param table the table of pnm_scale_table(), when the maxval needs one
+ */
+static void scale_pnm_row(const pnm_header_t *header, const unsigned char *table, unsigned char *row) {
+
+    size_t i, n = (size_t) header->width * header->channels;
+
+    if(header->maxval == 65535) {
+        /* round(v / 257), on big endian samples : a loop the compiler vectorizes */
+        for(i = 0; i < n; i++) {
+            unsigned int v = ((row[2 * i] << 8) | row[2 * i + 1]) + 128;
+            row[i] = (v - (v >> 8)) >> 8;
+        }
+    } else if(header->maxval > 255) {
+        for(i = 0; i < n; i++) {
+            row[i] = table[(row[2 * i] << 8) | row[2 * i + 1]];
+        }
+    } else if(header->maxval != 255) {
+        for(i = 0; i < n; i++) {
+            row[i] = table[row[i]];
+        }
+    }
+}
+
+
+/**
+ * Read "nbRows" rows of a netpbm file in the image "im", from its row "y".
+ * \param row a buffer of pnm_row_size() bytes, unused for raw RGB
+ * \return 0 in case of success
+ */
+static int read_pnm_rows(FILE *f, const pnm_header_t *header, const unsigned char *table, unsigned char *row,
+    yImage *im, int y, int nbRows) {
+
+    size_t rowSize = pnm_row_size(header);
+    int i;
+
+    if(is_raw_rgb(header)) {
+        return fread(im->rgbData + (size_t) 3 * y * im->rgbWidth, (size_t) 3 * im->rgbWidth, nbRows, f) != (size_t) nbRows;
+    }
+
+    for(i = 0; i < nbRows; i++) {
+        if(fread(row, rowSize, 1, f) != 1) return 1;
+        scale_pnm_row(header, table, row);
+        store_samples(row, header->channels, header->width, im->rgbData + (size_t) 3 * (y + i) * im->rgbWidth,
+            band_alpha_row(im, y + i));
+    }
+    return 0;
+}
+
+
+yImage *y_decode_ppm(const unsigned char *data, size_t size) {
+
+    yImage *im;
+    pnm_header_t header;
+    unsigned char *table, *row;
+    size_t rowSize;
+    int y, err;
+
+    if(parse_pnm_header(data, size, &header)) {
+        fprintf(stderr, "Bad ppm data\n");
+        return NULL;
+    }
+
+    rowSize = pnm_row_size(&header);
+    if((size - header.offset) / rowSize < (size_t) header.height) {
+        fprintf(stderr, "Decoding PPM data : Unexpected end of data\n");
+        return NULL;
+    }
+
+    if(is_raw_rgb(&header)) {
+        return y_create_image(&err, data + header.offset, header.width, header.height);
+    }
+
+    im = y_create_image(&err, NULL, header.width, header.height);
+    table = pnm_scale_table(&header);
+    row = malloc(rowSize);
+    if(im == NULL || row == NULL || (table == NULL && header.maxval != 255 && header.maxval != 65535)) {
+        y_destroy_image(im);
+        free(table);
+        free(row);
+        return NULL;
+    }
+
+    for(y = 0; y < header.height; y++) {
+        memcpy(row, data + header.offset + y * rowSize, rowSize);
+        scale_pnm_row(&header, table, row);
+        store_samples(row, header.channels, header.width, im->rgbData + (size_t) 3 * y * header.width,
+            im->alphaChanel + (size_t) y * header.width);
+    }
+
+    free(table);
+    free(row);
+    return im;
+}
+
+
+yImage *y_load_ppm(const char *file) {
+
+    FILE *f; /* file descriptor */
+    yImage *im;
+
+    f = fopen(file, "rb");
+    if (f)
+    {
+        unsigned char header[PPM_HEADER_MAX_SIZE]; // beginning of the file
+        size_t length; // number of bytes in header
+        pnm_header_t pnm; // description of the file
+        unsigned char *table = NULL; // to scale the samples to 8 bits
+        unsigned char *row = NULL; // samples of a row
+        int err; // error code
+
+        length = fread(header, 1, PPM_HEADER_MAX_SIZE, f);
+
+        if(parse_pnm_header(header, length, &pnm)) {
+            fprintf(stderr, "Bad file format for %s\n", file);
+            fclose(f);
+            return NULL;
+        }
+
+        if(fseek(f, pnm.offset, SEEK_SET)) {
+            fclose(f);
+            return NULL;
+        }
+
+        im = y_create_image(&err, NULL, pnm.width, pnm.height);
+        if(!is_raw_rgb(&pnm)) {
+            table = pnm_scale_table(&pnm);
+            row = malloc(pnm_row_size(&pnm));
+            if(row == NULL || (table == NULL && pnm.maxval != 255 && pnm.maxval != 65535)) {
+                y_destroy_image(im);
+                im = NULL;
+            }
+        }
+        if(im == NULL) {
+            free(table);
+            free(row);
+            fclose(f);
+            return NULL;
+        }
+
+        if(read_pnm_rows(f, &pnm, table, row, im, 0, pnm.height)) {
+            fprintf(stderr, "Reading PPM file %s : Unexpected end of file\n", file);
+            y_destroy_image(im);
+            im = NULL;
+        }
+
+        free(table);
+        free(row);
+        fclose(f);
+        return im;
+    }
+    return NULL;
+}
+
+
+/**
+ * Load the region (x, y, w, h) of a netpbm file, clipped to the image :
+ * only the pixels of the region are read.
+ * \return the image or NULL if the reading failed or the region is empty
+ */
+static yImage *load_pnm_region(const char *file, int x, int y, int w, int h) {
+
+    FILE *f;
+    unsigned char header[PPM_HEADER_MAX_SIZE];
+    pnm_header_t pnm, window;
+    unsigned char *table = NULL, *row;
+    size_t rowSize, pixelSize;
+    yImage *im = NULL;
+    int i, err;
+
+    f = fopen(file, "rb");
+    if(f == NULL) return NULL;
+
+    if(parse_pnm_header(header, fread(header, 1, PPM_HEADER_MAX_SIZE, f), &pnm) ||
+        clip_region(pnm.width, pnm.height, &x, &y, &w, &h)) {
+        fclose(f);
+        return NULL;
+    }
+
+    /* the rows of the region are rows of a narrower file */
+    window = pnm;
+    window.width = w;
+    rowSize = pnm_row_size(&pnm);
+    pixelSize = rowSize / pnm.width;
+
+    table = pnm_scale_table(&pnm);
+    row = malloc(pnm_row_size(&window));
+    if(row != NULL && (table != NULL || pnm.maxval == 255 || pnm.maxval == 65535)) {
+        im = y_create_image(&err, NULL, w, h);
+    }
+
+    for(i = 0; im != NULL && i < h; i++) {
+        if(fseek(f, pnm.offset + (y + i) * rowSize + x * pixelSize, SEEK_SET) ||
+            fread(row, pnm_row_size(&window), 1, f) != 1) {
+            fprintf(stderr, "Reading PPM file %s : Unexpected end of file\n", file);
+            y_destroy_image(im);
+            im = NULL;
+            break;
+        }
+
+        scale_pnm_row(&window, table, row);
+        store_samples(row, pnm.channels, w, im->rgbData + (size_t) 3 * i * w, im->alphaChanel + (size_t) i * w);
+    }
+
+    free(table);
+    free(row);
+    fclose(f);
+    return im;
+}
+
+
+yImage *y_load_ppm_mmap(const char *file, int readOnly) {
+    #ifdef HAVE_MMAP
+    struct stat st;
+    unsigned char *base;
+    pnm_header_t header;
+    size_t size;
+    int fd, err;
+    yImage *im;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open file %s\n", file);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) || st.st_size <= 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    size = st.st_size;
+
+    /* a private mapping : the changes of the image don't reach the file */
+    base = mmap(NULL, size, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    if (parse_pnm_header(base, size < PPM_HEADER_MAX_SIZE ? size : PPM_HEADER_MAX_SIZE, &header) ||
+        (size - header.offset) / pnm_row_size(&header) < (size_t) header.height)
+    {
+        fprintf(stderr, "Bad file format for %s\n", file);
+        munmap(base, size);
+        return NULL;
+    }
+
+    /* only the 8 bits RGB pixels are usable as they are */
+    if (!is_raw_rgb(&header))
+    {
+        munmap(base, size);
+        return y_load_ppm(file);
+    }
+
+    /* the pixels are read from the file when they are first accessed */
+    im = y_create_mapped_image(&err, base + header.offset, header.width, header.height, base, size);
+    if (im == NULL)
+        munmap(base, size);
+    return im;
+    #else
+    return y_load_ppm(file);
+    #endif
+}
+
+
+
+#ifdef HAVE_LIBPNG
+/** png data in memory */
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+} png_memory_source;
+
+
+static void png_memory_read(png_structp png_ptr, png_bytep data, png_size_t length) {
+    png_memory_source *source = png_get_io_ptr(png_ptr);
+
+    if(length > source->size - source->pos) {
+        png_error(png_ptr, "Unexpected end of data");
+    }
+
+    memcpy(data, source->data + source->pos, length);
+    source->pos += length;
+}
+
+
+static void png_file_read(png_structp png_ptr, png_bytep data, png_size_t length) {
+    FILE *f = png_get_io_ptr(png_ptr);
+
+    if(fread(data, 1, length, f) != length) {
+        png_error(png_ptr, "Unexpected end of file");
+    }
+}
+
+
+static yImage *LoadPNG(void *io, png_rw_ptr read);
+#else
+static yImage *decode_png_builtin(const unsigned char *data, size_t size);
+#endif
+
+
+yImage *y_decode_png(const unsigned char *data, size_t size) {
+
+    #ifdef HAVE_LIBPNG
+    png_memory_source source;
+    #endif
+
+    if (size < 8 || memcmp(data, png_signature, 8))
+    {
+        return NULL;
+    }
+
+    #ifdef HAVE_LIBPNG
+    source.data = data;
+    source.size = size;
+    source.pos = 8;
+
+    return LoadPNG(&source, png_memory_read);
+    #else
+    return decode_png_builtin(data, size);
+    #endif
+}
+
+
+yImage *y_load_png(const char *file) {
+
+    FILE *fd;
+    yImage *im = NULL;
+
+    fd=fopen(file, "rb");
+
+    if(fd == NULL) {
+        fprintf(stderr, "Could not open file %s\n", file);
+        return NULL;
+    }
+
+    #ifdef HAVE_LIBPNG
+    {
+        unsigned char header[8];    // 8 is the maximum size that can be checked
+
+        if (fread(header, 1, 8, fd) == 8 && !png_sig_cmp((png_const_bytep)header, 0, 8))
+        {
+            im = LoadPNG(fd, png_file_read);
+        }
+    }
+    #else
+    {
+        /* the built-in decoder needs the whole file */
+        long size;
+        unsigned char *data = NULL;
+
+        if (fseek(fd, 0, SEEK_END) == 0 && (size = ftell(fd)) > 0 && fseek(fd, 0, SEEK_SET) == 0)
+            data = malloc(size);
+
+        if (data != NULL && fread(data, 1, size, fd) == (size_t) size)
+            im = y_decode_png(data, size);
+
+        free(data);
+    }
+    #endif
+
+    fclose(fd);
+    return im;
+}
+
+
+
+
+#ifdef HAVE_LIBPNG
+/** make libpng give 8 bits gray, gray and alpha, RGB or RGBA samples */
+static void set_png_transforms(png_structp png_ptr, png_infop info_ptr, int color_type, int bit_depth)
+{
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png_ptr);
+    png_set_strip_16(png_ptr);
+}
+
+
+/**
+ * Decode a png image whose signature was already read.
+ *
+ * The rows are decoded one by one and directly split into the image's
+ * RGB and alpha arrays. libpng expands palette, low bit depth gray and
+ * tRNS transparency on the fly, so that each row has 1 to 4 channels of
+ * 8 bits.
+ * \param io the data source given to "read"
+ * \param read the function reading the png data
+ */
+static yImage *LoadPNG(void *io, png_rw_ptr read)
+{
+    png_structp png_ptr;
+    png_infop info_ptr;
+
+    unsigned char * volatile row = NULL; /* a decoded row */
+    yImage * volatile im = NULL;
+    png_uint_32 width, height;
+    int bit_depth, color_type, interlace_type;
+    int channels; /* number of bytes by pixel in row */
+    int passes, pass, x, y;
+    int err; /* error code */
+
+
+    /* Init PNG Reader */
+
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr) return NULL;
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr)
+    {
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        return NULL;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr)))
+    {
+        free(row);
+        y_destroy_image(im);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return NULL;
+    }
+
+    png_set_read_fn(png_ptr, io, read);
+
+    png_set_sig_bytes(png_ptr, 8);
+
+    png_read_info(png_ptr, info_ptr);
+
+    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+        &interlace_type, NULL, NULL);
+
+    /* Setup Translators */
+    set_png_transforms(png_ptr, info_ptr, color_type, bit_depth);
+    passes = png_set_interlace_handling(png_ptr);
+
+    png_read_update_info(png_ptr, info_ptr);
+    channels = png_get_channels(png_ptr, info_ptr);
+
+
+    /* Allocate memory for the yImage and one row */
+    im = y_create_image(&err, NULL, width, height);
+    if (im == NULL)
+    {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return NULL;
+    }
+
+    row = (unsigned char *) malloc(width * channels);
+    if (row == NULL)
+    {
+        y_destroy_image(im);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return NULL;
+    }
+
+
+    /* Reading */
+    for (pass = 0; pass < passes; pass++)
+    {
+        for (y = 0; y < height; y++)
+        {
+            unsigned char *ptr = im->rgbData + (size_t) y * width * 3;
+            unsigned char *ptrAlpha = im->alphaChanel + (size_t) y * width;
+            unsigned char *ptr2 = row;
+
+            if (passes > 1)
+            {
+                /* the rows of an interlaced image are completed at each pass */
+                if (!PNG_ROW_IN_INTERLACE_PASS(y, pass))
+                {
+                    png_read_row(png_ptr, NULL, NULL);
+                    continue;
+                }
+
+                for (x = 0; x < width; x++)
+                {
+                    switch (channels)
+                    {
+                    case 4: ptr2[3] = ptrAlpha[x]; /* fall through */
+                    case 3: ptr2[0] = ptr[3*x]; ptr2[1] = ptr[3*x+1]; ptr2[2] = ptr[3*x+2]; break;
+                    case 2: ptr2[1] = ptrAlpha[x]; /* fall through */
+                    default: ptr2[0] = ptr[3*x];
+                    }
+                    ptr2 += channels;
+                }
+                ptr2 = row;
+            }
+
+            png_read_row(png_ptr, row, NULL);
+            store_samples(row, channels, width, ptr, ptrAlpha);
+        }
+    }
+
+    png_read_end(png_ptr, NULL);
+
+    /* Freing memory */
+    free(row);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+    /* End */
+    return im;
+}
+#endif
+
+
+#ifndef HAVE_LIBPNG
+/************************************************************/
+/*                   BUILT-IN PNG DECODER                   */
+/************************************************************/
+
+
+/** origin and spacing of the pixels of the 7 passes of Adam7 interlacing */
+static const int adam7[7][4] = {
+    { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+    { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+};
+
+
+/** the content of the chunks preceding the image data */
+typedef struct {
+    int width, height;
+    int bitDepth;
+    int colorType; /**< colour type code of the IHDR chunk */
+    int interlace;
+    int channels; /**< number of samples by pixel */
+    unsigned char palette[3 * 256];
+    unsigned char paletteAlpha[256];
+    int nbColors; /**< number of colours in the palette */
+    int hasKey; /**< set if a tRNS chunk gives a transparent gray level or RGB colour */
+    unsigned int key[3]; /**< the transparent gray level or RGB colour */
+} png_info_t;
+
+
+/** \return 0 if the IHDR chunk is valid */
+static int read_png_header(png_info_t *info, const unsigned char *chunk, size_t length)
+{
+    uint32_t width, height;
+
+    if (length != 13) return 1;
+
+    width = get_uint32(chunk);
+    height = get_uint32(chunk + 4);
+    info->bitDepth = chunk[8];
+    info->colorType = chunk[9];
+    info->interlace = chunk[12];
+
+    /* the image's arrays are indexed with int */
+    if (width == 0 || height == 0 || (uint64_t) width * height * 3 > 0x7FFFFFFF) return 1;
+    if (chunk[10] != 0 || chunk[11] != 0 || info->interlace > 1) return 1;
+
+    info->width = width;
+    info->height = height;
+
+    switch (info->colorType)
+    {
+    case 0:
+        info->channels = 1;
+        return info->bitDepth > 16 || (info->bitDepth & (info->bitDepth - 1));
+    case 3:
+        info->channels = 1;
+        return info->bitDepth > 8 || (info->bitDepth & (info->bitDepth - 1));
+    case 2: info->channels = 3; break;
+    case 4: info->channels = 2; break;
+    case 6: info->channels = 4; break;
+    default: return 1;
+    }
+
+    return info->bitDepth != 8 && info->bitDepth != 16;
+}
+
+
+static void read_png_transparency(png_info_t *info, const unsigned char *chunk, size_t length)
+{
+    size_t i;
+
+    if (info->colorType == 3)
+    {
+        for (i = 0; i < length && i < 256; i++)
+            info->paletteAlpha[i] = chunk[i];
+    }
+    else if (info->colorType == 0 && length >= 2)
+    {
+        info->hasKey = 1;
+        info->key[0] = (chunk[0] << 8) | chunk[1];
+    }
+    else if (info->colorType == 2 && length >= 6)
+    {
+        info->hasKey = 1;
+        for (i = 0; i < 3; i++)
+            info->key[i] = (chunk[2 * i] << 8) | chunk[2 * i + 1];
+    }
+}
+
+
+/** \return the size of a row of "width" pixels, without the filter type byte */
+static size_t png_row_bytes(png_info_t *info, int width)
+{
+    return ((size_t) width * info->channels * info->bitDepth + 7) / 8;
+}
+
+
+/** undo the filter of a row, \return 0 or 1 for an unknown filter */
+static int unfilter_png_row(int type, unsigned char *row, const unsigned char *prev, size_t n, size_t bpp)
+{
+    size_t i;
+
+    switch (type)
+    {
+    case ROW_FILTER_NONE:
+        break;
+    case ROW_FILTER_SUB:
+        for (i = bpp; i < n; i++) row[i] += row[i - bpp];
+        break;
+    case ROW_FILTER_UP:
+        for (i = 0; i < n; i++) row[i] += prev[i];
+        break;
+    case ROW_FILTER_AVG:
+        for (i = 0; i < bpp; i++) row[i] += prev[i] >> 1;
+        for (; i < n; i++) row[i] += (row[i - bpp] + prev[i]) >> 1;
+        break;
+    case ROW_FILTER_PAETH:
+        for (i = 0; i < bpp; i++) row[i] += prev[i];
+        for (; i < n; i++) row[i] += paeth_predictor(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/** \return the sample "index" of a row, at its full precision */
+static unsigned int png_sample(const unsigned char *row, size_t index, int bitDepth)
+{
+    size_t bit;
+
+    switch (bitDepth)
+    {
+    case 16: return (row[2 * index] << 8) | row[2 * index + 1];
+    case 8: return row[index];
+    default:
+        bit = index * bitDepth;
+        return (row[bit >> 3] >> (8 - bitDepth - (bit & 7))) & ((1 << bitDepth) - 1);
+    }
+}
+
+
+/**
+ * Store the "width" pixels of a row in the image, at the positions
+ * x0, x0 + dx, x0 + 2dx... of the row "y".
+ */
+static void store_png_pixels(yImage *im, png_info_t *info, const unsigned char *row, int width, int y, int x0, int dx)
+{
+    unsigned char *rgb = im->rgbData + ((size_t) y * im->rgbWidth + x0) * 3;
+    unsigned char *alpha = im->alphaChanel + (size_t) y * im->rgbWidth + x0;
+    int depth = info->bitDepth;
+    /* scale of the low bit depth gray levels to 8 bits */
+    unsigned int scale = depth < 8 ? 255 / ((1 << depth) - 1) : 1;
+    int shift = depth == 16 ? 8 : 0;
+    int x, k;
+
+    if (depth == 8 && dx == 1 && !info->hasKey)
+    {
+        /* common cases */
+        if (info->colorType == 2)
+        {
+            memcpy(rgb, row, (size_t) width * 3);
+            return;
+        }
+        if (info->colorType == 6)
+        {
+            for (x = 0; x < width; x++, row += 4)
+            {
+                rgb[3 * x] = row[0];
+                rgb[3 * x + 1] = row[1];
+                rgb[3 * x + 2] = row[2];
+                alpha[x] = row[3];
+            }
+            return;
+        }
+    }
+
+    for (x = 0; x < width; x++, rgb += 3 * dx, alpha += dx)
+    {
+        size_t s = (size_t) x * info->channels;
+        unsigned int v, color[3];
+
+        switch (info->colorType)
+        {
+        case 3:
+            v = png_sample(row, s, depth);
+            if (v < (unsigned int) info->nbColors)
+            {
+                memcpy(rgb, info->palette + 3 * v, 3);
+                *alpha = info->paletteAlpha[v];
+            }
+            break;
+        case 0:
+            v = png_sample(row, s, depth);
+            rgb[0] = rgb[1] = rgb[2] = (v * scale) >> shift;
+            if (info->hasKey && v == info->key[0]) *alpha = 0;
+            break;
+        case 4:
+            rgb[0] = rgb[1] = rgb[2] = png_sample(row, s, depth) >> shift;
+            *alpha = png_sample(row, s + 1, depth) >> shift;
+            break;
+        case 2:
+            for (k = 0; k < 3; k++)
+            {
+                color[k] = png_sample(row, s + k, depth);
+                rgb[k] = color[k] >> shift;
+            }
+            if (info->hasKey && color[0] == info->key[0] && color[1] == info->key[1] && color[2] == info->key[2])
+                *alpha = 0;
+            break;
+        default:
+            for (k = 0; k < 3; k++)
+                rgb[k] = png_sample(row, s + k, depth) >> shift;
+            *alpha = png_sample(row, s + 3, depth) >> shift;
+        }
+    }
+}
+
+
+/** unfilter the rows of the decompressed data, and store their pixels */
+static int decode_png_pixels(yImage *im, png_info_t *info, unsigned char *raw)
+{
+    unsigned char *zeros;
+    size_t bpp = info->channels * info->bitDepth / 8;
+    int passes = info->interlace ? 7 : 1;
+    int pass, y;
+
+    if (bpp < 1)
+        bpp = 1;
+
+    /* the row above the first one */
+    zeros = calloc(png_row_bytes(info, info->width), 1);
+    if (zeros == NULL)
+        return 1;
+
+    for (pass = 0; pass < passes; pass++)
+    {
+        int x0 = info->interlace ? adam7[pass][0] : 0;
+        int y0 = info->interlace ? adam7[pass][1] : 0;
+        int dx = info->interlace ? adam7[pass][2] : 1;
+        int dy = info->interlace ? adam7[pass][3] : 1;
+        int width = (info->width - x0 + dx - 1) / dx;
+        size_t n = png_row_bytes(info, width);
+        const unsigned char *prev = zeros;
+
+        if (width <= 0 || y0 >= info->height)
+            continue;
+
+        for (y = y0; y < info->height; y += dy)
+        {
+            if (unfilter_png_row(raw[0], raw + 1, prev, n, bpp))
+            {
+                free(zeros);
+                return 1;
+            }
+            store_png_pixels(im, info, raw + 1, width, y, x0, dx);
+            prev = raw + 1;
+            raw += n + 1;
+        }
+    }
+
+    free(zeros);
+    return 0;
+}
+
+
+/** \return the size of the decompressed image data */
+static size_t png_raw_size(png_info_t *info)
+{
+    size_t size = 0;
+    int pass;
+
+    if (!info->interlace)
+        return (png_row_bytes(info, info->width) + 1) * info->height;
+
+    for (pass = 0; pass < 7; pass++)
+    {
+        int width = (info->width - adam7[pass][0] + adam7[pass][2] - 1) / adam7[pass][2];
+        int height = (info->height - adam7[pass][1] + adam7[pass][3] - 1) / adam7[pass][3];
+        if (width > 0 && height > 0)
+            size += (png_row_bytes(info, width) + 1) * height;
+    }
+
+    return size;
+}
+
+
+/**
+ * Read the chunks of a PNG file until IEND, the image data being
+ * concatenated in "idat".
+ * \return 0 in case of success
+ */
+static int read_png_chunks(const unsigned char *data, size_t size, png_info_t *info, yBuffer *idat)
+{
+    size_t pos = 8;
+    int hasHeader = 0;
+
+    for (;;)
+    {
+        const unsigned char *type, *chunk;
+        size_t length;
+
+        if (size - pos < 12) return 1;
+        length = get_uint32(data + pos);
+        if (length > size - pos - 12) return 1;
+
+        type = data + pos + 4;
+        chunk = data + pos + 8;
+        pos += length + 12;
+
+        if (y_crc32(0, type, length + 4) != get_uint32(chunk + length))
+        {
+            /* the ancillary chunks may be ignored, not the critical ones */
+            if (type[0] & 0x20) continue;
+            return 1;
+        }
+
+        if (!memcmp(type, "IHDR", 4))
+        {
+            if (hasHeader || read_png_header(info, chunk, length)) return 1;
+            hasHeader = 1;
+        }
+        else if (!hasHeader)
+            return 1;
+        else if (!memcmp(type, "PLTE", 4))
+        {
+            if (length % 3 || length > sizeof(info->palette)) return 1;
+            memcpy(info->palette, chunk, length);
+            info->nbColors = length / 3;
+        }
+        else if (!memcmp(type, "tRNS", 4))
+            read_png_transparency(info, chunk, length);
+        else if (!memcmp(type, "IDAT", 4))
+        {
+            if (y_buffer_write(idat, chunk, length)) return 1;
+        }
+        else if (!memcmp(type, "IEND", 4))
+            break;
+    }
+
+    return info->colorType == 3 && info->nbColors == 0;
+}
+
+
+/**
+ * Decode a PNG file in memory without libpng. All the colour types and
+ * bit depths are supported, the 16 bits samples being reduced to 8 bits.
+ */
+static yImage *decode_png_builtin(const unsigned char *data, size_t size)
+{
+    png_info_t info;
+    yBuffer idat;
+    yImage *im = NULL;
+    unsigned char *raw = NULL;
+    size_t rawSize, decoded;
+    int err;
+
+    memset(&info, 0, sizeof(info));
+    memset(info.paletteAlpha, 255, sizeof(info.paletteAlpha));
+    y_init_buffer(&idat);
+
+    if (!read_png_chunks(data, size, &info, &idat))
+    {
+        rawSize = png_raw_size(&info);
+        raw = malloc(rawSize);
+    }
+
+    if (raw != NULL)
+    {
+        /* extra data after the image is tolerated */
+        decoded = rawSize;
+        err = y_zlib_uncompress(idat.data, idat.size, raw, &decoded);
+        if ((!err || err == Y_DEFLATE_ERR_FULL) && decoded == rawSize)
+            im = y_create_image(&err, NULL, info.width, info.height);
+    }
+
+    if (im != NULL && decode_png_pixels(im, &info, raw))
+    {
+        y_destroy_image(im);
+        im = NULL;
+    }
+
+    free(raw);
+    y_release_buffer(&idat);
+    return im;
+}
+#endif
+
+
+/** source of QOI data : a memory area, or a file read by blocks */
+typedef struct {
+    const unsigned char *data; /**< the available data */
+    size_t size; /**< number of bytes in data */
+    size_t pos; /**< position of the next byte to read */
+    FILE *file; /**< the file to read, NULL for a memory area */
+    unsigned char *buffer; /**< the data read from the file */
+} qoi_source_t;
+
+
+/**
+ * Make at least "length" bytes available in the source.
+ * \return 0 in case of success
+ */
+static int qoi_fill(qoi_source_t *source, size_t length)
+{
+    size_t remaining = source->size - source->pos;
+
+    if (remaining >= length) return 0;
+    if (source->file == NULL) return 1;
+
+    memmove(source->buffer, source->data + source->pos, remaining);
+    source->size = remaining + fread(source->buffer + remaining, 1, QOI_BUFFER_SIZE - remaining, source->file);
+    source->data = source->buffer;
+    source->pos = 0;
+
+    return source->size < length;
+}
+
+
+/** state of the QOI decoder, kept from a row to the next */
+typedef struct {
+    uint32_t index[64]; /**< the recent colours */
+    unsigned char r, g, b, a; /**< the previous pixel */
+    int run; /**< number of pixels equal to the previous one still to output */
+} qoi_decoder_t;
+
+
+static void init_qoi_decoder(qoi_decoder_t *dec)
+{
+    memset(dec->index, 0, sizeof(dec->index));
+    dec->r = dec->g = dec->b = 0;
+    dec->a = 255;
+    dec->run = 0;
+}
+
+
+/**
+ * Read and check a QOI header.
+ * \return 0 in case of success
+ */
+static int read_qoi_header(qoi_source_t *source, int *width, int *height, int *channels)
+{
+    const unsigned char *header;
+    uint32_t w, h;
+
+    if (qoi_fill(source, QOI_HEADER_SIZE)) return 1;
+
+    header = source->data + source->pos;
+    w = get_uint32(header + 4);
+    h = get_uint32(header + 8);
+    if (memcmp(header, qoi_magic, 4) || (header[12] != 3 && header[12] != 4) || header[13] > 1 ||
+        w == 0 || h == 0 || h > QOI_PIXELS_MAX / w)
+    {
+        return 1;
+    }
+
+    *width = w;
+    *height = h;
+    *channels = header[12];
+    source->pos += QOI_HEADER_SIZE;
+    return 0;
+}
+
+
+/**
+ * Decode "nbRows" rows in the image, from the row "y0".
+ * \return 0 in case of success
+ */
+static int decode_qoi_rows(qoi_decoder_t *dec, qoi_source_t *source, yImage *im, int y0, int nbRows)
+{
+    uint32_t *index = dec->index;
+    unsigned char r = dec->r, g = dec->g, b = dec->b, a = dec->a;
+    int x, y, run = dec->run;
+
+    for (y = y0; y < y0 + nbRows; y++)
+    {
+        unsigned char *rgb = im->rgbData + (size_t) 3 * im->rgbWidth * y;
+        unsigned char *alpha = im->alphaChanel != NULL ? im->alphaChanel + (size_t) im->rgbWidth * y : NULL;
+
+        for (x = 0; x < im->rgbWidth; x++)
+        {
+            if (run > 0)
+            {
+                run--;
+            }
+            else
+            {
+                const unsigned char *data;
+                unsigned char op;
+
+                /* no chunk is longer than 5 bytes, and 8 bytes of padding end the stream */
+                if (qoi_fill(source, 5)) return 1;
+                data = source->data + source->pos;
+                op = data[0];
+
+                if (op == QOI_OP_RGB)
+                {
+                    r = data[1];
+                    g = data[2];
+                    b = data[3];
+                    source->pos += 4;
+                }
+                else if (op == QOI_OP_RGBA)
+                {
+                    r = data[1];
+                    g = data[2];
+                    b = data[3];
+                    a = data[4];
+                    source->pos += 5;
+                }
+                else if ((op & 0xC0) == QOI_OP_INDEX)
+                {
+                    uint32_t px = index[op];
+                    r = px >> 24;
+                    g = px >> 16;
+                    b = px >> 8;
+                    a = px;
+                    source->pos++;
+                }
+                else if ((op & 0xC0) == QOI_OP_DIFF)
+                {
+                    r += ((op >> 4) & 3) - 2;
+                    g += ((op >> 2) & 3) - 2;
+                    b += (op & 3) - 2;
+                    source->pos++;
+                }
+                else if ((op & 0xC0) == QOI_OP_LUMA)
+                {
+                    int vg = (op & 0x3F) - 32;
+                    r += vg - 8 + (data[1] >> 4);
+                    g += vg;
+                    b += vg - 8 + (data[1] & 0x0F);
+                    source->pos += 2;
+                }
+                else
+                {
+                    run = op & 0x3F;
+                    source->pos++;
+                }
+
+                index[QOI_HASH(r, g, b, a)] = qoi_pixel(r, g, b, a);
+            }
+
+            rgb[0] = r;
+            rgb[1] = g;
+            rgb[2] = b;
+            rgb += 3;
+            if (alpha != NULL) alpha[x] = a;
+        }
+    }
+
+    dec->r = r;
+    dec->g = g;
+    dec->b = b;
+    dec->a = a;
+    dec->run = run;
+    return 0;
+}
+
+
+/**
+ * Decode a QOI image.
+ * \return the image or NULL if the decoding failed
+ */
+static yImage *decode_qoi(qoi_source_t *source)
+{
+    qoi_decoder_t dec;
+    yImage *im;
+    int width, height, channels, err;
+
+    if (read_qoi_header(source, &width, &height, &channels)) return NULL;
+
+    init_qoi_decoder(&dec);
+    im = y_create_image(&err, NULL, width, height);
+    if (im != NULL && decode_qoi_rows(&dec, source, im, 0, height))
+    {
+        fprintf(stderr, "Decoding QOI data : Unexpected end of data\n");
+        y_destroy_image(im);
+        im = NULL;
+    }
+
+    return im;
+}
+
+
+yImage *y_decode_qoi(const unsigned char *data, size_t size)
+{
+    qoi_source_t source;
+
+    source.data = data;
+    source.size = size;
+    source.pos = 0;
+    source.file = NULL;
+    source.buffer = NULL;
+
+    return decode_qoi(&source);
+}
+
+
+yImage *y_load_qoi(const char *file)
+{
+    qoi_source_t source;
+    yImage *im = NULL;
+
+    source.file = fopen(file, "rb");
+    if (source.file == NULL) {
+        fprintf(stderr, "Could not open file %s\n", file);
+        return NULL;
+    }
+
+    source.buffer = malloc(QOI_BUFFER_SIZE);
+    source.data = source.buffer;
+    source.size = 0;
+    source.pos = 0;
+
+    if (source.buffer != NULL)
+        im = decode_qoi(&source);
+
+    free(source.buffer);
+    fclose(source.file);
+    return im;
+}
+
+
+
+void y_init_jpeg_read_options(yJpegReadOptions *options)
+{
+    options->scaleDenom = 1;
+    options->fastIdct = 0;
+    options->skipAlpha = 0;
+}
+
+
+#ifdef HAVE_LIBJPEG
+/** fake end of image, given when the data is truncated */
+static const JOCTET jpeg_eoi[2] = { 0xFF, JPEG_EOI };
+
+
+static void init_memory_source(j_decompress_ptr cinfo) {
+}
+
+
+static boolean fill_memory_source(j_decompress_ptr cinfo) {
+    WARNMS(cinfo, JWRN_JPEG_EOF);
+    cinfo->src->next_input_byte = jpeg_eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+
+static void skip_memory_source(j_decompress_ptr cinfo, long length) {
+    struct jpeg_source_mgr *src = cinfo->src;
+
+    if (length <= 0) return;
+
+    if ((size_t) length > src->bytes_in_buffer) {
+        fill_memory_source(cinfo);
+    } else {
+        src->next_input_byte += length;
+        src->bytes_in_buffer -= length;
+    }
+}
+
+
+static void term_memory_source(j_decompress_ptr cinfo) {
+}
+
+
+/** JPEG source manager reading a memory area */
+static void set_memory_source(j_decompress_ptr cinfo, const unsigned char *data, size_t size) {
+    struct jpeg_source_mgr *src;
+
+    src = (*cinfo->mem->alloc_small)((j_common_ptr) cinfo, JPOOL_PERMANENT, sizeof(struct jpeg_source_mgr));
+    src->init_source = init_memory_source;
+    src->fill_input_buffer = fill_memory_source;
+    src->skip_input_data = skip_memory_source;
+    src->resync_to_restart = jpeg_resync_to_restart;
+    src->term_source = term_memory_source;
+    src->next_input_byte = data;
+    src->bytes_in_buffer = size;
+    cinfo->src = src;
+}
+
+
+/**
+ * Decode a JPEG image whose source is set.
+ * \return the image or NULL if the decoding failed
+ */
+static yImage *decode_jpeg(j_decompress_ptr cinfo, jpeg_error_handler *jerr, yJpegReadOptions *options)
+{
+    yImage * volatile im = NULL;
+    JSAMPROW rows[JPEG_ROWS_BY_CALL];
+    yJpegReadOptions settings;
+    int i, err;
+
+    /* copied before setjmp() : the argument is never changed, so longjmp() can't clobber it */
+    y_init_jpeg_read_options(&settings);
+    if (options != NULL)
+        settings = *options;
+
+    if (setjmp(jerr->setjmpBuffer))
+    {
+        y_destroy_image(im);
+        return NULL;
+    }
+
+    jpeg_read_header(cinfo, TRUE);
+    cinfo->out_color_space = JCS_RGB;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = settings.scaleDenom >= 8 ? 8 : (settings.scaleDenom >= 4 ? 4 : (settings.scaleDenom >= 2 ? 2 : 1));
+    cinfo->dct_method = settings.fastIdct ? JDCT_IFAST : JDCT_ISLOW;
+    jpeg_start_decompress(cinfo);
+
+    if (settings.skipAlpha)
+        im = y_create_rgb_image(&err, NULL, cinfo->output_width, cinfo->output_height);
+    else
+        im = y_create_image(&err, NULL, cinfo->output_width, cinfo->output_height);
+    if (im == NULL)
+        return NULL;
+
+    /* the scanlines are decoded by batches, straight into the image */
+    while (cinfo->output_scanline < cinfo->output_height)
+    {
+        int n = cinfo->output_height - cinfo->output_scanline;
+
+        if (n > JPEG_ROWS_BY_CALL) n = JPEG_ROWS_BY_CALL;
+        for (i = 0; i < n; i++)
+            rows[i] = im->rgbData + (size_t) 3 * im->rgbWidth * (cinfo->output_scanline + i);
+        jpeg_read_scanlines(cinfo, rows, n);
+    }
+
+    jpeg_finish_decompress(cinfo);
+    return im;
+}
+#endif
+
+
+yImage *y_decode_jpeg_with_options(const unsigned char *data, size_t size, yJpegReadOptions *options)
+{
+    #ifdef HAVE_LIBJPEG
+    struct jpeg_decompress_struct cinfo;
+    jpeg_error_handler jerr;
+    yImage * volatile im = NULL;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_error_exit;
+    if (setjmp(jerr.setjmpBuffer) == 0)
+    {
+        jpeg_create_decompress(&cinfo);
+        set_memory_source(&cinfo, data, size);
+        im = decode_jpeg(&cinfo, &jerr, options);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return im;
+    #else
+    return NULL;
+    #endif
+}
+
+
+yImage *y_decode_jpeg(const unsigned char *data, size_t size)
+{
+    return y_decode_jpeg_with_options(data, size, NULL);
+}
+
+
+yImage *y_load_jpeg_with_options(const char *file, yJpegReadOptions *options)
+{
+    #ifdef HAVE_LIBJPEG
+    struct jpeg_decompress_struct cinfo;
+    jpeg_error_handler jerr;
+    yImage * volatile im = NULL;
+    FILE *f;
+
+    f = fopen(file, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Could not open file %s\n", file);
+        return NULL;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_error_exit;
+    if (setjmp(jerr.setjmpBuffer) == 0)
+    {
+        jpeg_create_decompress(&cinfo);
+        jpeg_stdio_src(&cinfo, f);
+        im = decode_jpeg(&cinfo, &jerr, options);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    fclose(f);
+    return im;
+    #else
+    return NULL;
+    #endif
+}
+
+
+yImage *y_load_jpeg(const char *file)
+{
+    return y_load_jpeg_with_options(file, NULL);
+}
+
+
+#ifdef HAVE_LIBTIFF
+/** decode a whole TIFF with libtiff's RGBA interface */
+static yImage *read_tiff_rgba(TIFF *tif, uint32_t width, uint32_t height)
+{
+    uint32_t *raster;
+    yImage *im;
+    size_t i;
+    int err;
+
+    im = y_create_image(&err, NULL, width, height);
+    if (im == NULL)
+        return NULL;
+
+    raster = malloc((size_t) width * height * sizeof(uint32_t));
+    if (raster == NULL || !TIFFReadRGBAImageOriented(tif, width, height, raster, ORIENTATION_TOPLEFT, 0))
+    {
+        free(raster);
+        y_destroy_image(im);
+        return NULL;
+    }
+
+    for (i = 0; i < (size_t) width * height; i++)
+    {
+        im->rgbData[3 * i] = TIFFGetR(raster[i]);
+        im->rgbData[3 * i + 1] = TIFFGetG(raster[i]);
+        im->rgbData[3 * i + 2] = TIFFGetB(raster[i]);
+        im->alphaChanel[i] = TIFFGetA(raster[i]);
+    }
+
+    free(raster);
+    return im;
+}
+
+
+/** divide the colours of the pixels by their alpha, for the associated alpha of TIFF files */
+static void unassociate_alpha(yImage *im)
+{
+    size_t i, n = (size_t) im->rgbWidth * im->rgbHeight;
+    int k;
+
+    for (i = 0; i < n; i++)
+    {
+        int a = im->alphaChanel[i];
+
+        if (a == 255) continue;
+        for (k = 0; k < 3; k++)
+            im->rgbData[3 * i + k] = a == 0 ? 0 :
+                (im->rgbData[3 * i + k] >= a ? 255 : (im->rgbData[3 * i + k] * 255 + a / 2) / a);
+    }
+}
+
+
+/**
+ * Decode the region (x, y, w, h) of a TIFF whose 8 bits samples are RGB,
+ * RGBA, gray or gray and alpha, in strips or tiles. Only the blocks
+ * crossing the region are read.
+ * \return the image or NULL if the decoding failed
+ */
+static yImage *read_tiff_blocks(TIFF *tif, uint32_t width, uint32_t height, int channels, int x, int y, int w, int h)
+{
+    uint32_t blockWidth = width, blockHeight = height, x0, y0, row;
+    tiff_block_t block;
+    yImage *im;
+    int tiled = TIFFIsTiled(tif);
+    int err;
+
+    im = y_create_image(&err, NULL, w, h);
+    if (im == NULL)
+        return NULL;
+
+    if (tiled)
+    {
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &blockWidth);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &blockHeight);
+        block.size = TIFFTileSize(tif);
+    }
+    else
+    {
+        TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &blockHeight);
+        block.size = TIFFStripSize(tif);
+    }
+    if (blockHeight > height) blockHeight = height;
+
+    block.data = blockWidth > 0 && blockHeight > 0 ? malloc(block.size) : NULL;
+    if (block.data == NULL)
+    {
+        y_destroy_image(im);
+        return NULL;
+    }
+
+    for (y0 = y - y % blockHeight; y0 < (uint32_t) (y + h); y0 += blockHeight)
+    {
+        uint32_t nbRows = height - y0 < blockHeight ? height - y0 : blockHeight;
+        uint32_t first = y0 < (uint32_t) y ? y - y0 : 0; /* rows of the block in the region */
+        uint32_t last = y0 + nbRows > (uint32_t) (y + h) ? y + h - y0 : nbRows;
+
+        for (x0 = x - x % blockWidth; x0 < (uint32_t) (x + w); x0 += blockWidth)
+        {
+            uint32_t nbColumns = width - x0 < blockWidth ? width - x0 : blockWidth;
+            uint32_t left = x0 < (uint32_t) x ? x - x0 : 0; /* columns of the block in the region */
+            uint32_t right = x0 + nbColumns > (uint32_t) (x + w) ? x + w - x0 : nbColumns;
+            tmsize_t length;
+
+            if (tiled)
+                length = TIFFReadEncodedTile(tif, TIFFComputeTile(tif, x0, y0, 0, 0), block.data, block.size);
+            else
+                length = TIFFReadEncodedStrip(tif, TIFFComputeStrip(tif, y0, 0), block.data, block.size);
+
+            if (length < (tmsize_t) ((size_t) ((nbRows - 1) * blockWidth + nbColumns) * channels))
+            {
+                free(block.data);
+                y_destroy_image(im);
+                return NULL;
+            }
+
+            for (row = first; row < last; row++)
+            {
+                size_t pos = (size_t) (y0 + row - y) * w + x0 + left - x;
+
+                store_samples(block.data + ((size_t) row * blockWidth + left) * channels, channels, right - left,
+                    im->rgbData + 3 * pos, im->alphaChanel + pos);
+            }
+        }
+    }
+
+    free(block.data);
+    return im;
+}
+
+
+/**
+ * Decode the region (x, y, w, h) of an opened TIFF, clipped to the
+ * image. \return NULL if the decoding failed or the region is empty
+ */
+static yImage *decode_tiff_region(TIFF *tif, int x, int y, int w, int h)
+{
+    uint32_t width = 0, height = 0;
+    uint16_t bitsPerSample, samplesPerPixel, planar, photometric = PHOTOMETRIC_RGB;
+    uint16_t nbExtra = 0, *extra = NULL;
+    yImage *im, *region;
+
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+    TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+    TIFFGetField(tif, TIFFTAG_EXTRASAMPLES, &nbExtra, &extra);
+
+    if (width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF ||
+        clip_region(width, height, &x, &y, &w, &h))
+        return NULL;
+
+    if (bitsPerSample == 8 && planar == PLANARCONFIG_CONTIG &&
+        ((photometric == PHOTOMETRIC_RGB && (samplesPerPixel == 3 || samplesPerPixel == 4)) ||
+        (photometric == PHOTOMETRIC_MINISBLACK && (samplesPerPixel == 1 || samplesPerPixel == 2))))
+    {
+        im = read_tiff_blocks(tif, width, height, samplesPerPixel, x, y, w, h);
+        if (im != NULL && nbExtra > 0 && extra[0] == EXTRASAMPLE_ASSOCALPHA)
+            unassociate_alpha(im);
+        return im;
+    }
+
+    /* the other layouts are converted by libtiff, for the whole image */
+    im = read_tiff_rgba(tif, width, height);
+    if (im == NULL || (w == (int) width && h == (int) height))
+        return im;
+
+    region = crop_image(im, x, y, w, h);
+    y_destroy_image(im);
+    return region;
+}
+
+
+/** decode the image of an opened TIFF, \return NULL if the decoding failed */
+static yImage *decode_tiff(TIFF *tif)
+{
+    return decode_tiff_region(tif, 0, 0, 0x7FFFFFFF, 0x7FFFFFFF);
+}
+#endif
+
+
+yImage *y_load_tiff(const char *file)
+{
+    #ifdef HAVE_LIBTIFF
+    TIFF *tif;
+    yImage *im;
+
+    tif = TIFFOpen(file, "r");
+    if (tif == NULL)
+        return NULL;
+
+    im = decode_tiff(tif);
+    TIFFClose(tif);
+    return im;
+    #else
+    return NULL;
+    #endif
+}
+
+
+yImage *y_decode_tiff(const unsigned char *data, size_t size)
+{
+    #ifdef HAVE_LIBTIFF
+    tiff_memory_stream stream;
+    TIFF *tif;
+    yImage *im;
+
+    tif = tiff_memory_open(&stream, NULL, NULL, data, size);
+    if (tif == NULL)
+        return NULL;
+
+    im = decode_tiff(tif);
+    TIFFClose(tif);
+    return im;
+    #else
+    return NULL;
+    #endif
+}
+
+
+/************************************************************/
+/*                  STREAMING READ AND WRITE                */
+/************************************************************/
+
+/*
+ * The readers and writers keep the file opened and decode or encode the
+ * rows on demand. The interlaced PNG files, the PNG files without libpng
+ * and the TIFF files with unusual layouts are decoded entirely at the
+ * opening : their rows are then copied from the whole image.
+ */
+
+/** state of a yImageReader or of a yImageWriter */
+typedef struct {
+    FILE *file;
+    unsigned char *row; /**< a row in the layout of the file */
+    yImage *image; /**< the whole image, for the files decoded at the opening */
+    int channels; /**< number of samples by pixel in "row" */
+    int failed; /**< set after a writing error */
+    int thumbWidth; /**< size of the thumbnail to make, 0 for the full image */
+    int thumbHeight;
+    pnm_header_t pnm; /**< header of a netpbm file */
+    unsigned char *pnmTable; /**< to scale the netpbm samples to 8 bits */
+    qoi_source_t qoiSource;
+    qoi_decoder_t qoiDecoder;
+    qoi_encoder_t qoiEncoder;
+    #ifdef HAVE_LIBPNG
+    png_structp png;
+    png_infop pngInfo;
+    png_callback_destination pngDest;
+    #else
+    unsigned char *prev; /**< the previous row, for the PNG filters */
+    unsigned char *trial; /**< a row filtered to be evaluated */
+    int filters; /**< PNG filters, as Y_PNG_FILTER_* flags */
+    yBuffer filtered; /**< the filtered rows not yet deflated */
+    yBuffer deflated; /**< the output of the deflate */
+    uint32_t adler; /**< checksum of the filtered rows already deflated */
+    int started; /**< set once the zlib header is written */
+    #endif
+    #ifdef HAVE_LIBJPEG
+    int jpegCreated; /**< set if jpegIn or jpegOut must be destroyed */
+    struct jpeg_decompress_struct jpegIn;
+    struct jpeg_compress_struct jpegOut;
+    jpeg_error_handler jpegError;
+    #endif
+    #ifdef HAVE_LIBTIFF
+    TIFF *tif;
+    #endif
+} image_stream_t;
+
+
+/** \return the format of a file, from its first bytes */
+static yImageFormat detect_format(const unsigned char *data, size_t size)
+{
+    if (size >= 8 && !memcmp(data, png_signature, 8)) return Y_FORMAT_PNG;
+    if (size >= 4 && !memcmp(data, qoi_magic, 4)) return Y_FORMAT_QOI;
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) return Y_FORMAT_JPEG;
+    if (size >= 4 && (!memcmp(data, "II*\0", 4) || !memcmp(data, "MM\0*", 4) ||
+        !memcmp(data, "II+\0", 4) || !memcmp(data, "MM\0+", 4))) return Y_FORMAT_TIFF; /* classic or BigTIFF */
+    if (size >= 2 && data[0] == 'P' && data[1] >= '5' && data[1] <= '7') return Y_FORMAT_PPM; /* PGM, PPM or PAM */
+    return Y_FORMAT_UNKNOWN;
+}
+
+
+/** set the alpha of "nbRows" rows to opaque */
+static void set_opaque_rows(yImage *band, int nbRows)
+{
+    if (band->alphaChanel != NULL)
+        memset(band->alphaChanel, 255, (size_t) band->rgbWidth * nbRows);
+}
+
+
+/** \return 1 if some pixels of the image are not opaque */
+static int image_has_alpha(yImage *im)
+{
+    size_t i, n = (size_t) im->rgbWidth * im->rgbHeight;
+
+    for (i = 0; i < n && im->alphaChanel != NULL; i++)
+        if (im->alphaChanel[i] != 255) return 1;
+
+    return 0;
+}
+
+
+/** read the rows from the whole image decoded at the opening, \return 0 in case of success */
+static int open_image_reader(yImageReader *reader, image_stream_t *stream)
+{
+    if (stream->image == NULL)
+        return 1;
+
+    reader->width = stream->image->rgbWidth;
+    reader->height = stream->image->rgbHeight;
+    reader->hasAlpha = image_has_alpha(stream->image);
+    return 0;
+}
+
+
+static int open_ppm_reader(yImageReader *reader, image_stream_t *stream)
+{
+    unsigned char header[PPM_HEADER_MAX_SIZE];
+    size_t length = fread(header, 1, PPM_HEADER_MAX_SIZE, stream->file);
+    pnm_header_t *pnm = &stream->pnm;
+
+    if (parse_pnm_header(header, length, pnm))
+        return 1;
+
+    reader->width = pnm->width;
+    reader->height = pnm->height;
+    reader->hasAlpha = pnm->channels == 2 || pnm->channels == 4;
+    if (!is_raw_rgb(pnm))
+    {
+        stream->pnmTable = pnm_scale_table(pnm);
+        stream->row = malloc(pnm_row_size(pnm));
+        if (stream->row == NULL || (stream->pnmTable == NULL && pnm->maxval != 255 && pnm->maxval != 65535))
+            return 1;
+    }
+
+    return fseek(stream->file, pnm->offset, SEEK_SET) != 0;
+}
+
+
+static int open_qoi_reader(yImageReader *reader, image_stream_t *stream)
+{
+    int channels;
+
+    stream->row = malloc(QOI_BUFFER_SIZE);
+    if (stream->row == NULL)
+        return 1;
+
+    stream->qoiSource.file = stream->file;
+    stream->qoiSource.buffer = stream->row;
+    stream->qoiSource.data = stream->row;
+    stream->qoiSource.size = 0;
+    stream->qoiSource.pos = 0;
+
+    if (read_qoi_header(&stream->qoiSource, &reader->width, &reader->height, &channels))
+        return 1;
+
+    init_qoi_decoder(&stream->qoiDecoder);
+    reader->hasAlpha = channels == 4;
+    return 0;
+}
+
+
+static int open_png_reader(yImageReader *reader, image_stream_t *stream, const char *file)
+{
+    #ifdef HAVE_LIBPNG
+    png_uint_32 width, height;
+    int bitDepth, colorType, interlace;
+
+    stream->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (stream->png == NULL)
+        return 1;
+    stream->pngInfo = png_create_info_struct(stream->png);
+    if (stream->pngInfo == NULL || setjmp(png_jmpbuf(stream->png)))
+        return 1;
+
+    png_set_read_fn(stream->png, stream->file, png_file_read);
+    png_read_info(stream->png, stream->pngInfo);
+    png_get_IHDR(stream->png, stream->pngInfo, &width, &height, &bitDepth, &colorType, &interlace, NULL, NULL);
+
+    if (interlace != PNG_INTERLACE_NONE)
+    {
+        /* each pass completes all the rows */
+        png_destroy_read_struct(&stream->png, &stream->pngInfo, NULL);
+        if (fseek(stream->file, 8, SEEK_SET))
+            return 1;
+        stream->image = LoadPNG(stream->file, png_file_read);
+        return open_image_reader(reader, stream);
+    }
+
+    set_png_transforms(stream->png, stream->pngInfo, colorType, bitDepth);
+    png_read_update_info(stream->png, stream->pngInfo);
+    stream->channels = png_get_channels(stream->png, stream->pngInfo);
+
+    reader->width = width;
+    reader->height = height;
+    reader->hasAlpha = stream->channels == 2 || stream->channels == 4;
+    stream->row = malloc((size_t) width * stream->channels);
+    return stream->row == NULL;
+    #else
+    /* the built-in decoder needs the whole file */
+    stream->image = y_load_png(file);
+    return open_image_reader(reader, stream);
+    #endif
+}
+
+
+/** size of an image reduced to fit in maxWidth x maxHeight, keeping its aspect ratio */
+static void thumbnail_size(int width, int height, int maxWidth, int maxHeight, int *thumbWidth, int *thumbHeight)
+{
+    *thumbWidth = width;
+    *thumbHeight = height;
+
+    if (width <= maxWidth && height <= maxHeight)
+        return;
+
+    if ((int64_t) width * maxHeight > (int64_t) height * maxWidth)
+    {
+        *thumbWidth = maxWidth;
+        *thumbHeight = ((int64_t) height * maxWidth + width / 2) / width;
+    }
+    else
+    {
+        *thumbHeight = maxHeight;
+        *thumbWidth = ((int64_t) width * maxHeight + height / 2) / height;
+    }
+
+    if (*thumbWidth < 1) *thumbWidth = 1;
+    if (*thumbHeight < 1) *thumbHeight = 1;
+}
+
+
+static int open_jpeg_reader(yImageReader *reader, image_stream_t *stream, int maxWidth, int maxHeight)
+{
+    #ifdef HAVE_LIBJPEG
+    struct jpeg_decompress_struct *cinfo = &stream->jpegIn;
+
+    cinfo->err = jpeg_std_error(&stream->jpegError.pub);
+    stream->jpegError.pub.error_exit = jpeg_error_exit;
+    if (setjmp(stream->jpegError.setjmpBuffer))
+        return 1;
+
+    stream->jpegCreated = 1;
+    jpeg_create_decompress(cinfo);
+    jpeg_stdio_src(cinfo, stream->file);
+    jpeg_read_header(cinfo, TRUE);
+    cinfo->out_color_space = JCS_RGB;
+
+    if (maxWidth > 0)
+    {
+        /* let the IDCT reduce the image by 2, 4 or 8, down to the thumbnail's size at least */
+        int width = cinfo->image_width, height = cinfo->image_height;
+        int denom;
+
+        thumbnail_size(width, height, maxWidth, maxHeight, &stream->thumbWidth, &stream->thumbHeight);
+        for (denom = 8; denom > 1; denom /= 2)
+            if ((width + denom - 1) / denom >= stream->thumbWidth && (height + denom - 1) / denom >= stream->thumbHeight)
+                break;
+
+        cinfo->scale_num = 1;
+        cinfo->scale_denom = denom;
+        cinfo->dct_method = JDCT_IFAST;
+        cinfo->do_fancy_upsampling = FALSE;
+    }
+
+    jpeg_start_decompress(cinfo);
+
+    reader->width = cinfo->output_width;
+    reader->height = cinfo->output_height;
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+
+static int open_tiff_reader(yImageReader *reader, image_stream_t *stream, const char *file)
+{
+    #ifdef HAVE_LIBTIFF
+    uint32_t width = 0, height = 0;
+    uint16_t bitsPerSample, samplesPerPixel, planar, photometric = PHOTOMETRIC_RGB;
+    uint16_t nbExtra = 0, *extra = NULL;
+
+    fclose(stream->file);
+    stream->file = NULL;
+
+    stream->tif = TIFFOpen(file, "r");
+    if (stream->tif == NULL)
+        return 1;
+
+    TIFFGetField(stream->tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(stream->tif, TIFFTAG_IMAGELENGTH, &height);
+    TIFFGetFieldDefaulted(stream->tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+    TIFFGetFieldDefaulted(stream->tif, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+    TIFFGetFieldDefaulted(stream->tif, TIFFTAG_PLANARCONFIG, &planar);
+    TIFFGetField(stream->tif, TIFFTAG_PHOTOMETRIC, &photometric);
+    TIFFGetField(stream->tif, TIFFTAG_EXTRASAMPLES, &nbExtra, &extra);
+
+    if (width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF)
+        return 1;
+
+    if (!TIFFIsTiled(stream->tif) && bitsPerSample == 8 && planar == PLANARCONFIG_CONTIG &&
+        (nbExtra == 0 || extra[0] != EXTRASAMPLE_ASSOCALPHA) &&
+        ((photometric == PHOTOMETRIC_RGB && (samplesPerPixel == 3 || samplesPerPixel == 4)) ||
+        (photometric == PHOTOMETRIC_MINISBLACK && (samplesPerPixel == 1 || samplesPerPixel == 2))))
+    {
+        reader->width = width;
+        reader->height = height;
+        reader->hasAlpha = samplesPerPixel == 2 || samplesPerPixel == 4;
+        stream->channels = samplesPerPixel;
+        stream->row = malloc(TIFFScanlineSize(stream->tif));
+        return stream->row == NULL;
+    }
+
+    /* the other layouts are decoded entirely */
+    stream->image = decode_tiff(stream->tif);
+    return open_image_reader(reader, stream);
+    #else
+    return 1;
+    #endif
+}
+
+
+/**
+ * Open a reader. For a thumbnail of at most maxWidth x maxHeight, the
+ * JPEG files are decoded at a reduced size.
+ */
+static yImageReader *open_reader(const char *file, int maxWidth, int maxHeight)
+{
+    yImageReader *reader;
+    image_stream_t *stream;
+    unsigned char magic[8];
+    size_t length;
+    int err;
+
+    reader = calloc(1, sizeof(yImageReader));
+    stream = calloc(1, sizeof(image_stream_t));
+    if (reader == NULL || stream == NULL)
+    {
+        free(reader);
+        free(stream);
+        return NULL;
+    }
+    reader->codec = stream;
+
+    stream->file = fopen(file, "rb");
+    if (stream->file == NULL)
+    {
+        fprintf(stderr, "Could not open file %s\n", file);
+        y_reader_close(reader);
+        return NULL;
+    }
+
+    length = fread(magic, 1, sizeof(magic), stream->file);
+    reader->format = detect_format(magic, length);
+    if (fseek(stream->file, 0, SEEK_SET))
+        reader->format = Y_FORMAT_UNKNOWN;
+
+    switch (reader->format)
+    {
+    case Y_FORMAT_PPM: err = open_ppm_reader(reader, stream); break;
+    case Y_FORMAT_QOI: err = open_qoi_reader(reader, stream); break;
+    case Y_FORMAT_PNG: err = open_png_reader(reader, stream, file); break;
+    case Y_FORMAT_JPEG: err = open_jpeg_reader(reader, stream, maxWidth, maxHeight); break;
+    case Y_FORMAT_TIFF: err = open_tiff_reader(reader, stream, file); break;
+    default: err = 1;
+    }
+
+    if (err)
+    {
+        fprintf(stderr, "Could not read the image %s\n", file);
+        y_reader_close(reader);
+        return NULL;
+    }
+
+    if (maxWidth > 0 && stream->thumbWidth == 0)
+        thumbnail_size(reader->width, reader->height, maxWidth, maxHeight, &stream->thumbWidth, &stream->thumbHeight);
+
+    return reader;
+}
+
+
+yImageReader *y_reader_open(const char *file)
+{
+    return open_reader(file, 0, 0);
+}
+
+
+/** \return 0 in case of success */
+static int read_png_rows(yImageReader *reader, image_stream_t *stream, yImage *band, int nbRows)
+{
+    #ifdef HAVE_LIBPNG
+    int i;
+
+    if (setjmp(png_jmpbuf(stream->png)))
+        return 1;
+
+    for (i = 0; i < nbRows; i++)
+    {
+        png_read_row(stream->png, stream->row, NULL);
+        store_samples(stream->row, stream->channels, reader->width, band->rgbData + (size_t) 3 * i * reader->width,
+            band_alpha_row(band, i));
+    }
+
+    if (!reader->hasAlpha)
+        set_opaque_rows(band, nbRows);
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+/** \return 0 in case of success */
+static int read_jpeg_rows(yImageReader *reader, image_stream_t *stream, yImage *band, int nbRows)
+{
+    #ifdef HAVE_LIBJPEG
+    JSAMPROW rows[JPEG_ROWS_BY_CALL];
+    /* changed after setjmp() : volatile for their values to be defined after longjmp() */
+    volatile int i, done = 0;
+
+    if (setjmp(stream->jpegError.setjmpBuffer))
+        return 1;
+
+    while (done < nbRows)
+    {
+        int n = nbRows - done < JPEG_ROWS_BY_CALL ? nbRows - done : JPEG_ROWS_BY_CALL;
+
+        for (i = 0; i < n; i++)
+            rows[i] = band->rgbData + (size_t) 3 * (done + i) * reader->width;
+        n = jpeg_read_scanlines(&stream->jpegIn, rows, n);
+        if (n <= 0)
+            return 1;
+        done += n;
+    }
+
+    set_opaque_rows(band, nbRows);
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+/** \return 0 in case of success */
+static int read_tiff_rows(yImageReader *reader, image_stream_t *stream, yImage *band, int nbRows)
+{
+    #ifdef HAVE_LIBTIFF
+    int i;
+
+    for (i = 0; i < nbRows; i++)
+    {
+        if (TIFFReadScanline(stream->tif, stream->row, reader->row + i, 0) < 0)
+            return 1;
+        store_samples(stream->row, stream->channels, reader->width, band->rgbData + (size_t) 3 * i * reader->width,
+            band_alpha_row(band, i));
+    }
+
+    if (!reader->hasAlpha)
+        set_opaque_rows(band, nbRows);
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+int y_read_rows(yImageReader *reader, yImage *band, int nbRows)
+{
+    image_stream_t *stream = reader->codec;
+    size_t width = reader->width;
+    int err = 0;
+
+    if (band->rgbWidth != reader->width || nbRows < 0 || nbRows > band->rgbHeight)
+        return -1;
+
+    if (nbRows > reader->height - reader->row)
+        nbRows = reader->height - reader->row;
+    if (nbRows == 0)
+        return 0;
+
+    if (stream->image != NULL)
+    {
+        memcpy(band->rgbData, stream->image->rgbData + 3 * width * reader->row, 3 * width * nbRows);
+        if (band->alphaChanel != NULL)
+            memcpy(band->alphaChanel, stream->image->alphaChanel + width * reader->row, width * nbRows);
+    }
+    else switch (reader->format)
+    {
+    case Y_FORMAT_PPM:
+        err = read_pnm_rows(stream->file, &stream->pnm, stream->pnmTable, stream->row, band, 0, nbRows);
+        if (!reader->hasAlpha)
+            set_opaque_rows(band, nbRows);
+        break;
+    case Y_FORMAT_QOI:
+        err = decode_qoi_rows(&stream->qoiDecoder, &stream->qoiSource, band, 0, nbRows);
+        break;
+    case Y_FORMAT_PNG: err = read_png_rows(reader, stream, band, nbRows); break;
+    case Y_FORMAT_JPEG: err = read_jpeg_rows(reader, stream, band, nbRows); break;
+    case Y_FORMAT_TIFF: err = read_tiff_rows(reader, stream, band, nbRows); break;
+    default: err = 1;
+    }
+
+    if (err)
+    {
+        fprintf(stderr, "Reading rows : Unexpected end of data\n");
+        return -1;
+    }
+
+    reader->row += nbRows;
+    return nbRows;
+}
+
+
+void y_reader_close(yImageReader *reader)
+{
+    image_stream_t *stream;
+
+    if (reader == NULL)
+        return;
+
+    stream = reader->codec;
+
+    #ifdef HAVE_LIBPNG
+    if (stream->png != NULL)
+        png_destroy_read_struct(&stream->png, &stream->pngInfo, NULL);
+    #endif
+    #ifdef HAVE_LIBJPEG
+    if (stream->jpegCreated)
+        jpeg_destroy_decompress(&stream->jpegIn);
+    #endif
+    #ifdef HAVE_LIBTIFF
+    if (stream->tif != NULL)
+        TIFFClose(stream->tif);
+    #endif
+
+    if (stream->file != NULL)
+        fclose(stream->file);
+    if (stream->image != NULL)
+        y_destroy_image(stream->image);
+    free(stream->pnmTable);
+    free(stream->row);
+    free(stream);
+    free(reader);
+}
+
+
+static int open_png_writer(yImageWriter *writer, image_stream_t *stream)
+{
+    yPngColorType colorType = writer->hasAlpha ? Y_PNG_COLOR_RGBA : Y_PNG_COLOR_RGB;
+
+    if (writer->hasAlpha)
+    {
+        stream->row = malloc((size_t) writer->width * 4);
+        if (stream->row == NULL)
+            return 1;
+    }
+
+    #ifdef HAVE_LIBPNG
+    stream->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (stream->png == NULL)
+        return 1;
+    stream->pngInfo = png_create_info_struct(stream->png);
+    if (stream->pngInfo == NULL || setjmp(png_jmpbuf(stream->png)))
+        return 1;
+
+    stream->pngDest.write = file_write;
+    stream->pngDest.userData = stream->file;
+    png_set_write_fn(stream->png, &stream->pngDest, png_callback_write, png_callback_flush);
+    png_set_IHDR(stream->png, stream->pngInfo, writer->width, writer->height, 8, png_color_code(colorType),
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(stream->png, stream->pngInfo);
+    return 0;
+    #else
+    {
+        yPngOptions options;
+        size_t rowSize = (size_t) writer->width * (writer->hasAlpha ? 4 : 3);
+
+        y_init_png_options(&options);
+        stream->filters = png_filter_flags(&options, colorType);
+        stream->prev = calloc(rowSize, 1);
+        stream->trial = malloc(rowSize + 1);
+        stream->adler = 1;
+        y_init_buffer(&stream->filtered);
+        y_init_buffer(&stream->deflated);
+
+        if (stream->prev == NULL || stream->trial == NULL)
+            return 1;
+
+        return write_png_header(file_write, stream->file, writer->width, writer->height, 8, colorType);
+    }
+    #endif
+}
+
+
+static int open_jpeg_writer(yImageWriter *writer, image_stream_t *stream)
+{
+    #ifdef HAVE_LIBJPEG
+    struct jpeg_compress_struct *cinfo = &stream->jpegOut;
+
+    cinfo->err = jpeg_std_error(&stream->jpegError.pub);
+    stream->jpegError.pub.error_exit = jpeg_error_exit;
+    if (setjmp(stream->jpegError.setjmpBuffer))
+        return 1;
+
+    stream->jpegCreated = 1;
+    jpeg_create_compress(cinfo);
+    jpeg_stdio_dest(cinfo, stream->file);
+    cinfo->image_width = writer->width;
+    cinfo->image_height = writer->height;
+    set_jpeg_options(cinfo, NULL);
+    jpeg_start_compress(cinfo, TRUE);
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+static int open_tiff_writer(yImageWriter *writer, image_stream_t *stream, const char *file)
+{
+    #ifdef HAVE_LIBTIFF
+    if (writer->hasAlpha)
+    {
+        stream->row = malloc((size_t) writer->width * 4);
+        if (stream->row == NULL)
+            return 1;
+    }
+
+    stream->tif = TIFFOpen(file, "w");
+    if (stream->tif == NULL)
+        return 1;
+
+    set_tiff_fields(stream->tif, writer->width, writer->height, writer->hasAlpha);
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+/** release a writer, \return 0 if the file was closed without error */
+static int release_writer(yImageWriter *writer)
+{
+    image_stream_t *stream = writer->codec;
+    int err = 0;
+
+    #ifdef HAVE_LIBPNG
+    if (stream->png != NULL)
+        png_destroy_write_struct(&stream->png, &stream->pngInfo);
+    #else
+    free(stream->prev);
+    free(stream->trial);
+    y_release_buffer(&stream->filtered);
+    y_release_buffer(&stream->deflated);
+    #endif
+    #ifdef HAVE_LIBJPEG
+    if (stream->jpegCreated)
+        jpeg_destroy_compress(&stream->jpegOut);
+    #endif
+    #ifdef HAVE_LIBTIFF
+    if (stream->tif != NULL)
+        TIFFClose(stream->tif);
+    #endif
+
+    if (stream->file != NULL && fclose(stream->file))
+        err = 1;
+    free(stream->qoiEncoder.out);
+    free(stream->row);
+    free(stream);
+    free(writer);
+    return err;
+}
+
+
+yImageWriter *y_writer_open(const char *file, yImageFormat format, int width, int height, int hasAlpha)
+{
+    yImageWriter *writer;
+    image_stream_t *stream;
+    int err;
+
+    if (width <= 0 || height <= 0)
+        return NULL;
+
+    writer = calloc(1, sizeof(yImageWriter));
+    stream = calloc(1, sizeof(image_stream_t));
+    if (writer == NULL || stream == NULL)
+    {
+        free(writer);
+        free(stream);
+        return NULL;
+    }
+    writer->codec = stream;
+    writer->format = format;
+    writer->width = width;
+    writer->height = height;
+    writer->hasAlpha = hasAlpha && (format == Y_FORMAT_PNG || format == Y_FORMAT_TIFF || format == Y_FORMAT_QOI);
+
+    if (format != Y_FORMAT_TIFF)
+    {
+        stream->file = fopen(file, "wb");
+        if (stream->file == NULL)
+        {
+            fprintf(stderr, "Could not create file %s\n", file);
+            release_writer(writer);
+            return NULL;
+        }
+    }
+
+    switch (format)
+    {
+    case Y_FORMAT_PPM:
+        err = fprintf(stream->file, PPM_HEADER, width, height) < 0;
+        break;
+    case Y_FORMAT_QOI:
+        stream->qoiEncoder.out = malloc(QOI_BUFFER_SIZE);
+        err = stream->qoiEncoder.out == NULL;
+        if (!err)
+            init_qoi_encoder(&stream->qoiEncoder, width, height, writer->hasAlpha ? 4 : 3);
+        break;
+    case Y_FORMAT_PNG: err = open_png_writer(writer, stream); break;
+    case Y_FORMAT_JPEG: err = open_jpeg_writer(writer, stream); break;
+    case Y_FORMAT_TIFF: err = open_tiff_writer(writer, stream, file); break;
+    default: err = 1;
+    }
+
+    if (err)
+    {
+        fprintf(stderr, "Could not write the image %s\n", file);
+        release_writer(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+
+#ifndef HAVE_LIBPNG
+/** deflate the filtered rows in an IDAT chunk, \return 0 in case of success */
+static int flush_png_rows(image_stream_t *stream, int last)
+{
+    size_t length = stream->filtered.size;
+    unsigned char *out;
+    size_t size = 0;
+
+    if (reserve_buffer(&stream->deflated, y_deflate_bound(length) + 6))
+        return 1;
+
+    out = stream->deflated.data;
+    if (!stream->started)
+    {
+        put_zlib_header(out, -1);
+        size = 2;
+        stream->started = 1;
+    }
+
+    size += y_deflate(stream->filtered.data, length, Y_DEFLATE_RLE, last, out + size);
+    stream->adler = y_adler32(stream->adler, stream->filtered.data, length);
+    if (last)
+    {
+        put_uint32(out + size, stream->adler);
+        size += 4;
+    }
+    stream->filtered.size = 0;
+
+    return size > 0 && write_png_chunk(file_write, stream->file, "IDAT", out, size);
+}
+#endif
+
+
+/** \return 0 in case of success */
+static int write_png_rows(yImageWriter *writer, image_stream_t *stream, yImage *band, int nbRows)
+{
+    yPngColorType colorType = writer->hasAlpha ? Y_PNG_COLOR_RGBA : Y_PNG_COLOR_RGB;
+    int i;
+
+    #ifdef HAVE_LIBPNG
+    if (setjmp(png_jmpbuf(stream->png)))
+        return 1;
+    #endif
+
+    for (i = 0; i < nbRows; i++)
+    {
+        unsigned char *row = band->rgbData + (size_t) 3 * i * writer->width;
+
+        if (writer->hasAlpha)
+        {
+            fill_png_row(band, i, colorType, NULL, stream->row);
+            row = stream->row;
+        }
+
+        #ifdef HAVE_LIBPNG
+        png_write_row(stream->png, row);
+        #else
+        {
+            size_t n = (size_t) writer->width * (writer->hasAlpha ? 4 : 3);
+
+            if (reserve_buffer(&stream->filtered, stream->filtered.size + n + 1))
+                return 1;
+            choose_png_filter(stream->filters, row, stream->prev, n, writer->hasAlpha ? 4 : 3,
+                stream->filtered.data + stream->filtered.size, stream->trial);
+            stream->filtered.size += n + 1;
+            memcpy(stream->prev, row, n);
+
+            if (stream->filtered.size >= PNG_BLOCK_SIZE && flush_png_rows(stream, 0))
+                return 1;
+        }
+        #endif
+    }
+
+    return 0;
+}
+
+
+/** \return 0 in case of success */
+static int write_jpeg_rows(yImageWriter *writer, image_stream_t *stream, yImage *band, int nbRows)
+{
+    #ifdef HAVE_LIBJPEG
+    JSAMPROW rows[JPEG_ROWS_BY_CALL];
+    /* changed after setjmp() : volatile for their values to be defined after longjmp() */
+    volatile int i, done = 0;
+
+    if (setjmp(stream->jpegError.setjmpBuffer))
+        return 1;
+
+    while (done < nbRows)
+    {
+        int n = nbRows - done < JPEG_ROWS_BY_CALL ? nbRows - done : JPEG_ROWS_BY_CALL;
+
+        for (i = 0; i < n; i++)
+            rows[i] = band->rgbData + (size_t) 3 * (done + i) * writer->width;
+        done += jpeg_write_scanlines(&stream->jpegOut, rows, n);
+    }
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+/** \return 0 in case of success */
+static int write_tiff_rows(yImageWriter *writer, image_stream_t *stream, yImage *band, int nbRows)
+{
+    #ifdef HAVE_LIBTIFF
+    int i;
+
+    for (i = 0; i < nbRows; i++)
+    {
+        unsigned char *row = band->rgbData + (size_t) 3 * i * writer->width;
+
+        if (writer->hasAlpha)
+        {
+            fill_png_row(band, i, Y_PNG_COLOR_RGBA, NULL, stream->row);
+            row = stream->row;
+        }
+
+        if (TIFFWriteScanline(stream->tif, row, writer->row + i, 0) < 0)
+            return 1;
+    }
+    return 0;
+    #else
+    return 1;
+    #endif
+}
+
+
+int y_write_rows(yImageWriter *writer, yImage *band, int nbRows)
+{
+    image_stream_t *stream = writer->codec;
+    int err;
+
+    if (stream->failed || band->rgbWidth != writer->width || nbRows < 0 || nbRows > band->rgbHeight ||
+        nbRows > writer->height - writer->row)
+    {
+        return 1;
+    }
+
+    switch (writer->format)
+    {
+    case Y_FORMAT_PPM:
+        err = fwrite(band->rgbData, (size_t) 3 * writer->width, nbRows, stream->file) != (size_t) nbRows;
+        break;
+    case Y_FORMAT_QOI:
+        err = encode_qoi_rows(&stream->qoiEncoder, band, 0, nbRows, file_write, stream->file);
+        break;
+    case Y_FORMAT_PNG: err = write_png_rows(writer, stream, band, nbRows); break;
+    case Y_FORMAT_JPEG: err = write_jpeg_rows(writer, stream, band, nbRows); break;
+    case Y_FORMAT_TIFF: err = write_tiff_rows(writer, stream, band, nbRows); break;
+    default: err = 1;
+    }
+
+    if (err)
+    {
+        stream->failed = 1;
+        return 1;
+    }
+
+    writer->row += nbRows;
+    return 0;
+}
+
+
+int y_writer_close(yImageWriter *writer)
+{
+    image_stream_t *stream;
+    int err;
+
+    if (writer == NULL)
+        return 1;
+
+    stream = writer->codec;
+    err = stream->failed || writer->row != writer->height;
+
+    if (!err) switch (writer->format)
+    {
+    case Y_FORMAT_QOI:
+        err = finish_qoi(&stream->qoiEncoder, file_write, stream->file);
+        break;
+    case Y_FORMAT_PNG:
+        #ifdef HAVE_LIBPNG
+        if (setjmp(png_jmpbuf(stream->png)))
+            err = 1;
+        else
+            png_write_end(stream->png, NULL);
+        #else
+        err = flush_png_rows(stream, 1) || write_png_chunk(file_write, stream->file, "IEND", NULL, 0);
+        #endif
+        break;
+    case Y_FORMAT_JPEG:
+        #ifdef HAVE_LIBJPEG
+        if (setjmp(stream->jpegError.setjmpBuffer))
+            err = 1;
+        else
+            jpeg_finish_compress(&stream->jpegOut);
+        #endif
+        break;
+    default:
+        break;
+    }
+
+    if (release_writer(writer))
+        err = 1;
+
+    return err;
+}
+
+
+
+/** rows read at once by the thumbnail maker */
+#define THUMBNAIL_BAND_HEIGHT 16
+
+/** map each of the "size" source pixels to the reduced pixel covering it, in a reduction to "reduced" pixels */
+static void box_map(int size, int reduced, int *map)
+{
+    int o, i;
+
+    for (o = 0; o < reduced; o++)
+        for (i = (int64_t) o * size / reduced; i < (int64_t) (o + 1) * size / reduced; i++)
+            map[i] = o;
+}
+
+
+/** set the row "y" of the thumbnail with the averages of the sums, then clear them */
+static void store_thumbnail_row(yImage *thumb, int y, uint64_t *sums)
+{
+    unsigned char *rgb = thumb->rgbData + (size_t) 3 * thumb->rgbWidth * y;
+    unsigned char *alpha = thumb->alphaChanel + (size_t) thumb->rgbWidth * y;
+    int x, k;
+
+    for (x = 0; x < thumb->rgbWidth; x++, sums += 5)
+    {
+        /* the colours are weighted by their alpha, so that the transparent pixels don't darken the edges */
+        uint64_t n = sums[4], a = sums[3];
+
+        for (k = 0; k < 3; k++)
+            rgb[3 * x + k] = a > 0 ? (sums[k] + a / 2) / a : 0;
+        alpha[x] = n > 0 ? (a + n / 2) / n : 0;
+        memset(sums, 0, 5 * sizeof(uint64_t));
+    }
+}
+
+
+yImage *y_load_thumbnail(const char *file, int maxWidth, int maxHeight)
+{
+    yImageReader *reader;
+    image_stream_t *stream;
+    yImage *band = NULL, *thumb = NULL;
+    int *xmap = NULL, *ymap = NULL;
+    uint64_t *sums = NULL;
+    int y, n, x, i, err, last = 0;
+
+    if (maxWidth < 1 || maxHeight < 1)
+        return NULL;
+
+    reader = open_reader(file, maxWidth, maxHeight);
+    if (reader == NULL)
+        return NULL;
+    stream = reader->codec;
+
+    /* the JPEG files may be decoded a little larger than the thumbnail */
+    if (stream->thumbWidth > reader->width) stream->thumbWidth = reader->width;
+    if (stream->thumbHeight > reader->height) stream->thumbHeight = reader->height;
+
+    band = y_create_image(&err, NULL, reader->width,
+        reader->height < THUMBNAIL_BAND_HEIGHT ? reader->height : THUMBNAIL_BAND_HEIGHT);
+    thumb = y_create_image(&err, NULL, stream->thumbWidth, stream->thumbHeight);
+    xmap = malloc(reader->width * sizeof(int));
+    ymap = malloc(reader->height * sizeof(int));
+    sums = calloc((size_t) 5 * stream->thumbWidth, sizeof(uint64_t));
+
+    if (band == NULL || thumb == NULL || xmap == NULL || ymap == NULL || sums == NULL)
+    {
+        y_destroy_image(thumb);
+        thumb = NULL;
+    }
+    else
+    {
+        box_map(reader->width, thumb->rgbWidth, xmap);
+        box_map(reader->height, thumb->rgbHeight, ymap);
+    }
 
-    f = fopen(file, "wb");
-    if (f)
+    for (y = 0; thumb != NULL && y < reader->height; y += n)
     {
-        png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-        if (!png_ptr)
-        {
-            fclose(f);
-            fprintf(stderr, "Fail create png file %s\n", file);
-            return 1;
-        }
-        info_ptr = png_create_info_struct(png_ptr);
-        if (info_ptr == NULL)
-        {
-            fclose(f);
-            png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
-            fprintf(stderr, "Fail create png file %s\n", file);
-            return 2;
-        }
-        //if (setjmp(png_ptr->jmpbuf))
-        if (setjmp(png_jmpbuf(png_ptr)))
-        {
-            fclose(f);
-            png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
-            fprintf(stderr, "Fail create png file %s\n", file);
-            return 3;
-        }
-        png_init_io(png_ptr, f);
-        png_set_IHDR(png_ptr, info_ptr, im->rgbWidth, im->rgbHeight, 8,
-            PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
-            PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-        sig_bit.red = 8;
-        sig_bit.green = 8;
-        sig_bit.blue = 8;
-        sig_bit.alpha = 8;
-        png_set_sBIT(png_ptr, info_ptr, &sig_bit);
-        png_write_info(png_ptr, info_ptr);
-        png_set_shift(png_ptr, &sig_bit);
-        png_set_packing(png_ptr);
-        data = (unsigned char *) malloc(im->rgbWidth * 4);
-        if (!data)
+        n = y_read_rows(reader, band, band->rgbHeight);
+        if (n <= 0)
         {
-            fclose(f);
-            png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
-            fprintf(stderr, "Fail create png file %s : no data\n", file);
-            return 4;
+            y_destroy_image(thumb);
+            thumb = NULL;
+            break;
         }
-        for (y = 0; y < im->rgbHeight; y++)
+
+        for (i = 0; i < n; i++)
         {
-            ptr = im->rgbData + (y * im->rgbWidth * 3);
-            for (x = 0; x < im->rgbWidth; x++)
+            const unsigned char *rgb = band->rgbData + (size_t) 3 * i * reader->width;
+            const unsigned char *alpha = band->alphaChanel + (size_t) i * reader->width;
+
+            if (ymap[y + i] != last)
             {
-                data[(x << 2) + 0] = *ptr++;
-                data[(x << 2) + 1] = *ptr++;
-                data[(x << 2) + 2] = *ptr++;
-                if(im->alphaChanel!=NULL)
-                    data[(x << 2) + 3] = im->alphaChanel[ x + y*im->rgbWidth ];
-                else if(im->hasShapeColor)
-                    if ((data[(x << 2) + 0] == im->shapeColor.r) &&
-                        (data[(x << 2) + 1] == im->shapeColor.g) &&
-                        (data[(x << 2) + 2] == im->shapeColor.b))
-                         data[(x << 2) + 3] = 0; /* transparent */
-                    else
-                        data[(x << 2) + 3] = 255; /* opaque */
-                else
-                    data[(x << 2) + 3] = 255;
+                store_thumbnail_row(thumb, last, sums);
+                last = ymap[y + i];
             }
-            row_ptr = data;
-            png_write_rows(png_ptr, &row_ptr, 1);
-        }
-        free(data);
-        png_write_end(png_ptr, info_ptr);
-        png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
 
-        fclose(f);
-        return 0;
+            for (x = 0; x < reader->width; x++, rgb += 3)
+            {
+                uint64_t *sum = sums + 5 * xmap[x];
+                unsigned int a = alpha[x];
+
+                sum[0] += rgb[0] * a;
+                sum[1] += rgb[1] * a;
+                sum[2] += rgb[2] * a;
+                sum[3] += a;
+                sum[4]++;
+            }
+        }
     }
-    #endif
-    return 5;
+
+    if (thumb != NULL)
+        store_thumbnail_row(thumb, last, sums);
+
+    free(sums);
+    free(ymap);
+    free(xmap);
+    if (band != NULL)
+        y_destroy_image(band);
+    y_reader_close(reader);
+    return thumb;
 }
 
 
 
-int y_save_tiff(yImage *im, const char *file)
+/** number of rows read at once, to skip the rows before a region */
+#define REGION_BAND_HEIGHT 16
+
+
+yImage *y_load_region(const char *file, int x, int y, int width, int height)
 {
-    #ifdef HAVE_LIBTIFF
-    TIFF               *tif;
-    unsigned char      *data;
-    int                 y;
+    unsigned char magic[8];
+    yImageReader *reader;
+    yImage *region = NULL, *band = NULL;
+    size_t length;
+    int row, err;
+    FILE *f;
 
-    tif = TIFFOpen(file, "w");
-    if (tif)
+    f = fopen(file, "rb");
+    if (f == NULL)
     {
-        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, im->rgbWidth);
-        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, im->rgbHeight);
-        TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
-        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-        TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
-        {
-            TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 3);
-            TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-            /*w = */TIFFScanlineSize(tif);
-            TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP,
-            TIFFDefaultStripSize(tif, -1));
-            for (y = 0; y < im->rgbHeight; y++)
-            {
-                data = im->rgbData + (y * im->rgbWidth * 3);
-                TIFFWriteScanline(tif, data, y, 0);
-            }
-        }
-        TIFFClose(tif);
-        return 0;
+        fprintf(stderr, "Could not open file %s\n", file);
+        return NULL;
     }
-    #endif
-    return 1;
-}
+    length = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
 
+    switch (detect_format(magic, length))
+    {
+    case Y_FORMAT_PPM:
+        return load_pnm_region(file, x, y, width, height);
+    case Y_FORMAT_TIFF:
+        #ifdef HAVE_LIBTIFF
+        {
+            TIFF *tif = TIFFOpen(file, "r");
+
+            if (tif == NULL)
+                return NULL;
+            region = decode_tiff_region(tif, x, y, width, height);
+            TIFFClose(tif);
+        }
+        #endif
+        return region;
+    default:
+        break;
+    }
 
+    /* the other files are decoded up to the end of the region, keeping only its pixels */
+    reader = y_reader_open(file);
+    if (reader == NULL)
+        return NULL;
 
-/* LOADING FILES */
+    if (!clip_region(reader->width, reader->height, &x, &y, &width, &height))
+    {
+        region = y_create_image(&err, NULL, width, height);
+        band = y_create_image(&err, NULL, reader->width, REGION_BAND_HEIGHT);
+    }
 
+    for (row = 0; region != NULL && band != NULL && row < y + height; )
+    {
+        int n = y + height - row, i;
 
+        if (n > REGION_BAND_HEIGHT) n = REGION_BAND_HEIGHT;
+        if (row < y && n > y - row) n = y - row;
 
-static void ignore_comments(FILE *stream) {
+        if (y_read_rows(reader, band, n) != n)
+        {
+            y_destroy_image(region);
+            region = NULL;
+            break;
+        }
 
-    int c = fgetc(stream);
+        for (i = row < y ? n : 0; i < n; i++)
+        {
+            size_t pos = (size_t) i * reader->width + x;
 
-    while(c == '#') {
-        int d = fgetc(stream);
-        while (d != '\n' && d != EOF) {
-            d = fgetc(stream);
+            memcpy(region->rgbData + (size_t) 3 * (row + i - y) * width, band->rgbData + 3 * pos, (size_t) 3 * width);
+            memcpy(region->alphaChanel + (size_t) (row + i - y) * width, band->alphaChanel + pos, width);
         }
-        c = fgetc(stream);
+        row += n;
     }
 
-    if(c != EOF) {
-        ungetc(c, stream);
+    if (band == NULL)
+    {
+        y_destroy_image(region);
+        region = NULL;
     }
+    else
+        y_destroy_image(band);
+    y_reader_close(reader);
+    return region;
 }
 
 
-yImage *y_load_ppm(const char *file) {
+/************************************************************/
+/*                PROBING AND GENERIC LOADING               */
+/************************************************************/
 
-    FILE *f; /* file descriptor */
-    yImage *im;
+/*
+ * The probe reads only the headers : the first bytes of the file, and
+ * for JPEG and TIFF the few segments or directory entries leading to the
+ * image's size. It doesn't need the codec libraries.
+ */
 
-    f = fopen(file, "rb");
-    if (f)
+/** size of the beginning of a file read at once by the probe */
+#define PROBE_HEADER_SIZE 64
+
+
+/** a file or a memory area read by the probe */
+typedef struct {
+    FILE *file; /**< the file, or NULL to read "data" */
+    const unsigned char *data;
+    size_t size;
+} probe_source_t;
+
+
+/** read up to "length" bytes at "offset", \return the number of bytes read */
+static size_t probe_read(probe_source_t *source, uint64_t offset, unsigned char *buffer, size_t length)
+{
+    if (source->file != NULL)
     {
-        char magic[4]; // magic number
-        char line[20]; // header line
-        int w, h; // width and height of the image
-        int n; // read on the file, must be 255
-        int err; // error code
-        int r; // number of elts read
+        if (offset > 0x7FFFFFFF || fseek(source->file, (long) offset, SEEK_SET))
+            return 0;
+        return fread(buffer, 1, length, source->file);
+    }
 
-        fread(magic, 1, 3, f);
-        magic[3]='\0';
+    if (offset >= source->size)
+        return 0;
+    if (length > source->size - offset)
+        length = source->size - offset;
+    memcpy(buffer, source->data + offset, length);
+    return length;
+}
 
-        if(strcmp(magic, "P6\n")) {
-            fprintf(stderr, "Bad file format for %s\n", file);
-            fclose(f);
-            return NULL;
-        }
 
-        ignore_comments(f);
+/** \return 0 if the header of a netpbm file is valid */
+static int probe_ppm(probe_source_t *source, yImageInfo *info)
+{
+    unsigned char header[PPM_HEADER_MAX_SIZE];
+    size_t size = probe_read(source, 0, header, PPM_HEADER_MAX_SIZE);
+    pnm_header_t pnm;
 
-        fgets(line, 19, f);
-        line[19]='\0';
-        sscanf(line, "%d %d\n", &w, &h);
+    if (parse_pnm_header(header, size, &pnm))
+        return 1;
 
-        ignore_comments(f);
+    info->width = pnm.width;
+    info->height = pnm.height;
+    info->channels = pnm.channels;
+    info->bitDepth = pnm.maxval > 255 ? 16 : 8;
+    return 0;
+}
 
-        fgets(line, 19, f);
-        line[19]='\0';
-        sscanf(line, "%d\n", &n);
 
-        ignore_comments(f);
+/** \return 0 if the IHDR chunk of a PNG file is valid */
+static int probe_png(const unsigned char *header, size_t size, yImageInfo *info)
+{
+    if (size < 29 || memcmp(header + 12, "IHDR", 4))
+        return 1;
 
-        if(h < 0 || w < 0) {
-            fprintf(stderr, "Bad file format for %s : width x height = %d x %d\n", file, w, h);
-            fclose(f);
-            return NULL;
-        }
+    info->width = get_uint32(header + 16);
+    info->height = get_uint32(header + 20);
+    info->bitDepth = header[24];
+    switch (header[25])
+    {
+    case 0: info->channels = 1; break;
+    case 4: info->channels = 2; break;
+    case 6: info->channels = 4; break;
+    default: info->channels = 3; /* RGB and palette */
+    }
+    return 0;
+}
 
-        if(n != 255) {
-            fprintf(stderr, "Bad file format for %s : n = %d\n", file, n);
-            fclose(f);
-            return NULL;
-        }
 
+/** \return 0 if the header of a QOI file is valid */
+static int probe_qoi(const unsigned char *header, size_t size, yImageInfo *info)
+{
+    if (size < QOI_HEADER_SIZE || (header[12] != 3 && header[12] != 4))
+        return 1;
 
-        im = y_create_image(&err, NULL, w, h);
-        r=fread(im->rgbData, w * h * 3, 1, f);
+    info->width = get_uint32(header + 4);
+    info->height = get_uint32(header + 8);
+    info->channels = header[12];
+    info->bitDepth = 8;
+    return 0;
+}
 
-        if(r != 1) {
-            fprintf(stderr, "Reading PPM file %s : Unexpected end of file\n", file);
-            y_destroy_image(im);
-            im = NULL;
+
+/** look for the start of frame segment of a JPEG file, \return 0 if found */
+static int probe_jpeg(probe_source_t *source, yImageInfo *info)
+{
+    unsigned char segment[10];
+    uint64_t pos = 2;
+
+    while (probe_read(source, pos, segment, 4) == 4)
+    {
+        int marker = segment[1];
+
+        if (segment[0] != 0xFF)
+            return 1;
+        if (marker == 0xFF)
+        {
+            pos++; /* fill byte */
+            continue;
         }
 
-        fclose(f);
-        return im;
+        /* SOF0 to SOF15, except DHT, JPG and DAC */
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            if (probe_read(source, pos + 4, segment + 4, 6) != 6)
+                return 1;
+            info->bitDepth = segment[4];
+            info->height = (segment[5] << 8) | segment[6];
+            info->width = (segment[7] << 8) | segment[8];
+            info->channels = segment[9] == 1 ? 1 : 3;
+            return 0;
+        }
+
+        if (marker == 0xD9 || marker == 0xDA)
+            return 1; /* end of image or scan before any frame */
+        pos += 2 + ((segment[2] << 8) | segment[3]);
     }
-    return NULL;
+    return 1;
 }
 
 
+/** \return the integer of "size" bytes at "data", in the byte order of a TIFF file */
+static uint64_t get_tiff_integer(const unsigned char *data, int size, int bigEndian)
+{
+    uint64_t value = 0;
+    int i;
 
+    for (i = 0; i < size; i++)
+        value |= (uint64_t) data[bigEndian ? i : size - 1 - i] << (8 * (size - 1 - i));
+    return value;
+}
 
-static yImage *LoadPNG(FILE *f);
 
-yImage *y_load_png(const char *file) {
+/** read the first directory of a TIFF or BigTIFF file, \return 0 if the size was found */
+static int probe_tiff(probe_source_t *source, const unsigned char *header, size_t size, yImageInfo *info)
+{
+    int bigEndian = header[0] == 'M';
+    int big = get_tiff_integer(header + 2, 2, bigEndian) == 43;
+    int entrySize = big ? 20 : 12;
+    int offsetSize = big ? 8 : 4;
+    int countSize = big ? 8 : 2; /* size of the number of entries */
+    unsigned char entry[20];
+    uint64_t ifd, n, i;
 
-    FILE *fd;
-    yImage *im = NULL;
+    if (size < 16)
+        return 1;
 
-    fd=fopen(file, "r");
+    ifd = big ? get_tiff_integer(header + 8, 8, bigEndian) : get_tiff_integer(header + 4, 4, bigEndian);
+    if (probe_read(source, ifd, entry, countSize) != (size_t) countSize)
+        return 1;
+    n = get_tiff_integer(entry, countSize, bigEndian);
+    ifd += countSize;
 
-    if(fd == NULL) {
-        fprintf(stderr, "Could not open file %s\n", file);
-        return NULL;
+    info->width = info->height = 0;
+    info->channels = 1;
+    info->bitDepth = 1;
+    for (i = 0; i < n && i < 1024; i++)
+    {
+        const unsigned char *value = entry + (big ? 12 : 8);
+        int tag, type;
+        uint64_t count;
+
+        if (probe_read(source, ifd + i * entrySize, entry, entrySize) != (size_t) entrySize)
+            return 1;
+        tag = get_tiff_integer(entry, 2, bigEndian);
+        type = get_tiff_integer(entry + 2, 2, bigEndian);
+        count = get_tiff_integer(entry + 4, big ? 8 : 4, bigEndian);
+
+        /* the first value of the tag, a SHORT (3) or a LONG (4) */
+        if (type == 3 && count * 2 > (uint64_t) offsetSize)
+        {
+            /* the values don't fit in the entry */
+            if (probe_read(source, get_tiff_integer(value, offsetSize, bigEndian), entry, 2) != 2)
+                return 1;
+            value = entry;
+        }
+
+        switch (tag)
+        {
+        case 256: info->width = get_tiff_integer(value, type == 3 ? 2 : 4, bigEndian); break;
+        case 257: info->height = get_tiff_integer(value, type == 3 ? 2 : 4, bigEndian); break;
+        case 258: info->bitDepth = get_tiff_integer(value, 2, bigEndian); break;
+        case 277: info->channels = get_tiff_integer(value, 2, bigEndian); break;
+        default: break;
+        }
     }
 
-    #ifdef HAVE_LIBPNG
-    im = LoadPNG(fd);
-    #endif
+    return info->width <= 0 || info->height <= 0;
+}
 
-    fclose(fd);
-    return im;
+
+/** fill "info" with the header of "source", \return 0 in case of success */
+static int probe(probe_source_t *source, yImageInfo *info)
+{
+    unsigned char header[PROBE_HEADER_SIZE];
+    size_t size = probe_read(source, 0, header, PROBE_HEADER_SIZE);
+    int err = 1;
+
+    info->format = detect_format(header, size);
+    switch (info->format)
+    {
+    case Y_FORMAT_PPM: err = probe_ppm(source, info); break;
+    case Y_FORMAT_PNG: err = probe_png(header, size, info); break;
+    case Y_FORMAT_QOI: err = probe_qoi(header, size, info); break;
+    case Y_FORMAT_JPEG: err = probe_jpeg(source, info); break;
+    case Y_FORMAT_TIFF: err = probe_tiff(source, header, size, info); break;
+    default: break;
+    }
+
+    if (err)
+    {
+        info->format = Y_FORMAT_UNKNOWN;
+        info->width = info->height = info->channels = info->bitDepth = 0;
+    }
+    return err;
 }
 
 
-static yImage *LoadPNG(FILE *f)
+int y_probe(const char *file, yImageInfo *info)
 {
-    png_structp png_ptr;
-    png_infop info_ptr;
+    probe_source_t source;
+    int err;
 
-    unsigned char *ptr, *ptr2; /* parcourt of data arrays */
-    unsigned char **lines; /* PNG data */
-    unsigned char r, g, b, a; /* RGBA of a pixel */
-    int i, x, y/*, interlace_type*/;
+    source.file = fopen(file, "rb");
+    if (source.file == NULL)
+    {
+        memset(info, 0, sizeof(yImageInfo));
+        return 1;
+    }
 
+    err = probe(&source, info);
+    fclose(source.file);
+    return err;
+}
 
-    unsigned char *ptrAlpha;
-    int width, height;
-    png_byte color_type;
-    char header[8];    // 8 is the maximum size that can be checked
-    int err; /* error code */
 
-    yImage *im=NULL;
+int y_probe_buffer(const unsigned char *data, size_t size, yImageInfo *info)
+{
+    probe_source_t source;
 
+    source.file = NULL;
+    source.data = data;
+    source.size = size;
+    return probe(&source, info);
+}
 
-    /* Init PNG Reader */
 
-    fread((void *) header, 1, 8, f);
-    if (png_sig_cmp((png_const_bytep)header, 0, 8))
+yImage *y_load_image(const char *file)
+{
+    unsigned char magic[PROBE_HEADER_SIZE];
+    size_t length = 0;
+    FILE *f;
+
+    f = fopen(file, "rb");
+    if (f == NULL)
     {
+        fprintf(stderr, "Could not open file %s\n", file);
         return NULL;
     }
+    length = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
 
-
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr) return NULL;
-    info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr)
+    switch (detect_format(magic, length))
     {
-        png_destroy_read_struct(&png_ptr, NULL, NULL);
-        return NULL;
+    case Y_FORMAT_PPM: return y_load_ppm(file);
+    case Y_FORMAT_PNG: return y_load_png(file);
+    case Y_FORMAT_QOI: return y_load_qoi(file);
+    case Y_FORMAT_JPEG: return y_load_jpeg(file);
+    case Y_FORMAT_TIFF: return y_load_tiff(file);
+    default: return NULL;
     }
+}
 
-    if (setjmp(png_jmpbuf(png_ptr)))
+
+yImage *y_decode_image(const unsigned char *data, size_t size)
+{
+    switch (detect_format(data, size))
     {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        return NULL;
+    case Y_FORMAT_PPM: return y_decode_ppm(data, size);
+    case Y_FORMAT_PNG: return y_decode_png(data, size);
+    case Y_FORMAT_QOI: return y_decode_qoi(data, size);
+    case Y_FORMAT_JPEG: return y_decode_jpeg(data, size);
+    case Y_FORMAT_TIFF: return y_decode_tiff(data, size);
+    default: return NULL;
     }
+}
 
 
-    png_init_io(png_ptr, f);
 
-    png_set_sig_bytes(png_ptr, 8);
+/************************************************************/
+/*                     FRAME STREAMING                      */
+/************************************************************/
 
-    png_read_info(png_ptr, info_ptr);
 
-    width = png_get_image_width(png_ptr, info_ptr);
-    height = png_get_image_height(png_ptr, info_ptr);
-    color_type = png_get_color_type(png_ptr, info_ptr);
+/** state of a yFrameSink */
+typedef struct {
+    unsigned char *buffer; /* converted frame, for RGBA and Y4M */
+    size_t size; /* size of a frame in the stream */
+    int failed; /* set after a write error */
+} frame_sink_t;
 
-    /* Setup Translators */
-    if (color_type == PNG_COLOR_TYPE_PALETTE)
-        png_set_expand(png_ptr);
-    png_set_strip_16(png_ptr);
-    png_set_packing(png_ptr);
-    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
-        png_set_expand(png_ptr);
-    png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
 
+/**
+ * Write all the bytes of several buffers, calling writev() again after
+ * partial writes.
+ * \return 0 in case of success
+ */
+static int write_vector(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
 
-    /* Allocate memory for read png data*/
-    lines = (unsigned char **)malloc(height * sizeof(unsigned char *));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
 
-    if (lines == NULL)
-    {
-        y_destroy_image(im);
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        return NULL;
+        while (count > 0 && (size_t) written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (unsigned char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
     }
+    return 0;
+}
 
-    for (i = 0; i < height; i++)
+
+/**
+ * Convert an image in the planes of a YUV 4:2:0 frame (BT.601, limited
+ * range). The rows are converted by pairs, each chroma sample from the
+ * sum of 2x2 pixels (or less on the odd right and bottom edges).
+ */
+static void convert_yuv420(yImage *im, unsigned char *planeY, unsigned char *planeU, unsigned char *planeV)
+{
+    int width = im->rgbWidth, height = im->rgbHeight;
+    int chromaWidth = (width + 1) / 2;
+    int x, y;
+
+    for (y = 0; y < height; y += 2)
     {
-        if ((lines[i] = (unsigned char*) malloc(width * (sizeof(unsigned char) * 4))) == NULL)
+        const unsigned char *row[2];
+        unsigned char *luma[2];
+        int nbRows = y + 1 < height ? 2 : 1;
+        unsigned char *u = planeU + (size_t) (y / 2) * chromaWidth;
+        unsigned char *v = planeV + (size_t) (y / 2) * chromaWidth;
+
+        row[0] = im->rgbData + (size_t) 3 * y * width;
+        row[1] = nbRows == 2 ? row[0] + 3 * width : row[0];
+        luma[0] = planeY + (size_t) y * width;
+        luma[1] = luma[0] + width;
+
+        for (x = 0; x < width; x += 2)
         {
-            int n;
+            int nbCols = x + 1 < width ? 2 : 1;
+            int sumR = 0, sumG = 0, sumB = 0, n = 0, i, j;
 
-            y_destroy_image(im);
+            for (j = 0; j < nbRows; j++)
+            {
+                for (i = 0; i < nbCols; i++)
+                {
+                    const unsigned char *p = row[j] + 3 * (x + i);
 
-            for (n = 0; n < i; n++)
-                free(lines[n]);
-            free(lines);
-            png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-            return NULL;
+                    luma[j][x + i] = ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16;
+                    sumR += p[0];
+                    sumG += p[1];
+                    sumB += p[2];
+                    n++;
+                }
+            }
+
+            /* the sums are scaled to 4 pixels, for a single shift */
+            if (n != 4)
+            {
+                sumR = sumR * 4 / n;
+                sumG = sumG * 4 / n;
+                sumB = sumB * 4 / n;
+            }
+            u[x / 2] = ((-38 * sumR - 74 * sumG + 112 * sumB + 512) >> 10) + 128;
+            v[x / 2] = ((112 * sumR - 94 * sumG - 18 * sumB + 512) >> 10) + 128;
         }
     }
+}
 
-    /* Reading */
-    png_read_image(png_ptr, lines);
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 
+yFrameSink *y_frame_sink_open(int fd, yFrameFormat format, int width, int height, int fpsNum, int fpsDen)
+{
+    yFrameSink *sink;
+    frame_sink_t *state;
+    size_t pixels = (size_t) width * height;
+
+    if (fd < 0 || width <= 0 || height <= 0)
+        return NULL;
 
-    /* allocate memory for yImage structure */
-    im=y_create_image(&err, NULL, width, height);
-    if(im==NULL)
+    sink = malloc(sizeof(yFrameSink));
+    state = malloc(sizeof(frame_sink_t));
+    if (sink == NULL || state == NULL)
     {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        free(sink);
+        free(state);
         return NULL;
     }
 
-    im->rgbData = (unsigned char*) malloc(im->rgbWidth * im->rgbHeight * 3);
-    if (!im->rgbData)
+    sink->format = format;
+    sink->fd = fd;
+    sink->width = width;
+    sink->height = height;
+    sink->frames = 0;
+    sink->codec = state;
+    state->buffer = NULL;
+    state->failed = 0;
+
+    switch (format)
     {
-      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-      return NULL;
+    case Y_FRAME_RGB24:
+        state->size = 3 * pixels;
+        break;
+    case Y_FRAME_RGBA:
+        state->size = 4 * pixels;
+        state->buffer = malloc(state->size);
+        break;
+    case Y_FRAME_Y4M:
+        state->size = pixels + 2 * (size_t) ((width + 1) / 2) * ((height + 1) / 2);
+        state->buffer = malloc(state->size);
+        break;
+    default:
+        state->size = 0;
     }
 
-    im->alphaChanel = (unsigned char*) malloc(im->rgbWidth * im->rgbHeight);
-    if (!im->alphaChanel)
+    if (state->size == 0 || (format != Y_FRAME_RGB24 && state->buffer == NULL))
     {
-      png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-      return NULL;
+        y_frame_sink_close(sink);
+        return NULL;
     }
 
-
-    /* Data interpretation */
-    ptr = im->rgbData;
-    ptrAlpha= im->alphaChanel;
-
-    if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+    if (format == Y_FRAME_Y4M)
     {
-        for (y = 0; y < im->rgbHeight; y++)
-        {
-            ptr2 = lines[y];
-            for (x = 0; x < im->rgbWidth; x++)
-            {
-                r = *ptr2++;
-                a = *ptr2++;
+        char header[128];
+        struct iovec iov;
 
-                *ptr++ = r;
-                *ptr++ = r;
-                *ptr++ = r;
-                *ptrAlpha++=a;
-            }
+        iov.iov_base = header;
+        iov.iov_len = snprintf(header, sizeof(header), Y4M_HEADER, width, height,
+            fpsNum > 0 ? fpsNum : 25, fpsNum > 0 && fpsDen > 0 ? fpsDen : 1);
+        if (write_vector(fd, &iov, 1))
+        {
+            y_frame_sink_close(sink);
+            return NULL;
         }
     }
 
-    else if (color_type == PNG_COLOR_TYPE_GRAY)
+    return sink;
+}
+
+
+int y_frame_sink_write(yFrameSink *sink, yImage *frame)
+{
+    frame_sink_t *state;
+    struct iovec iov[2];
+    int count = 0;
+
+    if (sink == NULL || frame == NULL || frame->rgbWidth != sink->width || frame->rgbHeight != sink->height)
+        return 1;
+
+    state = sink->codec;
+    if (state->failed)
+        return 1;
+
+    switch (sink->format)
     {
-        for (y = 0; y < im->rgbHeight; y++)
+    case Y_FRAME_RGB24:
+        iov[count].iov_base = frame->rgbData;
+        iov[count++].iov_len = state->size;
+        break;
+    case Y_FRAME_RGBA:
         {
-            ptr2 = lines[y];
-            for (x = 0; x < im->rgbWidth; x++)
+            size_t pixels = (size_t) sink->width * sink->height, i;
+
+            for (i = 0; i < pixels; i++)
             {
-                r = *ptr2++;
-                *ptr++ = r;
-                *ptr++ = r;
-                *ptr++ = r;
+                state->buffer[4 * i] = frame->rgbData[3 * i];
+                state->buffer[4 * i + 1] = frame->rgbData[3 * i + 1];
+                state->buffer[4 * i + 2] = frame->rgbData[3 * i + 2];
+                state->buffer[4 * i + 3] = frame->alphaChanel != NULL ? frame->alphaChanel[i] : 255;
             }
         }
-    }
-
-    else
-    {
-        for (y = 0; y < im->rgbHeight; y++)
+        iov[count].iov_base = state->buffer;
+        iov[count++].iov_len = state->size;
+        break;
+    case Y_FRAME_Y4M:
         {
-            ptr2 = lines[y];
-            for (x = 0; x < im->rgbWidth; x++)
-            {
-                r = *ptr2++;
-                g = *ptr2++;
-                b = *ptr2++;
-                a = *ptr2++;
-
-                *ptr++ = r;
-                *ptr++ = g;
-                *ptr++ = b;
-                *ptrAlpha++=a;
-            }
+            size_t lumaSize = (size_t) sink->width * sink->height;
+            size_t chromaSize = (state->size - lumaSize) / 2;
+
+            convert_yuv420(frame, state->buffer, state->buffer + lumaSize, state->buffer + lumaSize + chromaSize);
         }
+        iov[count].iov_base = (char *) Y4M_FRAME_HEADER;
+        iov[count++].iov_len = strlen(Y4M_FRAME_HEADER);
+        iov[count].iov_base = state->buffer;
+        iov[count++].iov_len = state->size;
+        break;
     }
 
-    /* Freing memory */
-    for (i = 0; i < im->rgbHeight; i++) {
-        free(lines[i]);
+    if (write_vector(sink->fd, iov, count))
+    {
+        state->failed = 1;
+        return 1;
     }
-    free(lines);
 
-    /* End */
-    return im;
+    sink->frames++;
+    return 0;
+}
+
+
+int y_frame_sink_close(yFrameSink *sink)
+{
+    frame_sink_t *state;
+    int err;
+
+    if (sink == NULL)
+        return 1;
+
+    state = sink->codec;
+    err = state->failed;
+    free(state->buffer);
+    free(state);
+    free(sink);
+    return err;
 }
@@ -9,9 +9,14 @@
  * \file yImage_io.h
  * \brief Load and save yImage in differents formats.
  *
- * PPM read or write is available without the need of an extern library.
- * The use of PNG, JPEG or TIFF format needs the correspondant library
- * at build time.
+ * PPM and QOI read or write is available without the need of an extern
+ * library. PNG uses libpng when available, and a built-in codec
+ * otherwise. The use of JPEG or TIFF format needs the correspondant
+ * library at build time.
+ *
+ * Each format can also be encoded through a write callback (for example
+ * into a growable yBuffer) and decoded from a memory area, without any
+ * access to the filesystem.
  */
 
 #ifndef Y_IMAGE_IO_H_
@@ -21,16 +26,294 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "yImage.h"
+#include "yQuantize.h"
 
 
 /** default quality for JPEG compression : 80% (208/255) */
 #define DEFAULT_JPEG_QUALITY 208
 
 
+/**
+ * \brief Function used by the encoders to output their data.
+ * \param userData the pointer given to the encoder
+ * \param data the bytes to write
+ * \param length the number of bytes to write
+ * \return 0 in case of success
+ */
+typedef int (*yWriteCallback)(void *userData, const unsigned char *data, size_t length);
+
+
+/**
+ * \brief A growable memory buffer, to receive encoded images.
+ */
+typedef struct {
+    unsigned char *data; /**< \brief the buffer's content */
+    size_t size; /**< \brief number of bytes written in data */
+    size_t capacity; /**< \brief allocated size of data */
+} yBuffer;
+
+
+/** \brief PNG row filters, to combine in yPngOptions.filters */
+#define Y_PNG_FILTER_AUTO 0 /**< let the encoder choose the filters */
+#define Y_PNG_FILTER_NONE 0x01 /**< no filter */
+#define Y_PNG_FILTER_SUB 0x02 /**< difference with the left pixel */
+#define Y_PNG_FILTER_UP 0x04 /**< difference with the pixel above */
+#define Y_PNG_FILTER_AVG 0x08 /**< difference with the mean of left and above pixels */
+#define Y_PNG_FILTER_PAETH 0x10 /**< Paeth predictor */
+#define Y_PNG_FILTER_ALL 0x1F /**< all filters, the best one is chosen for each row */
+
+
+/**
+ * \brief Kinds of binary netpbm files.
+ */
+typedef enum {
+    Y_PNM_PPM=0, /**< P6 : RGB */
+    Y_PNM_PGM, /**< P5 : gray level, taken from the red channel */
+    Y_PNM_PAM /**< P7 : RGBA, with the tuple type RGB_ALPHA */
+} yPnmType;
+
+
+/**
+ * \brief Colour type of the PNG files.
+ */
+typedef enum {
+    Y_PNG_COLOR_AUTO=0, /**< the smallest colour type keeping all the image's information */
+    Y_PNG_COLOR_RGBA, /**< 8 bits red, green, blue and alpha */
+    Y_PNG_COLOR_RGB, /**< 8 bits red, green and blue : the alpha channel is dropped */
+    Y_PNG_COLOR_GRAY, /**< 8 bits gray level, taken from the red channel */
+    Y_PNG_COLOR_GRAY_ALPHA, /**< 8 bits gray level and alpha */
+    Y_PNG_COLOR_PALETTE /**< 1 to 8 bits indices in a palette of up to 256 RGBA colours. Opaque images with more colours are quantized to 256 colours, the others are written in RGBA. */
+} yPngColorType;
+
+
+/**
+ * \brief zlib compression strategies.
+ */
+typedef enum {
+    Y_PNG_STRATEGY_DEFAULT=0, /**< zlib's default strategy */
+    Y_PNG_STRATEGY_FILTERED, /**< tuned for filtered data */
+    Y_PNG_STRATEGY_HUFFMAN_ONLY, /**< no string matching, only Huffman coding */
+    Y_PNG_STRATEGY_RLE, /**< only matches at distance one : fast, good for flat areas */
+    Y_PNG_STRATEGY_FIXED /**< no dynamic Huffman codes */
+} yPngStrategy;
+
+
+/**
+ * \brief Settings of the PNG encoder.
+ *
+ * Use y_init_png_options() to get the defaults before changing some
+ * fields. The built-in codec, used without libpng, ignores the strategy :
+ * level 0 writes stored blocks, the other levels a fast run-length
+ * compression.
+ */
+typedef struct {
+    int compressionLevel; /**< zlib level, from 0 (no compression) to 9 (smallest), or -1 for zlib's default */
+    yPngStrategy strategy; /**< zlib strategy */
+    int filters; /**< Y_PNG_FILTER_AUTO or a combination of Y_PNG_FILTER_* flags */
+    yPngColorType colorType; /**< colour type of the file. In automatic mode, images with at most 256 colours are written with a palette. */
+    yDithering dithering; /**< dithering used when an image is quantized for Y_PNG_COLOR_PALETTE */
+    int threads; /**< number of compression threads, 0 for one by processor. With 1, or for small images, the image is encoded on the calling thread. */
+} yPngOptions;
+
+
+/**
+ * \brief Settings of the animated PNG encoder.
+ *
+ * Use y_init_apng_options() to get the defaults before changing some
+ * fields.
+ */
+typedef struct {
+    int delay; /**< display time of each frame, in milliseconds */
+    const int *delays; /**< display time of each frame, or NULL to use "delay" for all of them */
+    int loops; /**< number of times the animation is played, 0 to loop forever */
+    yPngOptions png; /**< compression of the frames. The colour type is ignored. */
+} yApngOptions;
+
+
+/**
+ * \brief Chroma subsampling of the JPEG files.
+ */
+typedef enum {
+    Y_JPEG_SUBSAMPLING_420=0, /**< chrominance halved in both directions (4:2:0) : the smallest files */
+    Y_JPEG_SUBSAMPLING_422, /**< chrominance halved horizontally (4:2:2) */
+    Y_JPEG_SUBSAMPLING_444 /**< full resolution chrominance (4:4:4) : sharp coloured edges */
+} yJpegSubsampling;
+
+
+/**
+ * \brief Settings of the JPEG encoder.
+ *
+ * Use y_init_jpeg_options() to get the defaults before changing some
+ * fields.
+ */
+typedef struct {
+    int quality; /**< from 1 (smallest) to 100 (best) */
+    yJpegSubsampling subsampling; /**< chroma subsampling */
+    int fastDct; /**< set to use the fast integer DCT, less accurate */
+    int optimizeCoding; /**< set to compute optimal Huffman tables : smaller files, slower encoding */
+    int progressive; /**< set to write a progressive JPEG, which also optimizes the Huffman tables */
+    int restartInterval; /**< number of MCU between restart markers, 0 for none */
+} yJpegOptions;
+
+
+/**
+ * \brief Compression of the TIFF files.
+ */
+typedef enum {
+    Y_TIFF_COMPRESSION_LZW=0, /**< LZW */
+    Y_TIFF_COMPRESSION_NONE, /**< no compression */
+    Y_TIFF_COMPRESSION_DEFLATE, /**< deflate (zlib), compressed on several threads */
+    Y_TIFF_COMPRESSION_ZSTD /**< Zstandard, if libtiff was built with it */
+} yTiffCompression;
+
+
+/**
+ * \brief Settings of the TIFF encoder.
+ *
+ * Use y_init_tiff_options() to get the defaults before changing some
+ * fields. Without libpng, the deflate compression is done by the
+ * built-in codec : level 0 writes stored blocks, the other levels a fast
+ * run-length compression.
+ */
+typedef struct {
+    yTiffCompression compression; /**< compression of the tiles or strips */
+    int level; /**< deflate level from 0 to 9, or Zstandard level from 1 to 22, -1 for the codec's default */
+    int predictor; /**< set to compress the horizontal differences of the samples : better for photos and elevation data */
+    int tileSize; /**< width and height of the tiles, rounded up to a multiple of 16, or 0 to write strips */
+    int bigTiff; /**< set to write a BigTIFF file, with 64 bits offsets, needed beyond 4 GiB */
+    int dropAlpha; /**< set to write only RGB. Otherwise, the alpha channel is written as an extra sample when some pixels are not opaque. */
+    int threads; /**< number of threads for the deflate compression, 0 for one by processor */
+} yTiffOptions;
+
+
+/**
+ * \brief Settings of the JPEG decoder.
+ *
+ * Use y_init_jpeg_read_options() to get the defaults before changing
+ * some fields.
+ */
+typedef struct {
+    int scaleDenom; /**< reduce the image by 1, 2, 4 or 8 while decoding it, which is faster than decoding the full size */
+    int fastIdct; /**< set to use the fast integer IDCT, less accurate */
+    int skipAlpha; /**< set to create the image without alpha channel (alphaChanel is NULL) */
+} yJpegReadOptions;
+
+
+/**
+ * \brief Image file formats.
+ */
+typedef enum {
+    Y_FORMAT_UNKNOWN=0, /**< not a supported format */
+    Y_FORMAT_PPM, /**< binary netpbm : PPM, PGM or PAM */
+    Y_FORMAT_PNG, /**< Portable Network Graphics */
+    Y_FORMAT_JPEG, /**< JPEG, needs libjpeg */
+    Y_FORMAT_TIFF, /**< TIFF, needs libtiff */
+    Y_FORMAT_QOI /**< Quite OK Image format */
+} yImageFormat;
+
+
+/**
+ * \brief Description of an image file, read from its header.
+ */
+typedef struct {
+    yImageFormat format; /**< the format of the file */
+    int width, height; /**< size of the image */
+    int channels; /**< samples by pixel : 1 (gray), 2 (gray and alpha), 3 (RGB or palette) or 4 (RGBA) */
+    int bitDepth; /**< bits by sample, or by palette index */
+} yImageInfo;
+
+
+/**
+ * \brief An image file read by bands of rows.
+ *
+ * Created by y_reader_open(). The fields must not be changed.
+ */
+typedef struct {
+    yImageFormat format; /**< \brief format of the file */
+    int width; /**< \brief width of the image */
+    int height; /**< \brief height of the image */
+    int hasAlpha; /**< \brief set if the file has an alpha channel */
+    int row; /**< \brief number of rows already read */
+    void *codec; /**< \brief state of the decoder */
+} yImageReader;
+
+
+/**
+ * \brief An image file written by bands of rows.
+ *
+ * Created by y_writer_open(). The fields must not be changed.
+ */
+typedef struct {
+    yImageFormat format; /**< \brief format of the file */
+    int width; /**< \brief width of the image */
+    int height; /**< \brief height of the image */
+    int hasAlpha; /**< \brief set if the alpha channel is written */
+    int row; /**< \brief number of rows already written */
+    void *codec; /**< \brief state of the encoder */
+} yImageWriter;
+
+
+/**
+ * \brief Formats of the frames written by a yFrameSink.
+ */
+typedef enum {
+    Y_FRAME_RGB24 = 0, /**< \brief raw RGB, 3 bytes by pixel, no header */
+    Y_FRAME_RGBA, /**< \brief raw RGBA, 4 bytes by pixel, no header */
+    Y_FRAME_Y4M /**< \brief YUV4MPEG2 stream, in YUV 4:2:0 */
+} yFrameFormat;
+
+
+/**
+ * \brief A stream of video frames written on a file descriptor.
+ *
+ * Created by y_frame_sink_open(). The fields must not be changed.
+ */
+typedef struct {
+    yFrameFormat format; /**< \brief format of the frames */
+    int fd; /**< \brief file descriptor written */
+    int width; /**< \brief width of the frames */
+    int height; /**< \brief height of the frames */
+    long frames; /**< \brief number of frames already written */
+    void *codec; /**< \brief buffers of the converted frames */
+} yFrameSink;
+
+
+// MEMORY BUFFERS
+
+/**
+ * \brief Init an empty buffer.
+ * \param buffer the struct to init
+ */
+void y_init_buffer(yBuffer *buffer);
+
+
+/**
+ * \brief Free the memory used by a buffer's content.
+ *
+ * The buffer is then empty and can be reused.
+ * \param buffer the buffer to release
+ */
+void y_release_buffer(yBuffer *buffer);
+
+
+/**
+ * \brief A yWriteCallback which appends the data to a yBuffer.
+ * \param buffer a pointer on the yBuffer to fill
+ * \param data the bytes to write
+ * \param length the number of bytes to write
+ * \return 0 in case of success or ERR_ALLOCATE_FAIL
+ */
+int y_buffer_write(void *buffer, const unsigned char *data, size_t length);
+
+
 // READING
 
 /**
- * \brief load an yImage from a binary ppm file.
+ * \brief load an yImage from a binary netpbm file.
+ *
+ * The PPM (P6), PGM (P5) and PAM (P7) files are read, with 1 to 4
+ * samples by pixel (gray, gray and alpha, RGB, RGBA). The samples of up
+ * to 16 bits are scaled to 8 bits.
  * \param file
  *            the filename for the data to read
  * \return a new yImage or NULL if the reading failed
@@ -38,6 +321,26 @@
 yImage *y_load_ppm(const char *file);
 
 
+/**
+ * \brief Map a binary ppm file in memory.
+ *
+ * The rgbData of the image points directly in the mapping of the file,
+ * when its pixels are 8 bits RGB (PPM, or PAM of depth 3). The other
+ * netpbm files are loaded with y_load_ppm(). The opening of a mapped file
+ * doesn't read the pixels, they are loaded by the system when first
+ * accessed. The image has no alpha channel. The mapping is private :
+ * the changes of the image are not written to the file. Without mmap
+ * support (build with HAVE_MMAP=no), the file is loaded with y_load_ppm().
+ * \param file
+ *            the filename for the data to read
+ * \param readOnly
+ *            set to map the pixels read-only : no memory is used for
+ *            copies of modified pages, but changing the image crashes
+ * \return a new yImage or NULL if the reading failed
+ */
+yImage *y_load_ppm_mmap(const char *file, int readOnly);
+
+
 /**
  * \brief Load an yImage from a png file
  * \param file
@@ -47,6 +350,129 @@ yImage *y_load_ppm(const char *file);
 yImage *y_load_png(const char *file);
 
 
+/**
+ * \brief Load an yImage from a JPEG file.
+ *
+ * Needs libjpeg library
+ * \param file
+ *            the filename for the data to read
+ * \return a new yImage or NULL if the reading failed
+ */
+yImage *y_load_jpeg(const char *file);
+
+
+/**
+ * \brief Load an yImage from a TIFF file.
+ *
+ * Needs the libtiff library. The 8 bits RGB and gray images, with or
+ * without alpha, are read by strips or tiles. The other kinds are
+ * converted by libtiff.
+ * \param file
+ *            the filename for the data to read
+ * \return a new yImage or NULL if the reading failed
+ */
+yImage *y_load_tiff(const char *file);
+
+
+/**
+ * \brief Init the JPEG decoder's settings with the default values.
+ *
+ * By default, the image is decoded at its full size with the accurate
+ * IDCT, and has an opaque alpha channel.
+ * \param options the struct to init
+ */
+void y_init_jpeg_read_options(yJpegReadOptions *options);
+
+
+/**
+ * \brief Load an yImage from a JPEG file, with specific settings.
+ *
+ * Needs libjpeg library
+ * \param file
+ *            the filename for the data to read
+ * \param options
+ *            the decoder's settings, or NULL for the defaults
+ * \return a new yImage or NULL if the reading failed
+ */
+yImage *y_load_jpeg_with_options(const char *file, yJpegReadOptions *options);
+
+
+/**
+ * \brief Decode an yImage from the content of a binary netpbm file (PPM,
+ * PGM or PAM, see y_load_ppm()).
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \return a new yImage or NULL if the decoding failed
+ */
+yImage *y_decode_ppm(const unsigned char *data, size_t size);
+
+
+/**
+ * \brief Decode an yImage from the content of a png file.
+ *
+ * Without libpng, the built-in codec is used.
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \return a new yImage or NULL if the decoding failed
+ */
+yImage *y_decode_png(const unsigned char *data, size_t size);
+
+
+/**
+ * \brief Decode an yImage from the content of a TIFF file.
+ *
+ * Needs the libtiff library
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \return a new yImage or NULL if the decoding failed
+ */
+yImage *y_decode_tiff(const unsigned char *data, size_t size);
+
+
+/**
+ * \brief Decode an yImage from the content of a JPEG file.
+ *
+ * Needs libjpeg library
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \return a new yImage or NULL if the decoding failed
+ */
+yImage *y_decode_jpeg(const unsigned char *data, size_t size);
+
+
+/**
+ * \brief Decode an yImage from the content of a JPEG file, with specific
+ * settings.
+ *
+ * Needs libjpeg library
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \param options the decoder's settings, or NULL for the defaults
+ * \return a new yImage or NULL if the decoding failed
+ */
+yImage *y_decode_jpeg_with_options(const unsigned char *data, size_t size, yJpegReadOptions *options);
+
+
+/**
+ * \brief Load an yImage from a QOI file.
+ *
+ * The file is decoded while it is read, without loading it entirely.
+ * \param file
+ *            the filename for the data to read
+ * \return a new yImage or NULL if the reading failed
+ */
+yImage *y_load_qoi(const char *file);
+
+
+/**
+ * \brief Decode an yImage from the content of a QOI file.
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \return a new yImage or NULL if the decoding failed
+ */
+yImage *y_decode_qoi(const unsigned char *data, size_t size);
+
+
 
 // WRITING
 
@@ -62,6 +488,37 @@ yImage *y_load_png(const char *file);
 int y_save_ppm(yImage *im, const char *file);
 
 
+/**
+ * \brief save "im" into "file" at binary ppm format, through a memory
+ * mapping.
+ *
+ * The file is created at its final size, then the pixels are copied in
+ * its mapping. Without mmap support (build with HAVE_MMAP=no), this is
+ * y_save_ppm().
+ * \param im
+ *            the image's data
+ * \param file
+ *            the filename of the file to create
+ * \return 0 in case of success
+ */
+int y_save_ppm_mmap(yImage *im, const char *file);
+
+
+/**
+ * \brief save "im" into "file" at a binary netpbm format.
+ * \param im
+ *            the image's data
+ * \param file
+ *            the filename of the file to create
+ * \param type
+ *            the kind of file : PPM, PGM or PAM
+ * \param bitDepth
+ *            8, or 16 for samples of 2 bytes (maxval 65535)
+ * \return 0 in case of success
+ */
+int y_save_pnm(yImage *im, const char *file, yPnmType type, int bitDepth);
+
+
 /**
  * \brief save "im" into "file" at JPEG format
  *
@@ -76,9 +533,32 @@ int y_save_jpeg(yImage *im, const char *file);
 
 
 /**
- * \brief save "im" into "file" at PNG format.
+ * \brief Init the JPEG encoder's settings with the default values.
+ *
+ * The defaults are the quality DEFAULT_JPEG_QUALITY, 4:2:0 subsampling,
+ * the accurate DCT and a baseline file with standard Huffman tables.
+ * \param options the struct to init
+ */
+void y_init_jpeg_options(yJpegOptions *options);
+
+
+/**
+ * \brief save "im" into "file" at JPEG format, with specific settings.
  *
- * Needs libpng library
+ * Needs libjpeg library
+ * \param im
+ *            the image's data
+ * \param file
+ *            the filename of the file to create
+ * \param options
+ *            the encoder's settings, or NULL for the defaults
+ * \return 0 in case of success
+ */
+int y_save_jpeg_with_options(yImage *im, const char *file, yJpegOptions *options);
+
+
+/**
+ * \brief save "im" into "file" at PNG format.
  * \param im
  *            the image's data
  * \param file
@@ -88,6 +568,59 @@ int y_save_jpeg(yImage *im, const char *file);
 int y_save_png(yImage *im, const char *file);
 
 
+/**
+ * \brief Init the PNG encoder's settings with the default values.
+ *
+ * The defaults are zlib's default level and strategy, automatic
+ * filters and automatic colour type.
+ * \param options the struct to init
+ */
+void y_init_png_options(yPngOptions *options);
+
+
+/**
+ * \brief save "im" into "file" at PNG format, with specific settings.
+ * \param im
+ *            the image's data
+ * \param file
+ *            the filename of the file to create
+ * \param options
+ *            the encoder's settings, or NULL for the defaults
+ * \return 0 in case of success
+ */
+int y_save_png_with_options(yImage *im, const char *file, yPngOptions *options);
+
+
+/**
+ * \brief Init the animated PNG encoder's settings with the default values.
+ *
+ * The defaults are 100 ms by frame, an endless loop and the default PNG
+ * settings.
+ * \param options the struct to init
+ */
+void y_init_apng_options(yApngOptions *options);
+
+
+/**
+ * \brief save a sequence of images into "file" as an animated PNG (APNG).
+ *
+ * Each frame only stores the bounding rectangle of the pixels changed
+ * since the previous frame, drawn over it (the APNG disposal "none"),
+ * so that the size and the encoding time depend on the moving part of
+ * the scene. A frame identical to the previous one lengthens its display
+ * time. The frames are written in RGB, or in RGBA when some of them have
+ * transparent pixels. Viewers without APNG support show the first frame.
+ * \param frames the images, all of the same size
+ * \param nbFrames the number of images
+ * \param file
+ *            the filename of the file to create
+ * \param options
+ *            the encoder's settings, or NULL for the defaults
+ * \return 0 in case of success
+ */
+int y_save_apng(yImage **frames, int nbFrames, const char *file, yApngOptions *options);
+
+
 
 /**
  * \brief save "im" in "file" at the TIFF format.
@@ -102,5 +635,399 @@ int y_save_png(yImage *im, const char *file);
 int y_save_tiff(yImage *im, const char *file);
 
 
+/**
+ * \brief Init the TIFF encoder's settings with the default values.
+ *
+ * The defaults are LZW strips without predictor, in a classic TIFF file.
+ * \param options the struct to init
+ */
+void y_init_tiff_options(yTiffOptions *options);
+
+
+/**
+ * \brief save "im" in "file" at the TIFF format, with specific settings.
+ *
+ * Needs the libtiff library.
+ * \param im
+ *            the image's data
+ * \param file
+ *            the filename of the file to create
+ * \param options
+ *            the encoder's settings, or NULL for the defaults
+ * \return 0 in case of success
+ */
+int y_save_tiff_with_options(yImage *im, const char *file, yTiffOptions *options);
+
+
+/**
+ * \brief save "im" into "file" at QOI format.
+ *
+ * QOI is a simple lossless format, much faster to encode and decode than
+ * PNG, but less compact. It keeps the alpha channel.
+ * \param im
+ *            the image's data
+ * \param file
+ *            the filename of the file to create
+ * \return 0 in case of success, 3 if the writing failed, 4 if the
+ * memory allocation failed, 5 if the file could not be created
+ */
+int y_save_qoi(yImage *im, const char *file);
+
+
+/**
+ * \brief Encode "im" at binary ppm format.
+ * \param im
+ *            the image's data
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_ppm(yImage *im, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at a binary netpbm format.
+ * \param im
+ *            the image's data
+ * \param type
+ *            the kind of file : PPM, PGM or PAM
+ * \param bitDepth
+ *            8, or 16 for samples of 2 bytes (maxval 65535)
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_pnm(yImage *im, yPnmType type, int bitDepth, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at JPEG format.
+ *
+ * Needs libjpeg library
+ * \param im
+ *            the image's data
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_jpeg(yImage *im, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at JPEG format, with specific settings.
+ *
+ * Needs libjpeg library
+ * \param im
+ *            the image's data
+ * \param options
+ *            the encoder's settings, or NULL for the defaults
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_jpeg_with_options(yImage *im, yJpegOptions *options, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at PNG format.
+ * \param im
+ *            the image's data
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_png(yImage *im, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at PNG format, with specific settings.
+ * \param im
+ *            the image's data
+ * \param options
+ *            the encoder's settings, or NULL for the defaults
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_png_with_options(yImage *im, yPngOptions *options, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode a sequence of images as an animated PNG, see y_save_apng().
+ * \param frames the images, all of the same size
+ * \param nbFrames the number of images
+ * \param options the encoder's settings, or NULL for the defaults
+ * \param write the function receiving the data
+ * \param userData the first parameter given to write
+ * \return 0 in case of success
+ */
+int y_encode_apng(yImage **frames, int nbFrames, yApngOptions *options, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at TIFF format.
+ *
+ * Needs the libtiff library. As TIFF writing needs to seek backward, the
+ * whole file is built in memory before being given to "write".
+ * \param im
+ *            the image's data
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_tiff(yImage *im, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at TIFF format, with specific settings.
+ *
+ * Needs the libtiff library. The whole file is built in memory before
+ * being given to "write".
+ * \param im
+ *            the image's data
+ * \param options
+ *            the encoder's settings, or NULL for the defaults
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success
+ */
+int y_encode_tiff_with_options(yImage *im, yTiffOptions *options, yWriteCallback write, void *userData);
+
+
+/**
+ * \brief Encode "im" at QOI format.
+ *
+ * The data is given to "write" by blocks of 64 KiB while the rows are
+ * encoded.
+ * \param im
+ *            the image's data
+ * \param write
+ *            the function to call with the encoded data
+ * \param userData
+ *            the pointer to give to "write"
+ * \return 0 in case of success, 3 if "write" failed, 4 if the memory
+ * allocation failed
+ */
+int y_encode_qoi(yImage *im, yWriteCallback write, void *userData);
+
+
+// STREAMING
+
+/**
+ * \brief Open an image file to read it by bands of rows.
+ *
+ * The format is detected from the content of the file. The rows are
+ * decoded when y_read_rows() asks for them, so that images larger than
+ * the memory can be processed. Interlaced PNG files, PNG files without
+ * libpng and TIFF files which are not made of 8 bits RGB or gray strips
+ * are however decoded entirely by this function.
+ * \param file the filename of the image
+ * \return a new reader, to release with y_reader_close(), or NULL if
+ * the file is not a readable image
+ */
+yImageReader *y_reader_open(const char *file);
+
+
+/**
+ * \brief Read the next rows of an image.
+ * \param reader the opened image
+ * \param band the image receiving the rows, from its first row. Its
+ * width must be the width of the file, and its height at least "nbRows".
+ * If it has no alpha channel, the alpha of the file is dropped.
+ * \param nbRows the number of rows to read
+ * \return the number of rows read, less than nbRows at the end of the
+ * image, or -1 in case of error
+ */
+int y_read_rows(yImageReader *reader, yImage *band, int nbRows);
+
+
+/**
+ * \brief Load a reduced copy of an image file.
+ *
+ * The image is reduced to fit in maxWidth x maxHeight, keeping its
+ * aspect ratio : each pixel of the thumbnail is the average of a box of
+ * pixels of the file, weighted by their alpha. The rows are read by
+ * bands and accumulated, without loading the full size image (see
+ * y_reader_open() for the exceptions). The JPEG files are first
+ * reduced by 2, 4 or 8 by libjpeg, with its fast IDCT. Images smaller
+ * than the box are not enlarged.
+ * \param file the filename of the image
+ * \param maxWidth the maximum width of the thumbnail
+ * \param maxHeight the maximum height of the thumbnail
+ * \return a new yImage or NULL if the reading failed
+ */
+yImage *y_load_thumbnail(const char *file, int maxWidth, int maxHeight);
+
+
+/**
+ * \brief Load a rectangle of an image file.
+ *
+ * The region is clipped to the image. Only the needed part of the file
+ * is decoded : the PPM, PGM and PAM files are read by seeking to the
+ * pixels of each row of the region, the TIFF files by reading the tiles
+ * or strips crossing the region (except for the layouts converted by
+ * libtiff). The other files are decoded by bands of rows up to the end
+ * of the region, and the rows before it are discarded.
+ * \param file the filename of the image
+ * \param x the left column of the region
+ * \param y the top row of the region
+ * \param width the width of the region
+ * \param height the height of the region
+ * \return a new yImage or NULL if the reading failed or the region is
+ * outside of the image
+ */
+yImage *y_load_region(const char *file, int x, int y, int width, int height);
+
+
+/**
+ * \brief Close an image file and release its reader.
+ * \param reader the reader to release, may be NULL
+ */
+void y_reader_close(yImageReader *reader);
+
+
+/**
+ * \brief Create an image file to write it by bands of rows.
+ *
+ * The rows are encoded as y_write_rows() gives them. The PNG files are
+ * written in RGB or RGBA, the JPEG files with the default quality.
+ * \param file the filename of the file to create
+ * \param format the format of the file
+ * \param width the width of the image
+ * \param height the height of the image
+ * \param hasAlpha set to write the alpha channel, if the format has one
+ * (PNG, TIFF and QOI)
+ * \return a new writer, to release with y_writer_close(), or NULL in
+ * case of error
+ */
+yImageWriter *y_writer_open(const char *file, yImageFormat format, int width, int height, int hasAlpha);
+
+
+/**
+ * \brief Write the next rows of an image.
+ * \param writer the opened file
+ * \param band the image giving the rows, from its first row. Its width
+ * must be the width of the file.
+ * \param nbRows the number of rows to write, at most the number of rows
+ * still to write
+ * \return 0 in case of success
+ */
+int y_write_rows(yImageWriter *writer, yImage *band, int nbRows);
+
+
+/**
+ * \brief Finish an image file and release its writer.
+ * \param writer the writer to release
+ * \return 0 if all the rows were written and the file is complete
+ */
+int y_writer_close(yImageWriter *writer);
+
+
+/**
+ * \brief Describe an image file, reading only its header.
+ *
+ * The format is found from the first bytes of the file, whatever its
+ * name. No codec library is needed : the files are recognized even when
+ * the library can't decode them.
+ * \param file the filename of the image
+ * \param info to return the description
+ * \return 0 in case of success, 1 if the file can't be read or its
+ * format is unknown (info->format is then Y_FORMAT_UNKNOWN)
+ */
+int y_probe(const char *file, yImageInfo *info);
+
+
+/**
+ * \brief Describe an image from the beginning of its file in memory.
+ *
+ * See y_probe(). For JPEG and TIFF files, the data must go up to the
+ * start of frame segment or to the end of the first directory.
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \param info to return the description
+ * \return 0 in case of success
+ */
+int y_probe_buffer(const unsigned char *data, size_t size, yImageInfo *info);
+
+
+/**
+ * \brief Load an image file, whatever its format.
+ *
+ * The format is found from the first bytes of the file.
+ * \param file the filename of the image
+ * \return a new yImage or NULL if the reading failed or the format is
+ * unknown or not supported by the build
+ */
+yImage *y_load_image(const char *file);
+
+
+/**
+ * \brief Decode an image file in memory, whatever its format.
+ * \param data the file's content
+ * \param size the number of bytes in data
+ * \return a new yImage or NULL if the decoding failed or the format is
+ * unknown or not supported by the build
+ */
+yImage *y_decode_image(const unsigned char *data, size_t size);
+
+
+// FRAME STREAMING
+
+/**
+ * \brief Start a stream of frames, for example to pipe them to a video
+ * encoder.
+ *
+ * Each frame is sent with a single writev() of its header and pixels,
+ * without temporary files. The raw formats match the rawvideo formats
+ * rgb24 and rgba of ffmpeg. The Y4M stream uses the BT.601 limited range,
+ * with each chroma sample averaged on 2x2 pixels. The descriptor is not
+ * closed by the sink. Writing to a closed pipe raises SIGPIPE, which the
+ * caller may ignore to get an error instead.
+ * \param fd the file descriptor to write (a file, a pipe or a socket)
+ * \param format the format of the frames
+ * \param width the width of the frames
+ * \param height the height of the frames
+ * \param fpsNum numerator of the frame rate, written in the Y4M header
+ * \param fpsDen denominator of the frame rate
+ * \return a new sink, to release with y_frame_sink_close(), or NULL in
+ * case of error
+ */
+yFrameSink *y_frame_sink_open(int fd, yFrameFormat format, int width, int height, int fpsNum, int fpsDen);
+
+
+/**
+ * \brief Write the next frame.
+ * \param sink the opened stream
+ * \param frame the image to write, of the size of the stream. Without
+ * alpha channel, the RGBA frames are opaque.
+ * \return 0 in case of success
+ */
+int y_frame_sink_write(yFrameSink *sink, yImage *frame);
+
+
+/**
+ * \brief Release a stream of frames, without closing its descriptor.
+ * \param sink the sink to release
+ * \return 0 if all the frames were written
+ */
+int y_frame_sink_close(yFrameSink *sink);
+
+
 
 #endif
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yQuantize.c
+ * \brief colour quantization : reduce an image to a palette of colours.
+ *
+ * The colours are first counted in a histogram of 32x32x32 bins (5 bits
+ * by channel). Median cut splits the set of bins in boxes, each box
+ * giving a colour of the palette. The k-means iterations then move each
+ * colour to the mean of the bins which are nearest to it.
+ */
+
+#include "yQuantize.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/** number of bits by channel in the histogram and the lookup table */
+#define HIST_BITS 5
+#define HIST_SIDE (1 << HIST_BITS)
+#define HIST_SIZE (HIST_SIDE * HIST_SIDE * HIST_SIDE)
+
+/** number of k-means iterations */
+#define KMEANS_ITERATIONS 4
+
+/** value of the lookup table's cells not computed yet */
+#define LUT_EMPTY 0xFFFF
+
+#define HIST_INDEX(r, g, b) ((((r) >> (8-HIST_BITS)) << (2*HIST_BITS)) | \
+    (((g) >> (8-HIST_BITS)) << HIST_BITS) | ((b) >> (8-HIST_BITS)))
+
+
+
+/************************************************************/
+/*                   HISTOGRAM                              */
+/************************************************************/
+
+
+/** a non empty bin of the histogram */
+typedef struct {
+    unsigned char c[3]; /**< bin coordinates (5 bits values) */
+    unsigned char mean[3]; /**< mean colour of the pixels in the bin */
+    uint32_t count; /**< number of pixels */
+} quant_bin_t;
+
+
+/**
+ * Build the list of the non empty bins.
+ * \return the number of bins, or ERR_ALLOCATE_FAIL
+ */
+static int build_histogram(yImage *im, quant_bin_t **binsOut) {
+
+    uint32_t *counts;
+    uint32_t (*sums)[3];
+    quant_bin_t *bins;
+    int i, nbBins = 0;
+    int n = im->rgbWidth * im->rgbHeight;
+
+    counts = calloc(HIST_SIZE, sizeof(uint32_t));
+    sums = calloc(HIST_SIZE, sizeof(*sums));
+    if(counts == NULL || sums == NULL) {
+        free(counts);
+        free(sums);
+        return ERR_ALLOCATE_FAIL;
+    }
+
+    for(i=0; i<n; i++) {
+        const unsigned char *rgb = im->rgbData + 3*i;
+        int h = HIST_INDEX(rgb[0], rgb[1], rgb[2]);
+        counts[h]++;
+        sums[h][0] += rgb[0];
+        sums[h][1] += rgb[1];
+        sums[h][2] += rgb[2];
+    }
+
+    for(i=0; i<HIST_SIZE; i++) {
+        if(counts[i]) nbBins++;
+    }
+
+    bins = malloc((nbBins > 0 ? nbBins : 1) * sizeof(quant_bin_t));
+    if(bins == NULL) {
+        free(counts);
+        free(sums);
+        return ERR_ALLOCATE_FAIL;
+    }
+
+    nbBins = 0;
+    for(i=0; i<HIST_SIZE; i++) {
+        if(counts[i]) {
+            quant_bin_t *bin = bins + nbBins++;
+            int k;
+            bin->c[0] = i >> (2*HIST_BITS);
+            bin->c[1] = (i >> HIST_BITS) & (HIST_SIDE-1);
+            bin->c[2] = i & (HIST_SIDE-1);
+            for(k=0; k<3; k++) {
+                bin->mean[k] = (sums[i][k] + counts[i]/2) / counts[i];
+            }
+            bin->count = counts[i];
+        }
+    }
+
+    free(counts);
+    free(sums);
+
+    *binsOut = bins;
+    return nbBins;
+}
+
+
+
+/************************************************************/
+/*                   MEDIAN CUT                             */
+/************************************************************/
+
+
+/** a box of the median cut : the bins [first, last[ */
+typedef struct {
+    int first, last;
+    unsigned char min[3], max[3];
+    uint32_t count;
+} quant_box_t;
+
+
+static void shrink_box(quant_box_t *box, quant_bin_t *bins) {
+
+    int i, k;
+
+    for(k=0; k<3; k++) {
+        box->min[k] = HIST_SIDE-1;
+        box->max[k] = 0;
+    }
+    box->count = 0;
+
+    for(i=box->first; i<box->last; i++) {
+        for(k=0; k<3; k++) {
+            if(bins[i].c[k] < box->min[k]) box->min[k] = bins[i].c[k];
+            if(bins[i].c[k] > box->max[k]) box->max[k] = bins[i].c[k];
+        }
+        box->count += bins[i].count;
+    }
+}
+
+
+/** \return the longest axis of a box */
+static int box_axis(quant_box_t *box) {
+
+    int k, axis = 0;
+
+    for(k=1; k<3; k++) {
+        if(box->max[k] - box->min[k] > box->max[axis] - box->min[axis]) axis = k;
+    }
+
+    return axis;
+}
+
+
+/** sort the bins of a box along an axis (counting sort on 5 bits values) */
+static void sort_box(quant_box_t *box, quant_bin_t *bins, quant_bin_t *tmp, int axis) {
+
+    int start[HIST_SIDE + 1];
+    int i;
+
+    memset(start, 0, sizeof(start));
+    for(i=box->first; i<box->last; i++) start[bins[i].c[axis] + 1]++;
+    for(i=0; i<HIST_SIDE; i++) start[i+1] += start[i];
+    for(i=box->first; i<box->last; i++) tmp[start[bins[i].c[axis]]++] = bins[i];
+    memcpy(bins + box->first, tmp, (box->last - box->first) * sizeof(quant_bin_t));
+}
+
+
+/**
+ * Split the bins in at most "maxColors" boxes.
+ * \return the number of boxes
+ */
+static int median_cut(quant_bin_t *bins, int nbBins, quant_box_t *boxes, int maxColors) {
+
+    quant_bin_t *tmp;
+    int nbBoxes = 1;
+
+    tmp = malloc(nbBins * sizeof(quant_bin_t));
+    if(tmp == NULL) return ERR_ALLOCATE_FAIL;
+
+    boxes[0].first = 0;
+    boxes[0].last = nbBins;
+    shrink_box(boxes, bins);
+
+    while(nbBoxes < maxColors) {
+
+        quant_box_t *box = NULL;
+        uint64_t best = 0;
+        uint32_t half, acc;
+        int i, axis, cut;
+
+        /* split the box with the most pixels along the longest side */
+        for(i=0; i<nbBoxes; i++) {
+            int a = box_axis(boxes+i);
+            uint64_t score = (uint64_t) boxes[i].count * (boxes[i].max[a] - boxes[i].min[a]);
+            if(boxes[i].last - boxes[i].first > 1 && score > best) {
+                best = score;
+                box = boxes + i;
+            }
+        }
+
+        if(box == NULL) break;
+
+        axis = box_axis(box);
+        sort_box(box, bins, tmp, axis);
+
+        half = box->count / 2;
+        acc = 0;
+        for(cut=box->first; cut<box->last-1; cut++) {
+            acc += bins[cut].count;
+            if(acc >= half) break;
+        }
+        cut++;
+
+        boxes[nbBoxes].first = cut;
+        boxes[nbBoxes].last = box->last;
+        box->last = cut;
+        shrink_box(box, bins);
+        shrink_box(boxes+nbBoxes, bins);
+        nbBoxes++;
+    }
+
+    free(tmp);
+    return nbBoxes;
+}
+
+
+
+/************************************************************/
+/*                   NEAREST COLOUR                         */
+/************************************************************/
+
+
+static int nearest_color(const uint8_t *palette, int nbColors, int r, int g, int b) {
+
+    int i, best = 0;
+    int bestDist = 3*256*256;
+
+    for(i=0; i<nbColors; i++) {
+        int dr = palette[3*i] - r;
+        int dg = palette[3*i+1] - g;
+        int db = palette[3*i+2] - b;
+        int dist = dr*dr + dg*dg + db*db;
+        if(dist < bestDist) {
+            bestDist = dist;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+
+/** lookup table of the nearest colour, by cells of the RGB cube */
+typedef struct {
+    const uint8_t *palette;
+    int nbColors;
+    unsigned short cells[HIST_SIZE];
+} nearest_lut_t;
+
+
+static nearest_lut_t *create_lut(const uint8_t *palette, int nbColors) {
+
+    nearest_lut_t *lut = malloc(sizeof(nearest_lut_t));
+    if(lut == NULL) return NULL;
+
+    lut->palette = palette;
+    lut->nbColors = nbColors;
+    memset(lut->cells, 0xFF, sizeof(lut->cells));
+    return lut;
+}
+
+
+static int lut_lookup(nearest_lut_t *lut, int r, int g, int b) {
+
+    int h = HIST_INDEX(r, g, b);
+
+    if(lut->cells[h] == LUT_EMPTY) {
+        /* the nearest colour of the cell's center */
+        int half = 1 << (7-HIST_BITS);
+        lut->cells[h] = nearest_color(lut->palette, lut->nbColors,
+            (r & ~(2*half-1)) + half, (g & ~(2*half-1)) + half, (b & ~(2*half-1)) + half);
+    }
+
+    return lut->cells[h];
+}
+
+
+
+/************************************************************/
+/*                   PALETTE                                */
+/************************************************************/
+
+
+/** move each colour to the mean of the bins for which it is the nearest */
+static void refine_palette(quant_bin_t *bins, int nbBins, uint8_t *palette, int nbColors) {
+
+    uint64_t (*sums)[4];
+    int iteration, i, k;
+
+    sums = malloc(nbColors * sizeof(*sums));
+    if(sums == NULL) return;
+
+    for(iteration=0; iteration<KMEANS_ITERATIONS; iteration++) {
+
+        memset(sums, 0, nbColors * sizeof(*sums));
+
+        for(i=0; i<nbBins; i++) {
+            int c = nearest_color(palette, nbColors, bins[i].mean[0], bins[i].mean[1], bins[i].mean[2]);
+            for(k=0; k<3; k++) sums[c][k] += (uint64_t) bins[i].mean[k] * bins[i].count;
+            sums[c][3] += bins[i].count;
+        }
+
+        for(i=0; i<nbColors; i++) {
+            if(sums[i][3] == 0) continue;
+            for(k=0; k<3; k++) {
+                palette[3*i+k] = (sums[i][k] + sums[i][3]/2) / sums[i][3];
+            }
+        }
+    }
+
+    free(sums);
+}
+
+
+int y_quantize_palette(yImage *im, yColorPalette_t palette, int maxColors) {
+
+    quant_bin_t *bins = NULL;
+    quant_box_t *boxes;
+    int nbBins, nbColors, i;
+
+    if(palette == NULL) return ERR_NULL_PALETTE;
+    if(im == NULL) return ERR_NULL_COLOR;
+    if(maxColors < 1) maxColors = 1;
+    if(maxColors > 256) maxColors = 256;
+
+    memset(palette, 0, sizeof(yColorPalette_t));
+
+    nbBins = build_histogram(im, &bins);
+    if(nbBins < 0) return nbBins;
+    if(nbBins == 0) {
+        free(bins);
+        return 1;
+    }
+
+    boxes = malloc(maxColors * sizeof(quant_box_t));
+    if(boxes == NULL) {
+        free(bins);
+        return ERR_ALLOCATE_FAIL;
+    }
+
+    nbColors = median_cut(bins, nbBins, boxes, maxColors);
+
+    for(i=0; i<nbColors; i++) {
+        uint64_t sums[3] = {0, 0, 0};
+        int j, k;
+        for(j=boxes[i].first; j<boxes[i].last; j++) {
+            for(k=0; k<3; k++) sums[k] += (uint64_t) bins[j].mean[k] * bins[j].count;
+        }
+        for(k=0; k<3; k++) {
+            palette[3*i+k] = (sums[k] + boxes[i].count/2) / boxes[i].count;
+        }
+    }
+
+    if(nbColors > 0) refine_palette(bins, nbBins, palette, nbColors);
+
+    free(boxes);
+    free(bins);
+    return nbColors;
+}
+
+
+
+/************************************************************/
+/*                   MAPPING                                */
+/************************************************************/
+
+
+static const unsigned char bayer8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+
+static int clamp255(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+
+static void map_ordered(yImage *im, nearest_lut_t *lut, unsigned char *indices) {
+
+    int x, y;
+    int spread = 256;
+
+    /* about the distance between two colours of the palette */
+    while(spread > 8 && (256/spread)*(256/spread)*(256/spread) < lut->nbColors) spread /= 2;
+
+    for(y=0; y<im->rgbHeight; y++) {
+        const unsigned char *rgb = im->rgbData + (size_t) 3*y*im->rgbWidth;
+        unsigned char *out = indices + (size_t) y*im->rgbWidth;
+
+        for(x=0; x<im->rgbWidth; x++, rgb+=3) {
+            int offset = (bayer8[y&7][x&7] - 32) * spread / 64;
+            out[x] = lut_lookup(lut, clamp255(rgb[0]+offset), clamp255(rgb[1]+offset), clamp255(rgb[2]+offset));
+        }
+    }
+}
+
+
+/** Floyd-Steinberg error diffusion, with a serpentine scan */
+static int map_floyd_steinberg(yImage *im, nearest_lut_t *lut, unsigned char *indices) {
+
+    int w = im->rgbWidth;
+    int *errors, *current, *next;
+    int x, y, k;
+
+    /* errors of the current and next rows, scaled by 16, with a pixel of margin on each side */
+    errors = calloc(2 * 3 * (w + 2), sizeof(int));
+    if(errors == NULL) return ERR_ALLOCATE_FAIL;
+
+    current = errors;
+    next = errors + 3 * (w + 2);
+
+    for(y=0; y<im->rgbHeight; y++) {
+        int dir = (y & 1) ? -1 : 1;
+        int *tmp;
+
+        memset(next, 0, 3 * (w + 2) * sizeof(int));
+
+        for(x = (dir > 0 ? 0 : w-1); x >= 0 && x < w; x += dir) {
+            const unsigned char *rgb = im->rgbData + (size_t) 3*(y*w + x);
+            const uint8_t *color;
+            int value[3], index;
+            int *e = current + 3*(x+1);
+            int *n = next + 3*(x+1);
+
+            for(k=0; k<3; k++) value[k] = clamp255(rgb[k] + (e[k] + 8) / 16);
+
+            index = lut_lookup(lut, value[0], value[1], value[2]);
+            indices[(size_t) y*w + x] = index;
+            color = lut->palette + 3*index;
+
+            for(k=0; k<3; k++) {
+                int err = value[k] - color[k];
+                e[3*dir + k] += err * 7;
+                n[-3*dir + k] += err * 3;
+                n[k] += err * 5;
+                n[3*dir + k] += err;
+            }
+        }
+
+        tmp = current;
+        current = next;
+        next = tmp;
+    }
+
+    free(errors);
+    return 0;
+}
+
+
+int y_map_to_palette(yImage *im, yColorPalette_t palette, int nbColors, yDithering dithering, unsigned char *indices) {
+
+    nearest_lut_t *lut;
+    int err = 0;
+
+    if(palette == NULL) return ERR_NULL_PALETTE;
+    if(im == NULL || indices == NULL) return ERR_NULL_COLOR;
+    if(nbColors < 1 || nbColors > 256) return ERR_BAD_INDEX;
+
+    lut = create_lut(palette, nbColors);
+    if(lut == NULL) return ERR_ALLOCATE_FAIL;
+
+    switch(dithering) {
+    case Y_DITHER_FLOYD_STEINBERG:
+        err = map_floyd_steinberg(im, lut, indices);
+        break;
+    case Y_DITHER_ORDERED:
+        map_ordered(im, lut, indices);
+        break;
+    default:
+        {
+            size_t i, n = (size_t) im->rgbWidth * im->rgbHeight;
+            const unsigned char *rgb = im->rgbData;
+            for(i=0; i<n; i++, rgb+=3) {
+                indices[i] = lut_lookup(lut, rgb[0], rgb[1], rgb[2]);
+            }
+        }
+    }
+
+    free(lut);
+    return err;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yQuantize.h
+ * \brief colour quantization : reduce an image to a palette of colours.
+ *
+ * The palette of an image is computed by median cut, then refined by a
+ * few k-means iterations. The pixels are then mapped to the palette,
+ * with an optional dithering. Only the red, green and blue levels are
+ * taken into account : the alpha channel is ignored.
+ */
+
+#ifndef Y_QUANTIZE_H_
+#define Y_QUANTIZE_H_
+
+#include "yColor.h"
+#include "yImage.h"
+
+
+/**
+ * \brief Dithering methods used when mapping an image to a palette.
+ */
+typedef enum {
+    Y_DITHER_NONE=0, /**< each pixel takes the nearest colour */
+    Y_DITHER_FLOYD_STEINBERG, /**< error diffusion */
+    Y_DITHER_ORDERED /**< 8x8 Bayer matrix */
+} yDithering;
+
+
+/**
+ * \brief Compute a palette representing the colours of an image.
+ * \param im the image to analyse
+ * \param palette the palette to fill. The unused entries are set to black.
+ * \param maxColors the maximum number of colours, between 1 and 256
+ * \return the number of colours in the palette, or a negative error code
+ */
+int y_quantize_palette(yImage *im, yColorPalette_t palette, int maxColors);
+
+
+/**
+ * \brief Give for each pixel of an image the index of its colour in a
+ * palette.
+ *
+ * The nearest colour is found with a lookup table of 32x32x32 cells,
+ * filled when a cell is used for the first time.
+ * \param im the image to convert
+ * \param palette the palette to use
+ * \param nbColors the number of colours in the palette
+ * \param dithering the dithering method
+ * \param indices an array of width*height bytes to fill with the indices
+ * \return 0 in case of success, or a negative error code
+ */
+int y_map_to_palette(yImage *im, yColorPalette_t palette, int nbColors, yDithering dithering, unsigned char *indices);
+
+
+#endif
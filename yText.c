@@ -11,6 +11,7 @@
  */
 
 #include "yText.h"
+#include "yTransform.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -188,44 +189,19 @@ int y_display_text_with_font_and_color(yImage *background, int x, int y, char *t
 }
 
 
-static yImage *rotate_90_degrees(yImage *input) {
-
-    int i, j;
-    int err;
-    yImage *rotated = y_create_image(&err, NULL, input->rgbHeight, input->rgbWidth);
-    if(input->hasShapeColor) {
-        rotated->hasShapeColor = 1;
-        rotated->shapeColor = input->shapeColor;
-    }
-
-    for(i=0; i<input->rgbWidth; i++) {
-        for(j=0; j<input->rgbHeight; j++) {
-            int oPos = j + (rotated->rgbHeight - 1 - i)*rotated->rgbWidth;
-            int iPos = i + j*input->rgbWidth;
-            rotated->rgbData[3*oPos] = input->rgbData[3*iPos];
-            rotated->rgbData[3*oPos+1] = input->rgbData[3*iPos+1];
-            rotated->rgbData[3*oPos+2] = input->rgbData[3*iPos+2];
-            rotated->alphaChanel[oPos] = input->alphaChanel[iPos]; 
-        }
-    }
-
-    return rotated;
-}
-
-
 int y_display_text_vertically_with_font_and_color(yImage *background, int x, int y, char *text, font_t *font, yColor *color){
 
     yImage *textIm;
-    yImage *rotatedTextIm;
+    int err;
+
     textIm=y_create_text(font, text, color);
 
     if(textIm==NULL) return 0;
 
-    rotatedTextIm = rotate_90_degrees(textIm);
+    err = y_rotate90(textIm);
+    if(err == 0) y_superpose_images(background, textIm, x, y);
     y_destroy_image(textIm);
-    y_superpose_images(background, rotatedTextIm, x, y);
-    y_destroy_image(rotatedTextIm);
-    return 0;
+    return err;
 }
 
 int y_display_text_vertically_with_font(yImage *background, int x, int y, char *text, font_t *font){
@@ -252,3 +228,350 @@ int y_display_font_char_with_color(yImage *background, int x, int y, int index,
     return 0;
 }
 
+
+
+
+/************************************************************/
+/*                    LABELS PLACEMENT                      */
+/************************************************************/
+
+
+/** a label's box, in image coordinates (max values are excluded) */
+typedef struct {
+    int xMin, yMin, xMax, yMax;
+} label_box_t;
+
+
+/**
+ * Uniform grid used to find quickly the accepted labels near a box.
+ * Each cell contains a linked list of the boxes which intersect it.
+ */
+typedef struct {
+    int cellSize;
+    int nbColumns, nbRows;
+    int *heads; /**< first entry of each cell, or -1 */
+    int *next; /**< next entry in the same cell, or -1 */
+    int *boxIndex; /**< label's index for each entry */
+    int nbEntries, capacity;
+} label_grid_t;
+
+
+static int init_grid(label_grid_t *grid, int width, int height, int cellSize) {
+
+    int i;
+
+    grid->cellSize = cellSize;
+    grid->nbColumns = width / cellSize + 1;
+    grid->nbRows = height / cellSize + 1;
+    grid->nbEntries = 0;
+    grid->capacity = 1024;
+
+    grid->heads = malloc(grid->nbColumns * grid->nbRows * sizeof(int));
+    grid->next = malloc(grid->capacity * sizeof(int));
+    grid->boxIndex = malloc(grid->capacity * sizeof(int));
+
+    if(grid->heads==NULL || grid->next==NULL || grid->boxIndex==NULL) {
+        free(grid->heads);
+        free(grid->next);
+        free(grid->boxIndex);
+        return ERR_ALLOCATE_FAIL;
+    }
+
+    for(i=0; i<grid->nbColumns * grid->nbRows; i++) {
+        grid->heads[i] = -1;
+    }
+
+    return 0;
+}
+
+
+static void release_grid(label_grid_t *grid) {
+    free(grid->heads);
+    free(grid->next);
+    free(grid->boxIndex);
+}
+
+
+/** give the range of cells covered by a box, clipped to the grid */
+static void grid_cells(label_grid_t *grid, label_box_t *box, int *c0, int *r0, int *c1, int *r1) {
+
+    *c0 = box->xMin < 0 ? 0 : box->xMin / grid->cellSize;
+    *r0 = box->yMin < 0 ? 0 : box->yMin / grid->cellSize;
+    *c1 = box->xMax <= 0 ? 0 : (box->xMax - 1) / grid->cellSize;
+    *r1 = box->yMax <= 0 ? 0 : (box->yMax - 1) / grid->cellSize;
+
+    if(*c1 >= grid->nbColumns) *c1 = grid->nbColumns - 1;
+    if(*r1 >= grid->nbRows) *r1 = grid->nbRows - 1;
+    if(*c0 > *c1) *c0 = *c1;
+    if(*r0 > *r1) *r0 = *r1;
+}
+
+
+/** \return 1 if "box" intersects one of the boxes already in the grid */
+static int grid_collides(label_grid_t *grid, label_box_t *boxes, label_box_t *box) {
+
+    int c0, r0, c1, r1, c, r;
+
+    grid_cells(grid, box, &c0, &r0, &c1, &r1);
+
+    for(r=r0; r<=r1; r++) {
+        for(c=c0; c<=c1; c++) {
+            int e;
+            for(e=grid->heads[r*grid->nbColumns+c]; e>=0; e=grid->next[e]) {
+                label_box_t *other = boxes + grid->boxIndex[e];
+                if(box->xMin < other->xMax && other->xMin < box->xMax &&
+                    box->yMin < other->yMax && other->yMin < box->yMax) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static int grid_insert(label_grid_t *grid, label_box_t *box, int index) {
+
+    int c0, r0, c1, r1, c, r;
+
+    grid_cells(grid, box, &c0, &r0, &c1, &r1);
+
+    for(r=r0; r<=r1; r++) {
+        for(c=c0; c<=c1; c++) {
+            int cell = r*grid->nbColumns+c;
+
+            if(grid->nbEntries == grid->capacity) {
+                int *next, *boxIndex;
+                next = realloc(grid->next, 2 * grid->capacity * sizeof(int));
+                if(next == NULL) return ERR_ALLOCATE_FAIL;
+                grid->next = next;
+                boxIndex = realloc(grid->boxIndex, 2 * grid->capacity * sizeof(int));
+                if(boxIndex == NULL) return ERR_ALLOCATE_FAIL;
+                grid->boxIndex = boxIndex;
+                grid->capacity *= 2;
+            }
+
+            grid->boxIndex[grid->nbEntries] = index;
+            grid->next[grid->nbEntries] = grid->heads[cell];
+            grid->heads[cell] = grid->nbEntries;
+            grid->nbEntries++;
+        }
+    }
+
+    return 0;
+}
+
+
+/** \return the number of characters of an UTF-8 text */
+static int count_characters(font_t *font, char *text) {
+
+    int nb, count = 0;
+    int i = 0;
+
+    while(text[i] != '\0') {
+        get_glyph(font, text+i, &nb);
+        i += nb;
+        count++;
+    }
+
+    return count;
+}
+
+
+static void compute_label_box(label_box_t *box, yLabel *label, int width, int height) {
+
+    int x = label->x;
+    int y = label->y;
+
+    switch(label->anchor) {
+    case Y_ANCHOR_TOP: case Y_ANCHOR_CENTER: case Y_ANCHOR_BOTTOM:
+        x -= width / 2; break;
+    case Y_ANCHOR_TOP_RIGHT: case Y_ANCHOR_RIGHT: case Y_ANCHOR_BOTTOM_RIGHT:
+        x -= width; break;
+    default:
+        break;
+    }
+
+    switch(label->anchor) {
+    case Y_ANCHOR_LEFT: case Y_ANCHOR_CENTER: case Y_ANCHOR_RIGHT:
+        y -= height / 2; break;
+    case Y_ANCHOR_BOTTOM_LEFT: case Y_ANCHOR_BOTTOM: case Y_ANCHOR_BOTTOM_RIGHT:
+        y -= height; break;
+    default:
+        break;
+    }
+
+    box->xMin = x;
+    box->yMin = y;
+    box->xMax = x + width;
+    box->yMax = y + height;
+}
+
+
+/** blend a pixel of the background with a color, like y_superpose_images() */
+static void blend_pixel(yImage *im, int pos, yColor *color) {
+
+    int af = color->alpha;
+    unsigned char *rgb = im->rgbData + 3*pos;
+
+    rgb[0] = ((255-af)*rgb[0] + af*color->r)/255;
+    rgb[1] = ((255-af)*rgb[1] + af*color->g)/255;
+    rgb[2] = ((255-af)*rgb[2] + af*color->b)/255;
+
+    if(im->alphaChanel != NULL) {
+        int ab = im->alphaChanel[pos];
+        im->alphaChanel[pos] = ab + (255-ab)*af/255;
+    }
+}
+
+
+/** draw the glyphs of a text directly on the image, clipping at the borders */
+static void blit_text(yImage *im, font_t *font, char *text, int x, int y, yColor *color) {
+
+    int bytesPerRow = (font->header.width + 7) / 8;
+    int nb, i = 0;
+
+    while(text[i] != '\0') {
+
+        unsigned char *car = get_glyph(font, text+i, &nb);
+
+        if(car != NULL && x < im->rgbWidth && x + (int) font->header.width > 0) {
+            int row;
+            for(row=0; row<font->header.height; row++) {
+                int col;
+                int py = y + row;
+
+                if(py < 0 || py >= im->rgbHeight) continue;
+
+                for(col=0; col<font->header.width; col++) {
+                    int px = x + col;
+                    if(px < 0 || px >= im->rgbWidth) continue;
+                    if(car[row*bytesPerRow + col/8] & (0x80 >> (col%8))) {
+                        blend_pixel(im, py*im->rgbWidth + px, color);
+                    }
+                }
+            }
+        }
+
+        i += nb;
+        x += font->header.width;
+    }
+}
+
+
+/* an entry of the labels' ordering */
+typedef struct {
+    int index;
+    int key;
+} label_order_t;
+
+static int compare_by_priority(const void *a, const void *b) {
+    const label_order_t *la = a;
+    const label_order_t *lb = b;
+    if(la->key != lb->key) return la->key > lb->key ? -1 : 1;
+    return la->index - lb->index;
+}
+
+static int compare_by_position(const void *a, const void *b) {
+    const label_order_t *la = a;
+    const label_order_t *lb = b;
+    if(la->key != lb->key) return la->key < lb->key ? -1 : 1;
+    return la->index - lb->index;
+}
+
+
+int y_display_labels(yImage *background, yLabel *labels, int nbLabels, font_t *font, int margin) {
+
+    label_box_t *boxes;
+    label_order_t *order;
+    label_grid_t grid;
+    font_t *defaultFont = NULL;
+    int nbDisplayed = 0;
+    int err = 0;
+    int i;
+
+    if(background == NULL || labels == NULL) return 0;
+    if(nbLabels <= 0) return 0;
+    if(margin < 0) margin = 0;
+
+    if(font == NULL) {
+        defaultFont = read_default_font(&err);
+        if(err != 0) {
+            fprintf(stderr, "Error opening default font - Write failed\n");
+            return -err;
+        }
+        font = defaultFont;
+    }
+
+    boxes = malloc(nbLabels * sizeof(label_box_t));
+    order = malloc(nbLabels * sizeof(label_order_t));
+
+    if(boxes == NULL || order == NULL ||
+        init_grid(&grid, background->rgbWidth, background->rgbHeight, 2 * font->header.height + 2 * margin) != 0) {
+        free(boxes);
+        free(order);
+        release_font(defaultFont);
+        return ERR_ALLOCATE_FAIL;
+    }
+
+    /* measure the labels */
+    for(i=0; i<nbLabels; i++) {
+        int width = 0;
+
+        labels[i].displayed = 0;
+        if(labels[i].text != NULL) {
+            width = count_characters(font, labels[i].text) * font->header.width;
+        }
+        compute_label_box(boxes+i, labels+i, width, font->header.height);
+
+        order[i].index = i;
+        order[i].key = labels[i].priority;
+    }
+
+    qsort(order, nbLabels, sizeof(label_order_t), compare_by_priority);
+
+    /* keep the labels which don't overlap an already accepted one */
+    for(i=0; i<nbLabels; i++) {
+        int index = order[i].index;
+        label_box_t *box = boxes + index;
+        label_box_t padded;
+
+        if(box->xMax <= box->xMin) continue;
+        if(box->xMax <= 0 || box->yMax <= 0) continue;
+        if(box->xMin >= background->rgbWidth || box->yMin >= background->rgbHeight) continue;
+
+        padded.xMin = box->xMin - margin;
+        padded.yMin = box->yMin - margin;
+        padded.xMax = box->xMax + margin;
+        padded.yMax = box->yMax + margin;
+
+        if(grid_collides(&grid, boxes, &padded)) continue;
+
+        err = grid_insert(&grid, box, index);
+        if(err != 0) break;
+
+        labels[index].displayed = 1;
+        order[nbDisplayed].index = index;
+        order[nbDisplayed].key = box->yMin;
+        nbDisplayed++;
+    }
+
+    /* draw the survivors from top to bottom */
+    if(err == 0) {
+        qsort(order, nbDisplayed, sizeof(label_order_t), compare_by_position);
+
+        for(i=0; i<nbDisplayed; i++) {
+            yLabel *label = labels + order[i].index;
+            label_box_t *box = boxes + order[i].index;
+            blit_text(background, font, label->text, box->xMin, box->yMin, &(label->color));
+        }
+    }
+
+    release_grid(&grid);
+    free(boxes);
+    free(order);
+    release_font(defaultFont);
+
+    return err != 0 ? err : nbDisplayed;
+}
@@ -18,6 +18,36 @@
 #include "yImage.h"
 
 
+/**
+ * \brief Position of a label's anchor point relatively to its text box.
+ */
+typedef enum {
+    Y_ANCHOR_TOP_LEFT=0, /**< the anchor is the top left corner of the text */
+    Y_ANCHOR_TOP, /**< the anchor is the middle of the text's top border */
+    Y_ANCHOR_TOP_RIGHT, /**< the anchor is the top right corner of the text */
+    Y_ANCHOR_LEFT, /**< the anchor is the middle of the text's left border */
+    Y_ANCHOR_CENTER, /**< the anchor is the center of the text */
+    Y_ANCHOR_RIGHT, /**< the anchor is the middle of the text's right border */
+    Y_ANCHOR_BOTTOM_LEFT, /**< the anchor is the bottom left corner of the text */
+    Y_ANCHOR_BOTTOM, /**< the anchor is the middle of the text's bottom border */
+    Y_ANCHOR_BOTTOM_RIGHT /**< the anchor is the bottom right corner of the text */
+} yAnchor;
+
+
+/**
+ * \brief A candidate label for y_display_labels().
+ */
+typedef struct {
+    char *text; /**< the text to display */
+    int x; /**< x coordinate of the anchor point */
+    int y; /**< y coordinate of the anchor point */
+    yAnchor anchor; /**< how the text is placed around (x,y) */
+    int priority; /**< labels with higher priority are placed first */
+    yColor color; /**< the text color */
+    int displayed; /**< output : 1 if the label was drawn, 0 if it was culled */
+} yLabel;
+
+
 /**
  * \brief Create a new image with transparent background and showing a
  * given text.
@@ -107,6 +137,24 @@ int y_display_text_vertically_with_font_and_color(yImage *background, int x, int
 int y_display_text_vertically_with_font(yImage *background, int x, int y, char *text, font_t *font);
 
 
+/**
+ * \brief Display a batch of labels, discarding the ones which overlap.
+ *
+ * The labels are considered by decreasing priority (the order of the
+ * array is kept between labels of same priority). A label is culled if
+ * its text box, enlarged by "margin" pixels, intersects the box of an
+ * already accepted label or lies entirely outside the image. The
+ * accepted labels are then drawn directly on the background.
+ * \param background the background image
+ * \param labels the candidate labels. Their field "displayed" is updated.
+ * \param nbLabels number of labels in the array
+ * \param font the font to use, or NULL for the default font
+ * \param margin minimal free space in pixels around each label
+ * \return the number of displayed labels, or a negative error code
+ */
+int y_display_labels(yImage *background, yLabel *labels, int nbLabels, font_t *font, int margin);
+
+
 /**
  * To display a font's glyph.
  */
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yThread.c
+ * \brief run independent tasks on several threads.
+ *
+ * The threads share a counter giving the next task to run, so that a
+ * thread finishing early takes more tasks.
+ */
+
+#include "yThread.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+/** maximum number of threads started by y_parallel_for() */
+#define MAX_THREADS 64
+
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+    yTask task;
+    void *data;
+    int nbTasks;
+    int next; /**< index of the next task to run */
+    pthread_mutex_t lock;
+} task_queue_t;
+
+
+static void *run_tasks(void *arg) {
+
+    task_queue_t *queue = arg;
+    int index;
+
+    for(;;) {
+        pthread_mutex_lock(&queue->lock);
+        index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if(index >= queue->nbTasks) break;
+        queue->task(queue->data, index);
+    }
+
+    return NULL;
+}
+#endif
+
+
+int y_cpu_count(void) {
+
+    #ifdef HAVE_PTHREAD
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n > MAX_THREADS) return MAX_THREADS;
+    if(n > 1) return n;
+    #endif
+    return 1;
+}
+
+
+void y_parallel_for(int nbTasks, int nbThreads, yTask task, void *data) {
+
+    int i;
+
+    #ifdef HAVE_PTHREAD
+    pthread_t threads[MAX_THREADS];
+    task_queue_t queue;
+    int nbStarted = 0;
+
+    if(nbThreads <= 0) nbThreads = y_cpu_count();
+    if(nbThreads > MAX_THREADS) nbThreads = MAX_THREADS;
+    if(nbThreads > nbTasks) nbThreads = nbTasks;
+
+    if(nbThreads > 1) {
+
+        queue.task = task;
+        queue.data = data;
+        queue.nbTasks = nbTasks;
+        queue.next = 0;
+        pthread_mutex_init(&queue.lock, NULL);
+
+        /* if a thread can't be created, the others do its part */
+        for(i=1; i<nbThreads; i++) {
+            if(pthread_create(threads + nbStarted, NULL, run_tasks, &queue) == 0) nbStarted++;
+        }
+
+        run_tasks(&queue);
+
+        for(i=0; i<nbStarted; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&queue.lock);
+        return;
+    }
+    #endif
+
+    for(i=0; i<nbTasks; i++) {
+        task(data, i);
+    }
+}
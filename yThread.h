@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yThread.h
+ * \brief run independent tasks on several threads.
+ *
+ * The threads are used only if the library is built with HAVE_PTHREAD.
+ * Otherwise, the tasks are run one after the other by the calling
+ * thread.
+ */
+
+#ifndef Y_THREAD_H_
+#define Y_THREAD_H_
+
+
+/**
+ * \brief A task run by y_parallel_for().
+ * \param data the pointer given to y_parallel_for()
+ * \param index the index of the task, from 0 to nbTasks-1
+ */
+typedef void (*yTask)(void *data, int index);
+
+
+/**
+ * \brief Give the number of processors available.
+ * \return the number of online processors, 1 without threads support
+ */
+int y_cpu_count(void);
+
+
+/**
+ * \brief Run "nbTasks" tasks on up to "nbThreads" threads, and wait
+ * for their completion.
+ *
+ * The calling thread takes part in the work. The tasks are started in
+ * the order of their indices, but may end in any order.
+ * \param nbTasks the number of tasks
+ * \param nbThreads the maximum number of threads, or 0 for one by
+ * processor
+ * \param task the function to run for each index
+ * \param data the pointer to give to "task"
+ */
+void y_parallel_for(int nbTasks, int nbThreads, yTask task, void *data);
+
+
+#endif
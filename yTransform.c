@@ -0,0 +1,1456 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yTransform.c
+ * \brief geometric transformations of images.
+ *
+ * Quarter turns are made of a transposition, possibly with the source
+ * rows or columns taken in reverse order. The transposition walks the
+ * image by tiles of TILE_SIZE x TILE_SIZE pixels, so that both the
+ * rows read and the rows written stay in cache while a tile is
+ * processed. With SSE2, the blocks are transposed in registers : 8x8
+ * bytes of the alpha plane, or 4x4 pixels of the RGB plane widened to 32
+ * bits. The gain is small for the RGB plane once the image is larger
+ * than the cache. The in place transposition of square images is scalar.
+ *
+ * The resampling is separable : each output pixel is a weighted sum of
+ * source pixels, with weights computed once by axis in fixed point. The
+ * source rows are first resampled horizontally, then the columns
+ * vertically, by bands of output rows run in parallel. With SSE2, the
+ * vertical pass sums two source rows by instruction, on 8 samples.
+ *
+ * The warps map each output pixel back to the source. The output is
+ * computed by tiles of TILE_SIZE x TILE_SIZE pixels, whose sources stay
+ * close together whatever the rotation. In each row of a tile, the span
+ * of pixels whose source is inside the image is found first, and the
+ * source coordinates are then stepped in 16.16 fixed point : exactly for
+ * affine warps, linearly between exact points every WARP_SPAN pixels for
+ * perspective warps.
+ */
+
+#include "yTransform.h"
+#include "yThread.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/** size in pixels of the side of the tiles */
+#define TILE_SIZE 64
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/** number of fractional bits of the resampling weights */
+#define WEIGHT_BITS 14
+
+/** size of the pixels of the rows resampled horizontally : the SSE2 code reads 4 bytes by pixel */
+#ifdef __SSE2__
+#define ROW_PIXEL_SIZE 4
+#else
+#define ROW_PIXEL_SIZE 3
+#endif
+
+/** number of output rows of the bands resampled in parallel */
+#define RESIZE_BAND_ROWS 64
+
+/** under this number of output pixels, the resampling uses a single thread */
+#define RESIZE_MIN_PARALLEL (256*256)
+
+/** number of pixels between the exact source coordinates of perspective warps */
+#define WARP_SPAN 8
+
+/** smallest homogeneous coordinate of the sources of perspective warps : the points at infinity are skipped */
+#define WARP_MIN_W 1e-9
+
+
+
+/************************************************************/
+/*                   TRANSPOSITION KERNELS                  */
+/************************************************************/
+
+
+/*
+ * In the kernels, "dst" is the transposition of "src" (width x height
+ * pixels). The destination row dy is the source column dy (width-1-dy
+ * if flipX) and the destination column dx is the source row dx
+ * (height-1-dx if flipY).
+ */
+
+
+/** scalar transposition of the destination rectangle [x0,x1[ x [y0,y1[ */
+static void transpose_rect(const unsigned char *src, unsigned char *dst, int width, int height,
+    int pixelSize, int flipX, int flipY, int x0, int x1, int y0, int y1) {
+
+    int dx, dy;
+
+    for(dy=y0; dy<y1; dy++) {
+
+        int sx = flipX ? width-1-dy : dy;
+        unsigned char *d = dst + ((size_t) dy*height + x0)*pixelSize;
+
+        if(pixelSize == 3) {
+            for(dx=x0; dx<x1; dx++) {
+                int sy = flipY ? height-1-dx : dx;
+                const unsigned char *s = src + ((size_t) sy*width + sx)*3;
+                d[0] = s[0];
+                d[1] = s[1];
+                d[2] = s[2];
+                d += 3;
+            }
+        } else {
+            for(dx=x0; dx<x1; dx++) {
+                int sy = flipY ? height-1-dx : dx;
+                *d++ = src[(size_t) sy*width + sx];
+            }
+        }
+    }
+}
+
+
+#ifdef __SSE2__
+/**
+ * Transpose the 8x8 bytes block of destination (dx0,dy0) in registers.
+ */
+static void transpose_block8(const unsigned char *src, unsigned char *dst, int width, int height,
+    int flipX, int flipY, int dx0, int dy0) {
+
+    __m128i r[8], a[4], b[4], c[4];
+    int sx0 = flipX ? width-8-dy0 : dy0;
+    int i;
+
+    for(i=0; i<8; i++) {
+        int sy = flipY ? height-1-(dx0+i) : dx0+i;
+        r[i] = _mm_loadl_epi64((const __m128i *) (src + (size_t) sy*width + sx0));
+    }
+
+    a[0] = _mm_unpacklo_epi8(r[0], r[1]);
+    a[1] = _mm_unpacklo_epi8(r[2], r[3]);
+    a[2] = _mm_unpacklo_epi8(r[4], r[5]);
+    a[3] = _mm_unpacklo_epi8(r[6], r[7]);
+
+    b[0] = _mm_unpacklo_epi16(a[0], a[1]);
+    b[1] = _mm_unpackhi_epi16(a[0], a[1]);
+    b[2] = _mm_unpacklo_epi16(a[2], a[3]);
+    b[3] = _mm_unpackhi_epi16(a[2], a[3]);
+
+    /* c[k] holds the source columns 2k and 2k+1 */
+    c[0] = _mm_unpacklo_epi32(b[0], b[2]);
+    c[1] = _mm_unpackhi_epi32(b[0], b[2]);
+    c[2] = _mm_unpacklo_epi32(b[1], b[3]);
+    c[3] = _mm_unpackhi_epi32(b[1], b[3]);
+
+    for(i=0; i<4; i++) {
+        int k0 = 2*i, k1 = 2*i+1;
+        int dy_0 = flipX ? dy0+7-k0 : dy0+k0;
+        int dy_1 = flipX ? dy0+7-k1 : dy0+k1;
+        _mm_storel_epi64((__m128i *) (dst + (size_t) dy_0*height + dx0), c[i]);
+        _mm_storel_epi64((__m128i *) (dst + (size_t) dy_1*height + dx0), _mm_srli_si128(c[i], 8));
+    }
+}
+
+
+/** load 4 RGB pixels, each one in the low 3 bytes of a 32 bits lane */
+static __m128i load_rgb4(const unsigned char *p) {
+
+    __m128i v;
+    int last;
+
+    memcpy(&last, p + 8, 4);
+    v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) p), _mm_cvtsi32_si128(last));
+    return _mm_unpacklo_epi64(_mm_unpacklo_epi32(v, _mm_srli_si128(v, 3)),
+        _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9)));
+}
+
+
+/** store the 4 RGB pixels of the low 3 bytes of the lanes, in 12 bytes */
+static void store_rgb4(unsigned char *p, __m128i v) {
+
+    int last;
+
+    /* each half of 64 bits packs its 2 pixels in 6 bytes, then the halves are joined */
+    v = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi64x(0xFFFFFF)),
+        _mm_and_si128(_mm_srli_epi64(v, 8), _mm_set1_epi64x(0xFFFFFF000000LL)));
+    v = _mm_or_si128(_mm_and_si128(v, _mm_set_epi32(0, 0, 0xFFFF, -1)), _mm_slli_si128(_mm_srli_si128(v, 8), 6));
+
+    _mm_storel_epi64((__m128i *) p, v);
+    last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    memcpy(p + 8, &last, 4);
+}
+
+
+/**
+ * Transpose the 4x4 RGB pixels block of destination (dx0,dy0) in
+ * registers, the pixels being widened to 32 bits.
+ */
+static void transpose_block4_rgb(const unsigned char *src, unsigned char *dst, int width, int height,
+    int flipX, int flipY, int dx0, int dy0) {
+
+    __m128i r[4], t[4], c[4];
+    int sx0 = flipX ? width-4-dy0 : dy0;
+    int i;
+
+    for(i=0; i<4; i++) {
+        int sy = flipY ? height-1-(dx0+i) : dx0+i;
+        r[i] = load_rgb4(src + ((size_t) sy*width + sx0)*3);
+    }
+
+    t[0] = _mm_unpacklo_epi32(r[0], r[1]);
+    t[1] = _mm_unpacklo_epi32(r[2], r[3]);
+    t[2] = _mm_unpackhi_epi32(r[0], r[1]);
+    t[3] = _mm_unpackhi_epi32(r[2], r[3]);
+
+    /* c[k] holds the source column k */
+    c[0] = _mm_unpacklo_epi64(t[0], t[1]);
+    c[1] = _mm_unpackhi_epi64(t[0], t[1]);
+    c[2] = _mm_unpacklo_epi64(t[2], t[3]);
+    c[3] = _mm_unpackhi_epi64(t[2], t[3]);
+
+    for(i=0; i<4; i++) {
+        int dy = flipX ? dy0+3-i : dy0+i;
+        store_rgb4(dst + ((size_t) dy*height + dx0)*3, c[i]);
+    }
+}
+#endif
+
+
+/** tiled transposition of a whole plane */
+static void transpose_plane(const unsigned char *src, unsigned char *dst, int width, int height,
+    int pixelSize, int flipX, int flipY) {
+
+    int tx, ty;
+
+    for(ty=0; ty<width; ty+=TILE_SIZE) {
+        int yEnd = ty+TILE_SIZE < width ? ty+TILE_SIZE : width;
+
+        for(tx=0; tx<height; tx+=TILE_SIZE) {
+            int xEnd = tx+TILE_SIZE < height ? tx+TILE_SIZE : height;
+
+#ifdef __SSE2__
+            /* blocks of 8x8 alpha values or 4x4 RGB pixels, then the remaining edges */
+            int block = pixelSize == 1 ? 8 : 4;
+            int yFull = ty + (yEnd-ty) / block * block;
+            int xFull = tx + (xEnd-tx) / block * block;
+            int dx, dy;
+
+            for(dy=ty; dy<yFull; dy+=block) {
+                for(dx=tx; dx<xFull; dx+=block) {
+                    if(pixelSize == 1) transpose_block8(src, dst, width, height, flipX, flipY, dx, dy);
+                    else transpose_block4_rgb(src, dst, width, height, flipX, flipY, dx, dy);
+                }
+            }
+            transpose_rect(src, dst, width, height, pixelSize, flipX, flipY, xFull, xEnd, ty, yFull);
+            transpose_rect(src, dst, width, height, pixelSize, flipX, flipY, tx, xEnd, yFull, yEnd);
+#else
+            transpose_rect(src, dst, width, height, pixelSize, flipX, flipY, tx, xEnd, ty, yEnd);
+#endif
+        }
+    }
+}
+
+
+/** tiled in place transposition of a square plane */
+static void transpose_square_plane(unsigned char *data, int size, int pixelSize) {
+
+    int ti, tj;
+
+    for(ti=0; ti<size; ti+=TILE_SIZE) {
+        int iEnd = ti+TILE_SIZE < size ? ti+TILE_SIZE : size;
+
+        for(tj=ti; tj<size; tj+=TILE_SIZE) {
+            int jEnd = tj+TILE_SIZE < size ? tj+TILE_SIZE : size;
+            int i, j;
+
+            for(i=ti; i<iEnd; i++) {
+                for(j=(tj==ti ? i+1 : tj); j<jEnd; j++) {
+                    unsigned char *p = data + ((size_t) i*size + j)*pixelSize;
+                    unsigned char *q = data + ((size_t) j*size + i)*pixelSize;
+                    int k;
+                    for(k=0; k<pixelSize; k++) {
+                        unsigned char tmp = p[k];
+                        p[k] = q[k];
+                        q[k] = tmp;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+/************************************************************/
+/*                   IN PLACE MIRRORS                       */
+/************************************************************/
+
+
+static void swap_bytes(unsigned char *p, unsigned char *q, size_t n) {
+
+    size_t i;
+
+    for(i=0; i<n; i++) {
+        unsigned char tmp = p[i];
+        p[i] = q[i];
+        q[i] = tmp;
+    }
+}
+
+
+static void flip_v_plane(unsigned char *data, int width, int height, int pixelSize) {
+
+    size_t rowSize = (size_t) width*pixelSize;
+    int y;
+
+    for(y=0; y<height/2; y++) {
+        swap_bytes(data + y*rowSize, data + (height-1-y)*rowSize, rowSize);
+    }
+}
+
+
+/** reverse the order of "nb" pixels */
+static void reverse_pixels(unsigned char *data, size_t nb, int pixelSize) {
+
+    unsigned char *p = data;
+    unsigned char *q = data + (nb-1)*pixelSize;
+
+    if(nb == 0) return;
+
+    if(pixelSize == 3) {
+        while(p < q) {
+            unsigned char r = p[0], g = p[1], b = p[2];
+            p[0] = q[0]; p[1] = q[1]; p[2] = q[2];
+            q[0] = r; q[1] = g; q[2] = b;
+            p += 3;
+            q -= 3;
+        }
+    } else {
+        while(p < q) {
+            unsigned char tmp = *p;
+            *p++ = *q;
+            *q-- = tmp;
+        }
+    }
+}
+
+
+static void flip_h_plane(unsigned char *data, int width, int height, int pixelSize) {
+
+    int y;
+
+    for(y=0; y<height; y++) {
+        reverse_pixels(data + (size_t) y*width*pixelSize, width, pixelSize);
+    }
+}
+
+
+
+/************************************************************/
+/*                   RESAMPLING WEIGHTS                     */
+/************************************************************/
+
+
+/** the weights of the source pixels for each output pixel of an axis */
+typedef struct {
+    int *first; /* first source pixel of each output pixel */
+    int *count; /* number of source pixels of each output pixel */
+    int16_t *weights; /* "taps" weights by output pixel, with WEIGHT_BITS fractional bits */
+    int taps;
+} resample_axis_t;
+
+
+static double sinc(double x) {
+
+    if(x == 0.0) return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+
+/** the filter's kernel, \return its value at x */
+static double filter_kernel(yResizeFilter filter, double x) {
+
+    if(x < 0.0) x = -x;
+
+    switch(filter) {
+        case Y_FILTER_BILINEAR:
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case Y_FILTER_BICUBIC:
+            /* Keys' cubic convolution, a = -0.5 */
+            if(x < 1.0) return (1.5*x - 2.5)*x*x + 1.0;
+            if(x < 2.0) return ((-0.5*x + 2.5)*x - 4.0)*x + 2.0;
+            return 0.0;
+        case Y_FILTER_LANCZOS:
+            return x < 3.0 ? sinc(x) * sinc(x/3.0) : 0.0;
+        default:
+            return x < 0.5 ? 1.0 : 0.0;
+    }
+}
+
+
+/** \return the half width of the filter's kernel */
+static double filter_support(yResizeFilter filter) {
+
+    switch(filter) {
+        case Y_FILTER_BILINEAR: return 1.0;
+        case Y_FILTER_BICUBIC: return 2.0;
+        case Y_FILTER_LANCZOS: return 3.0;
+        default: return 0.5;
+    }
+}
+
+
+static void release_axis(resample_axis_t *axis) {
+
+    free(axis->first);
+    free(axis->count);
+    free(axis->weights);
+}
+
+
+/**
+ * Compute the weights to resample "inSize" pixels to "outSize". When
+ * reducing, the kernel is widened by the scale, to average all the
+ * source pixels.
+ * \return 0 in case of success
+ */
+static int init_axis(resample_axis_t *axis, yResizeFilter filter, int inSize, int outSize) {
+
+    double scale = (double) inSize / outSize;
+    double filterScale = scale > 1.0 ? scale : 1.0;
+    double support = filter_support(filter) * filterScale;
+    double *kernel;
+    int i, k;
+
+    axis->taps = (int) ceil(support) * 2 + 1;
+    axis->first = malloc(outSize * sizeof(int));
+    axis->count = malloc(outSize * sizeof(int));
+    axis->weights = calloc((size_t) outSize * axis->taps, sizeof(int16_t));
+    kernel = malloc(axis->taps * sizeof(double));
+
+    if(axis->first == NULL || axis->count == NULL || axis->weights == NULL || kernel == NULL) {
+        release_axis(axis);
+        free(kernel);
+        return 1;
+    }
+
+    for(i=0; i<outSize; i++) {
+        double center = (i + 0.5) * scale;
+        double total = 0.0;
+        int16_t *w = axis->weights + (size_t) i * axis->taps;
+        int first = (int) (center - support + 0.5);
+        int last = (int) (center + support + 0.5);
+        int sum = 0, largest = 0;
+
+        if(first < 0) first = 0;
+        if(last > inSize) last = inSize;
+        if(last - first > axis->taps) last = first + axis->taps;
+
+        for(k=0; k<last-first; k++) {
+            kernel[k] = filter_kernel(filter, (first + k - center + 0.5) / filterScale);
+            total += kernel[k];
+        }
+
+        for(k=0; k<last-first; k++) {
+            w[k] = (int16_t) floor((total != 0.0 ? kernel[k] / total : 0.0) * (1 << WEIGHT_BITS) + 0.5);
+            sum += w[k];
+            if(w[k] > w[largest]) largest = k;
+        }
+
+        /* the rounding errors go to the largest weight : the weights sum to 1 exactly */
+        w[largest] += (1 << WEIGHT_BITS) - sum;
+
+        axis->first[i] = first;
+        axis->count[i] = last - first;
+    }
+
+    free(kernel);
+    return 0;
+}
+
+
+
+/************************************************************/
+/*                   SEPARABLE RESAMPLING                   */
+/************************************************************/
+
+
+/** a resampling of an image, by bands of output rows */
+typedef struct {
+    const yImage *src;
+    yResizeFilter filter;
+    int width, height; /* size of the output */
+    unsigned char *rgb; /* output planes */
+    unsigned char *alpha;
+    resample_axis_t *horizontal; /* NULL when the width doesn't change */
+    resample_axis_t *vertical; /* NULL when the height doesn't change */
+    int *nearestX; /* source column of each output column, for Y_FILTER_NEAREST */
+    volatile int failed; /* set by the tasks which can't allocate their buffers */
+} resize_job_t;
+
+
+static unsigned char clip_sample(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+
+/** resample horizontally a row of RGB pixels of ROW_PIXEL_SIZE bytes (see prepare_row()) */
+static void resample_rgb_row(const resample_axis_t *axis, const unsigned char *src, unsigned char *dst, int width) {
+
+    int x, k;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+
+    for(x=0; x<width; x++) {
+        const int16_t *w = axis->weights + (size_t) x*axis->taps;
+        const unsigned char *s = src + 4*axis->first[x];
+        int count = axis->count[x];
+        __m128i sum = _mm_set1_epi32(1 << (WEIGHT_BITS-1));
+        int rgbx;
+
+        /* two pixels by step : their samples are paired (r0 r1 g0 g1 b0 b1 x0 x1) to multiply and add them at once */
+        for(k=0; k<count; k+=2) {
+            __m128i pixels, samples, weights;
+
+            if(k+1 < count) {
+                pixels = _mm_loadl_epi64((const __m128i *) (s + 4*k));
+            } else {
+                memcpy(&rgbx, s + 4*k, 4);
+                pixels = _mm_cvtsi32_si128(rgbx);
+            }
+            samples = _mm_unpacklo_epi8(pixels, zero);
+            weights = _mm_set1_epi32((k+1 < count ? (int) ((uint32_t) (uint16_t) w[k+1] << 16) : 0) | (uint16_t) w[k]);
+
+            samples = _mm_unpacklo_epi16(samples, _mm_srli_si128(samples, 8));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(samples, weights));
+        }
+
+        sum = _mm_srai_epi32(sum, WEIGHT_BITS);
+        sum = _mm_packus_epi16(_mm_packs_epi32(sum, zero), zero);
+        rgbx = _mm_cvtsi128_si32(sum);
+        dst[3*x] = rgbx & 0xFF;
+        dst[3*x+1] = (rgbx >> 8) & 0xFF;
+        dst[3*x+2] = (rgbx >> 16) & 0xFF;
+    }
+#else
+    for(x=0; x<width; x++) {
+        const int16_t *w = axis->weights + (size_t) x*axis->taps;
+        const unsigned char *s = src + 3*axis->first[x];
+        int r = 1 << (WEIGHT_BITS-1), g = r, b = r;
+
+        for(k=0; k<axis->count[x]; k++) {
+            r += w[k] * s[3*k];
+            g += w[k] * s[3*k+1];
+            b += w[k] * s[3*k+2];
+        }
+        dst[3*x] = clip_sample(r >> WEIGHT_BITS);
+        dst[3*x+1] = clip_sample(g >> WEIGHT_BITS);
+        dst[3*x+2] = clip_sample(b >> WEIGHT_BITS);
+    }
+#endif
+}
+
+
+/** resample horizontally a row of alpha values */
+static void resample_alpha_row(const resample_axis_t *axis, const unsigned char *src, unsigned char *dst, int width) {
+
+    int x, k;
+
+    for(x=0; x<width; x++) {
+        const int16_t *w = axis->weights + (size_t) x*axis->taps;
+        const unsigned char *s = src + axis->first[x];
+        int v = 1 << (WEIGHT_BITS-1);
+
+        for(k=0; k<axis->count[x]; k++) {
+            v += w[k] * s[k];
+        }
+        dst[x] = clip_sample(v >> WEIGHT_BITS);
+    }
+}
+
+
+/**
+ * Resample vertically the output row "y" of "n" samples, from the rows
+ * of "src" (the first one being the source row "srcFirst").
+ */
+static void resample_column(const resample_axis_t *axis, int y, const unsigned char *src, int srcFirst,
+    size_t n, unsigned char *dst) {
+
+    const int16_t *w = axis->weights + (size_t) y*axis->taps;
+    const unsigned char *rows = src + (size_t) (axis->first[y] - srcFirst)*n;
+    int count = axis->count[y];
+    size_t i = 0;
+    int k;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi32(1 << (WEIGHT_BITS-1));
+
+    for(; i+8<=n; i+=8) {
+        __m128i lo = round, hi = round;
+
+        /* the samples of two rows are interleaved, to multiply and add them with their weights at once */
+        for(k=0; k<count; k+=2) {
+            __m128i a = _mm_loadl_epi64((const __m128i *) (rows + k*n + i));
+            __m128i b = k+1 < count ? _mm_loadl_epi64((const __m128i *) (rows + (k+1)*n + i)) : zero;
+            __m128i weights = _mm_set1_epi32((k+1 < count ? (int) ((uint32_t) (uint16_t) w[k+1] << 16) : 0) | (uint16_t) w[k]);
+            __m128i ab = _mm_unpacklo_epi8(a, b);
+
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi8(ab, zero), weights));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi8(ab, zero), weights));
+        }
+
+        lo = _mm_srai_epi32(lo, WEIGHT_BITS);
+        hi = _mm_srai_epi32(hi, WEIGHT_BITS);
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(_mm_packs_epi32(lo, hi), zero));
+    }
+#endif
+
+    for(; i<n; i++) {
+        int v = 1 << (WEIGHT_BITS-1);
+
+        for(k=0; k<count; k++) {
+            v += w[k] * rows[k*n + i];
+        }
+        dst[i] = clip_sample(v >> WEIGHT_BITS);
+    }
+}
+
+
+/** copy a row of RGB pixels to ROW_PIXEL_SIZE bytes by pixel */
+static void prepare_row(const unsigned char *rgb, unsigned char *dst, int width) {
+
+    int x;
+
+    for(x=0; x<width; x++) {
+        dst[0] = rgb[0];
+        dst[1] = rgb[1];
+        dst[2] = rgb[2];
+        if(ROW_PIXEL_SIZE == 4) dst[3] = 0;
+        rgb += 3;
+        dst += ROW_PIXEL_SIZE;
+    }
+}
+
+
+/** task resampling the band "index" with the nearest pixels */
+static void resize_nearest_band(void *data, int index) {
+
+    resize_job_t *job = data;
+    const yImage *src = job->src;
+    int y0 = index * RESIZE_BAND_ROWS;
+    int y1 = y0 + RESIZE_BAND_ROWS < job->height ? y0 + RESIZE_BAND_ROWS : job->height;
+    int x, y;
+
+    for(y=y0; y<y1; y++) {
+        int sy = (int) (((2*(int64_t) y + 1) * src->rgbHeight) / (2*(int64_t) job->height));
+        const unsigned char *s = src->rgbData + (size_t) sy*src->rgbWidth*3;
+        unsigned char *d = job->rgb + (size_t) y*job->width*3;
+
+        for(x=0; x<job->width; x++) {
+            const unsigned char *p = s + 3*job->nearestX[x];
+            d[3*x] = p[0];
+            d[3*x+1] = p[1];
+            d[3*x+2] = p[2];
+        }
+
+        if(job->alpha != NULL) {
+            const unsigned char *sa = src->alphaChanel + (size_t) sy*src->rgbWidth;
+            unsigned char *da = job->alpha + (size_t) y*job->width;
+            for(x=0; x<job->width; x++) {
+                da[x] = sa[job->nearestX[x]];
+            }
+        }
+    }
+}
+
+
+/**
+ * Task resampling the band "index" : the source rows needed by the band
+ * are resampled horizontally in a buffer, then its columns vertically.
+ */
+static void resize_band(void *data, int index) {
+
+    resize_job_t *job = data;
+    const yImage *src = job->src;
+    int y0 = index * RESIZE_BAND_ROWS;
+    int y1 = y0 + RESIZE_BAND_ROWS < job->height ? y0 + RESIZE_BAND_ROWS : job->height;
+    int srcFirst = y0, srcLast = y1;
+    size_t rowSize = (size_t) job->width*3;
+    unsigned char *rgb, *alpha = NULL, *row = NULL;
+    int prepare = job->horizontal != NULL && ROW_PIXEL_SIZE != 3;
+    int y;
+
+    if(job->vertical != NULL) {
+        srcFirst = job->vertical->first[y0];
+        srcLast = srcFirst;
+        for(y=y0; y<y1; y++) {
+            int last = job->vertical->first[y] + job->vertical->count[y];
+            if(last > srcLast) srcLast = last;
+        }
+    }
+
+    rgb = malloc((size_t) (srcLast-srcFirst) * rowSize);
+    if(job->alpha != NULL) alpha = malloc((size_t) (srcLast-srcFirst) * job->width);
+    if(prepare) row = malloc((size_t) src->rgbWidth*ROW_PIXEL_SIZE);
+
+    if(rgb == NULL || (job->alpha != NULL && alpha == NULL) || (prepare && row == NULL)) {
+        job->failed = 1;
+        free(rgb);
+        free(alpha);
+        free(row);
+        return;
+    }
+
+    /* horizontal pass */
+    for(y=srcFirst; y<srcLast; y++) {
+        const unsigned char *s = src->rgbData + (size_t) y*src->rgbWidth*3;
+        const unsigned char *a = src->alphaChanel != NULL ? src->alphaChanel + (size_t) y*src->rgbWidth : NULL;
+        unsigned char *d = rgb + (size_t) (y-srcFirst)*rowSize;
+
+        if(job->horizontal != NULL) {
+            if(prepare) {
+                prepare_row(s, row, src->rgbWidth);
+                s = row;
+            }
+            resample_rgb_row(job->horizontal, s, d, job->width);
+        } else {
+            memcpy(d, s, rowSize);
+        }
+
+        if(alpha != NULL) {
+            d = alpha + (size_t) (y-srcFirst)*job->width;
+            if(job->horizontal != NULL) resample_alpha_row(job->horizontal, a, d, job->width);
+            else memcpy(d, a, job->width);
+        }
+    }
+
+    /* vertical pass */
+    for(y=y0; y<y1; y++) {
+        unsigned char *d = job->rgb + (size_t) y*rowSize;
+        unsigned char *da = job->alpha != NULL ? job->alpha + (size_t) y*job->width : NULL;
+
+        if(job->vertical != NULL) {
+            resample_column(job->vertical, y, rgb, srcFirst, rowSize, d);
+            if(da != NULL) resample_column(job->vertical, y, alpha, srcFirst, job->width, da);
+        } else {
+            memcpy(d, rgb + (size_t) (y-srcFirst)*rowSize, rowSize);
+            if(da != NULL) memcpy(da, alpha + (size_t) (y-srcFirst)*job->width, job->width);
+        }
+    }
+
+    free(rgb);
+    free(alpha);
+    free(row);
+}
+
+
+/************************************************************/
+/*                 PREMULTIPLIED RESAMPLING                 */
+/************************************************************/
+
+
+/*
+ * The images with transparent pixels are resampled with their colours
+ * multiplied by alpha, in 15 bits : a pixel is (r*a/2, g*a/2, b*a/2,
+ * 128*a), so that the SSE2 code can multiply the samples as signed 16 bit
+ * values. Rounded to 8 bits, the premultiplied colours of the nearly
+ * transparent pixels would lose most of their precision when divided back
+ * by alpha.
+ */
+
+
+/** largest premultiplied sample */
+#define PREMULTIPLIED_MAX 32767
+
+
+static int16_t clip_premultiplied(int value) {
+    return value < 0 ? 0 : (value > PREMULTIPLIED_MAX ? PREMULTIPLIED_MAX : value);
+}
+
+
+/** multiply the colours of a row of pixels by their alpha */
+static void premultiply_row(const unsigned char *rgb, const unsigned char *alpha, int16_t *dst, int width) {
+
+    int x;
+
+    for(x=0; x<width; x++) {
+        dst[0] = (rgb[0] * alpha[x] + 1) >> 1;
+        dst[1] = (rgb[1] * alpha[x] + 1) >> 1;
+        dst[2] = (rgb[2] * alpha[x] + 1) >> 1;
+        dst[3] = alpha[x] << 7;
+        rgb += 3;
+        dst += 4;
+    }
+}
+
+
+/** resample horizontally a row of premultiplied pixels */
+static void resample_premultiplied_row(const resample_axis_t *axis, const int16_t *src, int16_t *dst, int width) {
+
+    int x, k;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+
+    for(x=0; x<width; x++) {
+        const int16_t *w = axis->weights + (size_t) x*axis->taps;
+        const int16_t *s = src + 4*axis->first[x];
+        int count = axis->count[x];
+        __m128i sum = _mm_set1_epi32(1 << (WEIGHT_BITS-1));
+
+        /* two pixels by step, paired as in resample_rgb_row() */
+        for(k=0; k<count; k+=2) {
+            __m128i pixels, weights;
+
+            if(k+1 < count) {
+                pixels = _mm_loadu_si128((const __m128i *) (s + 4*k));
+            } else {
+                pixels = _mm_loadl_epi64((const __m128i *) (s + 4*k));
+            }
+            weights = _mm_set1_epi32((k+1 < count ? (int) ((uint32_t) (uint16_t) w[k+1] << 16) : 0) | (uint16_t) w[k]);
+
+            pixels = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, weights));
+        }
+
+        sum = _mm_srai_epi32(sum, WEIGHT_BITS);
+        sum = _mm_max_epi16(_mm_packs_epi32(sum, zero), zero);
+        _mm_storel_epi64((__m128i *) (dst + 4*x), sum);
+    }
+#else
+    for(x=0; x<width; x++) {
+        const int16_t *w = axis->weights + (size_t) x*axis->taps;
+        const int16_t *s = src + 4*axis->first[x];
+        int r = 1 << (WEIGHT_BITS-1), g = r, b = r, a = r;
+
+        for(k=0; k<axis->count[x]; k++) {
+            r += w[k] * s[4*k];
+            g += w[k] * s[4*k+1];
+            b += w[k] * s[4*k+2];
+            a += w[k] * s[4*k+3];
+        }
+        dst[4*x] = clip_premultiplied(r >> WEIGHT_BITS);
+        dst[4*x+1] = clip_premultiplied(g >> WEIGHT_BITS);
+        dst[4*x+2] = clip_premultiplied(b >> WEIGHT_BITS);
+        dst[4*x+3] = clip_premultiplied(a >> WEIGHT_BITS);
+    }
+#endif
+}
+
+
+/** resample vertically the output row "y" of "n" premultiplied samples (see resample_column()) */
+static void resample_premultiplied_column(const resample_axis_t *axis, int y, const int16_t *src, int srcFirst,
+    size_t n, int16_t *dst) {
+
+    const int16_t *w = axis->weights + (size_t) y*axis->taps;
+    const int16_t *rows = src + (size_t) (axis->first[y] - srcFirst)*n;
+    int count = axis->count[y];
+    size_t i = 0;
+    int k;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi32(1 << (WEIGHT_BITS-1));
+
+    for(; i+8<=n; i+=8) {
+        __m128i lo = round, hi = round;
+
+        for(k=0; k<count; k+=2) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (rows + k*n + i));
+            __m128i b = k+1 < count ? _mm_loadu_si128((const __m128i *) (rows + (k+1)*n + i)) : zero;
+            __m128i weights = _mm_set1_epi32((k+1 < count ? (int) ((uint32_t) (uint16_t) w[k+1] << 16) : 0) | (uint16_t) w[k]);
+
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+        }
+
+        lo = _mm_srai_epi32(lo, WEIGHT_BITS);
+        hi = _mm_srai_epi32(hi, WEIGHT_BITS);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_max_epi16(_mm_packs_epi32(lo, hi), zero));
+    }
+#endif
+
+    for(; i<n; i++) {
+        int v = 1 << (WEIGHT_BITS-1);
+
+        for(k=0; k<count; k++) {
+            v += w[k] * rows[k*n + i];
+        }
+        dst[i] = clip_premultiplied(v >> WEIGHT_BITS);
+    }
+}
+
+
+/**
+ * Divide back the colours of a row of premultiplied pixels by their
+ * alpha. The negative lobes of the filters can leave a colour above its
+ * alpha : it is clamped to it first, as the other samples are to 255.
+ */
+static void unpremultiply_row(const int16_t *src, unsigned char *rgb, unsigned char *alpha, int width) {
+
+    int x, c;
+
+    for(x=0; x<width; x++) {
+        unsigned int a = src[3] < 255 << 7 ? src[3] : 255 << 7;
+        unsigned int limit = a * 255 / 256; /* the premultiplied sample of a colour of 255 */
+
+        alpha[x] = (a + 64) >> 7;
+        for(c=0; c<3; c++) {
+            unsigned int v = (unsigned int) src[c] < limit ? (unsigned int) src[c] : limit;
+            rgb[c] = a > 0 ? (v * 256 + a/2) / a : 0;
+        }
+        src += 4;
+        rgb += 3;
+    }
+}
+
+
+/**
+ * Task resampling the band "index" of an image with transparent pixels,
+ * as resize_band() does.
+ */
+static void resize_premultiplied_band(void *data, int index) {
+
+    resize_job_t *job = data;
+    const yImage *src = job->src;
+    int y0 = index * RESIZE_BAND_ROWS;
+    int y1 = y0 + RESIZE_BAND_ROWS < job->height ? y0 + RESIZE_BAND_ROWS : job->height;
+    int srcFirst = y0, srcLast = y1;
+    size_t rowSize = (size_t) job->width*4;
+    int16_t *band, *row;
+    int y;
+
+    if(job->vertical != NULL) {
+        srcFirst = job->vertical->first[y0];
+        srcLast = srcFirst;
+        for(y=y0; y<y1; y++) {
+            int last = job->vertical->first[y] + job->vertical->count[y];
+            if(last > srcLast) srcLast = last;
+        }
+    }
+
+    band = malloc((size_t) (srcLast-srcFirst) * rowSize * sizeof(int16_t));
+    row = malloc((size_t) (src->rgbWidth > job->width ? src->rgbWidth : job->width) * 4 * sizeof(int16_t));
+
+    if(band == NULL || row == NULL) {
+        job->failed = 1;
+        free(band);
+        free(row);
+        return;
+    }
+
+    /* horizontal pass */
+    for(y=srcFirst; y<srcLast; y++) {
+        const unsigned char *s = src->rgbData + (size_t) y*src->rgbWidth*3;
+        const unsigned char *a = src->alphaChanel + (size_t) y*src->rgbWidth;
+        int16_t *d = band + (size_t) (y-srcFirst)*rowSize;
+
+        if(job->horizontal != NULL) {
+            premultiply_row(s, a, row, src->rgbWidth);
+            resample_premultiplied_row(job->horizontal, row, d, job->width);
+        } else {
+            premultiply_row(s, a, d, src->rgbWidth);
+        }
+    }
+
+    /* vertical pass */
+    for(y=y0; y<y1; y++) {
+        const int16_t *s = band + (size_t) (y-srcFirst)*rowSize;
+
+        if(job->vertical != NULL) {
+            resample_premultiplied_column(job->vertical, y, band, srcFirst, rowSize, row);
+            s = row;
+        }
+        unpremultiply_row(s, job->rgb + (size_t) y*job->width*3, job->alpha + (size_t) y*job->width, job->width);
+    }
+
+    free(band);
+    free(row);
+}
+
+
+
+/** \return 1 if some pixels are not opaque */
+static int has_transparency(const yImage *im) {
+
+    size_t i, nb = (size_t) im->rgbWidth*im->rgbHeight;
+
+    if(im->alphaChanel == NULL) return 0;
+    for(i=0; i<nb; i++) {
+        if(im->alphaChanel[i] != 255) return 1;
+    }
+    return 0;
+}
+
+
+
+/************************************************************/
+/*                   INVERSE MAPPING                        */
+/************************************************************/
+
+
+/** a warp of an image, by rows of tiles */
+typedef struct {
+    const yImage *src;
+    int width, height; /* size of the output */
+    unsigned char *rgb; /* output planes */
+    unsigned char *alpha;
+    double m[9]; /* projective map of the output coordinates to the source ones */
+    int perspective; /* unset when the last row of m is 0 0 1 */
+    int bilinear;
+    int transparency; /* set when the source has transparent pixels */
+} warp_job_t;
+
+
+/** invert the 3x3 matrix "m", \return 0 in case of success */
+static int invert_matrix(const double m[9], double inv[9]) {
+
+    double det;
+    int i;
+
+    inv[0] = m[4]*m[8] - m[5]*m[7];
+    inv[1] = m[2]*m[7] - m[1]*m[8];
+    inv[2] = m[1]*m[5] - m[2]*m[4];
+    inv[3] = m[5]*m[6] - m[3]*m[8];
+    inv[4] = m[0]*m[8] - m[2]*m[6];
+    inv[5] = m[2]*m[3] - m[0]*m[5];
+    inv[6] = m[3]*m[7] - m[4]*m[6];
+    inv[7] = m[1]*m[6] - m[0]*m[7];
+    inv[8] = m[0]*m[4] - m[1]*m[3];
+
+    det = m[0]*inv[0] + m[1]*inv[3] + m[2]*inv[6];
+    if(det == 0.0 || det != det) return 1;
+
+    for(i=0; i<9; i++) {
+        inv[i] /= det;
+    }
+    return 0;
+}
+
+
+/** restrict [*x0,*x1[ to the integers x where a + b*x >= 0 */
+static void clip_span(double a, double b, int *x0, int *x1) {
+
+    double limit;
+
+    if(b == 0.0) {
+        if(a < 0.0) *x1 = *x0;
+        return;
+    }
+
+    limit = -a / b;
+    if(b > 0.0) {
+        if(limit > *x0) *x0 = limit >= *x1 ? *x1 : (int) ceil(limit);
+    } else {
+        if(limit < *x1 - 1) *x1 = limit < *x0 ? *x0 : (int) floor(limit) + 1;
+    }
+}
+
+
+/** the source pixel nearest to (u, v), in 16.16 coordinates of the pixels' centers */
+static void sample_nearest(const warp_job_t *job, int64_t u, int64_t v, unsigned char *rgb, unsigned char *alpha) {
+
+    const yImage *src = job->src;
+    int64_t x = (u + 0x8000) >> 16, y = (v + 0x8000) >> 16;
+    size_t i;
+
+    if(x < 0) x = 0;
+    if(x >= src->rgbWidth) x = src->rgbWidth-1;
+    if(y < 0) y = 0;
+    if(y >= src->rgbHeight) y = src->rgbHeight-1;
+
+    i = (size_t) y*src->rgbWidth + x;
+    rgb[0] = src->rgbData[3*i];
+    rgb[1] = src->rgbData[3*i+1];
+    rgb[2] = src->rgbData[3*i+2];
+    *alpha = src->alphaChanel != NULL ? src->alphaChanel[i] : 255;
+}
+
+
+/** the bilinear interpolation of the source at (u, v), in 16.16 coordinates of the pixels' centers */
+static void sample_bilinear(const warp_job_t *job, int64_t u, int64_t v, unsigned char *rgb, unsigned char *alpha) {
+
+    const yImage *src = job->src;
+    int64_t maxU = (int64_t) (src->rgbWidth-1) << 16, maxV = (int64_t) (src->rgbHeight-1) << 16;
+    unsigned int fx, fy, w[4];
+    size_t i[4];
+    int x, y, dx, dy, k, c;
+
+    if(u < 0) u = 0;
+    if(u > maxU) u = maxU;
+    if(v < 0) v = 0;
+    if(v > maxV) v = maxV;
+
+    x = (int) (u >> 16);
+    y = (int) (v >> 16);
+    fx = (u >> 8) & 0xFF;
+    fy = (v >> 8) & 0xFF;
+    dx = x+1 < src->rgbWidth ? 1 : 0;
+    dy = y+1 < src->rgbHeight ? src->rgbWidth : 0;
+
+    i[0] = (size_t) y*src->rgbWidth + x;
+    i[1] = i[0] + dx;
+    i[2] = i[0] + dy;
+    i[3] = i[2] + dx;
+    w[0] = (256-fx) * (256-fy);
+    w[1] = fx * (256-fy);
+    w[2] = (256-fx) * fy;
+    w[3] = fx * fy;
+
+    if(!job->transparency) {
+        for(c=0; c<3; c++) {
+            unsigned int sum = 0x8000;
+            for(k=0; k<4; k++) sum += w[k] * src->rgbData[3*i[k]+c];
+            rgb[c] = sum >> 16;
+        }
+        *alpha = src->alphaChanel != NULL ? src->alphaChanel[i[0]] : 255;
+        return;
+    }
+
+    /* the colours are weighted by their alpha, so that the transparent pixels don't tint their neighbours */
+    {
+        uint64_t weight = 0;
+        for(k=0; k<4; k++) {
+            w[k] *= src->alphaChanel[i[k]];
+            weight += w[k];
+        }
+        for(c=0; c<3; c++) {
+            uint64_t sum = weight / 2;
+            for(k=0; k<4; k++) sum += (uint64_t) w[k] * src->rgbData[3*i[k]+c];
+            rgb[c] = weight > 0 ? sum / weight : 0;
+        }
+        *alpha = (weight + 0x8000) >> 16;
+    }
+}
+
+
+/** warp the output pixels [x0,x1[ of the row y */
+static void warp_span(const warp_job_t *job, int y, int x0, int x1) {
+
+    const double *m = job->m;
+    double cy = y + 0.5;
+    size_t row = (size_t) y*job->width;
+    int x = x0;
+
+    /* the source is inside the image where 0 <= X/W < width and 0 <= Y/W < height, with W > 0 */
+    double ax = m[1]*cy + m[2], ay = m[4]*cy + m[5], aw = m[7]*cy + m[8];
+
+    clip_span(aw + 0.5*m[6] - WARP_MIN_W, m[6], &x0, &x1);
+    clip_span(ax + 0.5*m[0], m[0], &x0, &x1);
+    clip_span(job->src->rgbWidth*(aw + 0.5*m[6]) - (ax + 0.5*m[0]), job->src->rgbWidth*m[6] - m[0], &x0, &x1);
+    clip_span(ay + 0.5*m[3], m[3], &x0, &x1);
+    clip_span(job->src->rgbHeight*(aw + 0.5*m[6]) - (ay + 0.5*m[3]), job->src->rgbHeight*m[6] - m[3], &x0, &x1);
+
+    for(x=x0; x<x1; ) {
+        int end = job->perspective && x + WARP_SPAN < x1 ? x + WARP_SPAN : x1;
+        double cx0 = x + 0.5, cx1 = end - 0.5;
+        double w0 = m[6]*cx0 + aw, w1 = m[6]*cx1 + aw;
+        int64_t u, v, du, dv;
+
+        /* the coordinates of the pixels' centers, in 16.16 fixed point */
+        u = llround(((m[0]*cx0 + ax) / w0 - 0.5) * 65536.0);
+        v = llround(((m[3]*cx0 + ay) / w0 - 0.5) * 65536.0);
+        if(job->perspective) {
+            /* linear steps up to the exact coordinates of the last pixel of the span */
+            du = end-1 > x ? (llround(((m[0]*cx1 + ax) / w1 - 0.5) * 65536.0) - u) / (end-1 - x) : 0;
+            dv = end-1 > x ? (llround(((m[3]*cx1 + ay) / w1 - 0.5) * 65536.0) - v) / (end-1 - x) : 0;
+        } else {
+            du = llround(m[0] * 65536.0);
+            dv = llround(m[3] * 65536.0);
+        }
+
+        for(; x<end; x++) {
+            if(job->bilinear) sample_bilinear(job, u, v, job->rgb + 3*(row + x), job->alpha + row + x);
+            else sample_nearest(job, u, v, job->rgb + 3*(row + x), job->alpha + row + x);
+            u += du;
+            v += dv;
+        }
+    }
+}
+
+
+/** task warping the row of tiles "index" */
+static void warp_tiles(void *data, int index) {
+
+    const warp_job_t *job = data;
+    int y0 = index * TILE_SIZE;
+    int y1 = y0 + TILE_SIZE < job->height ? y0 + TILE_SIZE : job->height;
+    int tx, y;
+
+    for(tx=0; tx<job->width; tx+=TILE_SIZE) {
+        int x1 = tx + TILE_SIZE < job->width ? tx + TILE_SIZE : job->width;
+
+        for(y=y0; y<y1; y++) {
+            warp_span(job, y, tx, x1);
+        }
+    }
+}
+
+
+/** warp with the projective map "matrix" of the source to the output, \return 0 or an error code */
+static int warp_image(yImage *im, const double matrix[9], int width, int height, yResizeFilter filter) {
+
+    warp_job_t job;
+    int err, i;
+
+    if(im == NULL || width <= 0 || height <= 0) return -1;
+
+    memset(&job, 0, sizeof(job));
+    if(invert_matrix(matrix, job.m)) return -1;
+
+    /*
+     * A matrix and its multiples map the same points. The sign is chosen
+     * to make W positive at the center of the output : the sources with
+     * W <= 0 are then the ones behind the viewpoint, which are clipped.
+     */
+    if(job.m[6]*0.5*width + job.m[7]*0.5*height + job.m[8] < 0.0) {
+        for(i=0; i<9; i++) {
+            job.m[i] = -job.m[i];
+        }
+    }
+
+    /* the pixels of the shape color are mixed with their neighbours : they need a real alpha */
+    job.bilinear = filter != Y_FILTER_NEAREST;
+    if(job.bilinear && im->alphaChanel == NULL && im->hasShapeColor) {
+        err = y_add_alpha_channel(im);
+        if(err) return err;
+    }
+
+    job.src = im;
+    job.width = width;
+    job.height = height;
+    job.perspective = job.m[6] != 0.0 || job.m[7] != 0.0;
+    job.transparency = job.bilinear && has_transparency(im);
+
+    /* the output pixels without source stay transparent */
+    job.rgb = calloc((size_t) 3*width, height);
+    job.alpha = calloc((size_t) width, height);
+    if(job.rgb == NULL || job.alpha == NULL) {
+        free(job.rgb);
+        free(job.alpha);
+        return ERR_ALLOCATE_FAIL;
+    }
+
+    y_parallel_for((height + TILE_SIZE - 1) / TILE_SIZE, (size_t) width*height < RESIZE_MIN_PARALLEL ? 1 : 0,
+        warp_tiles, &job);
+
+    y_release_rgb_data(im);
+    free(im->alphaChanel);
+    im->rgbData = job.rgb;
+    im->alphaChanel = job.alpha;
+    im->rgbWidth = width;
+    im->rgbHeight = height;
+
+    return 0;
+}
+
+
+
+/************************************************************/
+/*                   IMAGES TRANSFORMATIONS                 */
+/************************************************************/
+
+
+/** transposition with optional flips of the source, see transpose_plane() */
+static int transpose_image(yImage *im, int flipX, int flipY) {
+
+    unsigned char *rgb, *alpha = NULL;
+    int tmp;
+
+    if(im == NULL) return -1;
+
+    if(im->rgbWidth == im->rgbHeight) {
+        transpose_square_plane(im->rgbData, im->rgbWidth, 3);
+        if(im->alphaChanel != NULL) transpose_square_plane(im->alphaChanel, im->rgbWidth, 1);
+        if(flipX) y_flip_v(im);
+        if(flipY) y_flip_h(im);
+        return 0;
+    }
+
+    rgb = malloc((size_t) 3*im->rgbWidth*im->rgbHeight);
+    if(rgb == NULL) return ERR_ALLOCATE_FAIL;
+
+    if(im->alphaChanel != NULL) {
+        alpha = malloc((size_t) im->rgbWidth*im->rgbHeight);
+        if(alpha == NULL) {
+            free(rgb);
+            return ERR_ALLOCATE_FAIL;
+        }
+        transpose_plane(im->alphaChanel, alpha, im->rgbWidth, im->rgbHeight, 1, flipX, flipY);
+        free(im->alphaChanel);
+        im->alphaChanel = alpha;
+    }
+
+    transpose_plane(im->rgbData, rgb, im->rgbWidth, im->rgbHeight, 3, flipX, flipY);
+    y_release_rgb_data(im);
+    im->rgbData = rgb;
+
+    tmp = im->rgbWidth;
+    im->rgbWidth = im->rgbHeight;
+    im->rgbHeight = tmp;
+
+    return 0;
+}
+
+
+int y_transpose(yImage *im) {
+    return transpose_image(im, 0, 0);
+}
+
+
+int y_rotate90(yImage *im) {
+    return transpose_image(im, 1, 0);
+}
+
+
+int y_rotate270(yImage *im) {
+    return transpose_image(im, 0, 1);
+}
+
+
+int y_rotate180(yImage *im) {
+
+    size_t nb;
+
+    if(im == NULL) return -1;
+
+    nb = (size_t) im->rgbWidth*im->rgbHeight;
+    reverse_pixels(im->rgbData, nb, 3);
+    if(im->alphaChanel != NULL) reverse_pixels(im->alphaChanel, nb, 1);
+
+    return 0;
+}
+
+
+int y_flip_h(yImage *im) {
+
+    if(im == NULL) return -1;
+
+    flip_h_plane(im->rgbData, im->rgbWidth, im->rgbHeight, 3);
+    if(im->alphaChanel != NULL) flip_h_plane(im->alphaChanel, im->rgbWidth, im->rgbHeight, 1);
+
+    return 0;
+}
+
+
+int y_flip_v(yImage *im) {
+
+    if(im == NULL) return -1;
+
+    flip_v_plane(im->rgbData, im->rgbWidth, im->rgbHeight, 3);
+    if(im->alphaChanel != NULL) flip_v_plane(im->alphaChanel, im->rgbWidth, im->rgbHeight, 1);
+
+    return 0;
+}
+
+
+int y_resize(yImage *im, int width, int height, yResizeFilter filter) {
+
+    resize_job_t job;
+    resample_axis_t horizontal, vertical;
+    yTask task;
+    int nbBands, nbThreads, x, err = 0;
+
+    if(im == NULL || width <= 0 || height <= 0) return -1;
+    if(width == im->rgbWidth && height == im->rgbHeight) return 0;
+
+    /* the pixels of the shape color are mixed with their neighbours : they need a real alpha */
+    if(filter != Y_FILTER_NEAREST && im->alphaChanel == NULL && im->hasShapeColor) {
+        err = y_add_alpha_channel(im);
+        if(err) return err;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.src = im;
+    job.filter = filter;
+    job.width = width;
+    job.height = height;
+
+    job.rgb = malloc((size_t) 3*width*height);
+    if(im->alphaChanel != NULL) job.alpha = malloc((size_t) width*height);
+    if(job.rgb == NULL || (im->alphaChanel != NULL && job.alpha == NULL)) {
+        free(job.rgb);
+        free(job.alpha);
+        return ERR_ALLOCATE_FAIL;
+    }
+
+    if(filter == Y_FILTER_NEAREST) {
+        job.nearestX = malloc(width * sizeof(int));
+        if(job.nearestX == NULL) {
+            err = ERR_ALLOCATE_FAIL;
+        } else {
+            for(x=0; x<width; x++) {
+                job.nearestX[x] = (int) (((2*(int64_t) x + 1) * im->rgbWidth) / (2*(int64_t) width));
+            }
+        }
+    } else {
+        /* an axis keeping its size is copied */
+        if(width != im->rgbWidth) {
+            if(init_axis(&horizontal, filter, im->rgbWidth, width)) err = ERR_ALLOCATE_FAIL;
+            else job.horizontal = &horizontal;
+        }
+        if(!err && height != im->rgbHeight) {
+            if(init_axis(&vertical, filter, im->rgbHeight, height)) err = ERR_ALLOCATE_FAIL;
+            else job.vertical = &vertical;
+        }
+    }
+
+    if(!err) {
+        nbBands = (height + RESIZE_BAND_ROWS - 1) / RESIZE_BAND_ROWS;
+        nbThreads = (size_t) width*height < RESIZE_MIN_PARALLEL ? 1 : 0;
+        if(filter == Y_FILTER_NEAREST) task = resize_nearest_band;
+        else if(has_transparency(im)) task = resize_premultiplied_band;
+        else task = resize_band;
+        y_parallel_for(nbBands, nbThreads, task, &job);
+        if(job.failed) err = ERR_ALLOCATE_FAIL;
+    }
+
+    if(job.horizontal != NULL) release_axis(job.horizontal);
+    if(job.vertical != NULL) release_axis(job.vertical);
+    free(job.nearestX);
+
+    if(err) {
+        free(job.rgb);
+        free(job.alpha);
+        return err;
+    }
+
+    y_release_rgb_data(im);
+    free(im->alphaChanel);
+    im->rgbData = job.rgb;
+    im->alphaChanel = job.alpha;
+    im->rgbWidth = width;
+    im->rgbHeight = height;
+
+    return 0;
+}
+
+
+int y_warp_affine(yImage *im, const double matrix[6], int width, int height, yResizeFilter filter) {
+
+    double projective[9];
+
+    memcpy(projective, matrix, 6 * sizeof(double));
+    projective[6] = 0.0;
+    projective[7] = 0.0;
+    projective[8] = 1.0;
+
+    return warp_image(im, projective, width, height, filter);
+}
+
+
+int y_warp_perspective(yImage *im, const double matrix[9], int width, int height, yResizeFilter filter) {
+    return warp_image(im, matrix, width, height, filter);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2009-2017 Yannick Garcia <thaddeus.dupont@free.fr>
+ *
+ * yImage is free software; you can redistribute it and/or modify
+ * it under the terms of the GPL license. See LICENSE for details.
+ */
+
+/**
+ * \file yTransform.h
+ * \brief geometric transformations of images.
+ *
+ * The transformations modify the image given as parameter. When the
+ * geometry allows it (flips, half turn, or quarter turns of a square
+ * image) the pixels are moved in place, otherwise new data arrays
+ * replace the old ones.
+ */
+
+#ifndef Y_TRANSFORM_H_
+#define Y_TRANSFORM_H_
+
+#include "yImage.h"
+
+
+/**
+ * \brief Filters of the resampling.
+ */
+typedef enum {
+    Y_FILTER_NEAREST=0, /**< the nearest source pixel : fast, no new colours */
+    Y_FILTER_BILINEAR, /**< linear interpolation, or average of the covered pixels when reducing */
+    Y_FILTER_BICUBIC, /**< cubic convolution (Keys, a = -0.5) : sharper than bilinear */
+    Y_FILTER_LANCZOS /**< Lanczos, 3 lobes : the sharpest, for photos */
+} yResizeFilter;
+
+
+/**
+ * \brief Rotate an image by 90 degrees counter-clockwise.
+ * \param im the image to transform
+ * \return 0 in case of success, or a negative error code
+ */
+int y_rotate90(yImage *im);
+
+
+/**
+ * \brief Rotate an image by 180 degrees.
+ * \param im the image to transform
+ * \return 0 in case of success, or a negative error code
+ */
+int y_rotate180(yImage *im);
+
+
+/**
+ * \brief Rotate an image by 270 degrees counter-clockwise (90 degrees
+ * clockwise).
+ * \param im the image to transform
+ * \return 0 in case of success, or a negative error code
+ */
+int y_rotate270(yImage *im);
+
+
+/**
+ * \brief Mirror an image horizontally : left border becomes right border.
+ * \param im the image to transform
+ * \return 0 in case of success, or a negative error code
+ */
+int y_flip_h(yImage *im);
+
+
+/**
+ * \brief Mirror an image vertically : top border becomes bottom border.
+ * \param im the image to transform
+ * \return 0 in case of success, or a negative error code
+ */
+int y_flip_v(yImage *im);
+
+
+/**
+ * \brief Transpose an image : the pixel (x,y) goes to (y,x).
+ * \param im the image to transform
+ * \return 0 in case of success, or a negative error code
+ */
+int y_transpose(yImage *im);
+
+
+/**
+ * \brief Resize an image.
+ *
+ * Except for the nearest pixel filter, each output pixel is a weighted
+ * sum of source pixels. When the image is reduced, the filter is widened
+ * to cover all the source pixels, which avoids aliasing. The colours of
+ * the transparent pixels are weighted by their alpha, so that they don't
+ * leak on the edges of the opaque areas. An image with a shape color and
+ * no alpha channel gets one. The large images are resampled on several
+ * threads.
+ * \param im the image to transform
+ * \param width the new width
+ * \param height the new height
+ * \param filter the resampling filter
+ * \return 0 in case of success, or a negative error code
+ */
+int y_resize(yImage *im, int width, int height, yResizeFilter filter);
+
+
+/**
+ * \brief Apply an affine transformation to an image.
+ *
+ * The source pixel (x, y) goes to the output position
+ * (m[0]*x + m[1]*y + m[2], m[3]*x + m[4]*y + m[5]), in coordinates where
+ * the pixel (0, 0) covers [0,1[ x [0,1[. For example, the rotation of an
+ * angle a around the center (cx, cy) is
+ * { cos a, -sin a, cx - cx*cos a + cy*sin a, sin a, cos a, cy - cx*sin a - cy*cos a }.
+ * The output pixels whose source is outside of the image are
+ * transparent : the image gets an alpha channel. The output is sampled
+ * with the nearest pixel, or bilinearly with the other filters.
+ * \param im the image to transform
+ * \param matrix the transformation m, from the source to the output
+ * \param width the width of the output
+ * \param height the height of the output
+ * \param filter Y_FILTER_NEAREST, or an interpolating filter for bilinear
+ * sampling
+ * \return 0 in case of success, or a negative error code (-1 if the
+ * matrix can't be inverted)
+ */
+int y_warp_affine(yImage *im, const double matrix[6], int width, int height, yResizeFilter filter);
+
+
+/**
+ * \brief Apply a perspective transformation to an image.
+ *
+ * The source pixel (x, y) goes to the output position
+ * ((m[0]*x + m[1]*y + m[2]) / w, (m[3]*x + m[4]*y + m[5]) / w), with
+ * w = m[6]*x + m[7]*y + m[8]. Otherwise, see y_warp_affine().
+ * \param im the image to transform
+ * \param matrix the 3x3 transformation m, from the source to the output,
+ * by rows
+ * \param width the width of the output
+ * \param height the height of the output
+ * \param filter Y_FILTER_NEAREST, or an interpolating filter for bilinear
+ * sampling
+ * \return 0 in case of success, or a negative error code (-1 if the
+ * matrix can't be inverted)
+ */
+int y_warp_perspective(yImage *im, const double matrix[9], int width, int height, yResizeFilter filter);
+
+
+#endif